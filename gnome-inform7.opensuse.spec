@@ -106,6 +106,7 @@ find %{buildroot} -type f -name "*.la" -delete -print
 %files -f %{name}.lang
 %defattr(-,root,root)
 %{_bindir}/%{name}
+%{_bindir}/i7-skein-check
 %{_libdir}/%{name}
 %ifarch x86_64
 %{_prefix}/lib/%{name}
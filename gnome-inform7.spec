@@ -137,6 +137,7 @@ rm -rf %{buildroot}
 %lang(fr) %{_datadir}/locale/fr/LC_MESSAGES/%{name}.mo
 %lang(nl) %{_datadir}/locale/nl/LC_MESSAGES/%{name}.mo
 %{_bindir}/gnome-inform7
+%{_bindir}/i7-skein-check
 %{pkglibexecdir}/cBlorb
 %{pkgdocdir}/cBlorb/Complete.html
 %{pkgdocdir}/cBlorb/crumbs.gif
@@ -154,6 +155,7 @@ rm -rf %{buildroot}
 %{pkgdocdir}/inform6/*.txt
 %{pkgdocdir}/inform6/ReleaseNotes.html
 %{pkglibexecdir}/ni
+%{pkglibexecdir}/i7-replay
 
 %changelog
 * Sun Jan 10 2016 Philip Chimento <philip.chimento@gmail.com> - 6M62-1
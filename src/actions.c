@@ -141,11 +141,12 @@ action_import_into_skein(GtkAction *action, I7Story *story)
 	/* Ask the user for a file to import */
 	/* TRANSLATORS: File->Import Into Skein... */
 	GtkWidget *dialog = gtk_file_chooser_dialog_new(
-	  _("Select the file to import into the skein"),
+	  _("Select the files to import into the skein"),
 	  GTK_WINDOW(story),
 	  GTK_FILE_CHOOSER_ACTION_OPEN, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
 	  GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT, NULL);
 	gtk_window_set_position(GTK_WINDOW(dialog), GTK_WIN_POS_CENTER_ON_PARENT);
+	gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
 	/* Create appropriate file filters */
 	GtkFileFilter *filter1 = gtk_file_filter_new();
 	gtk_file_filter_set_name(filter1, _("Interpreter recording files (*.rec)"));
@@ -161,18 +162,24 @@ action_import_into_skein(GtkAction *action, I7Story *story)
 		return;
 	}
 
-	GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(dialog));
+	GSList *files = gtk_file_chooser_get_files(GTK_FILE_CHOOSER(dialog));
 	gtk_widget_destroy(dialog);
-	if(!file)
+	if(!files)
 		return; /* Fail silently */
 
-	/* Provide some visual feedback that the command did something */
-	if(!i7_skein_import(i7_story_get_skein(story), file, &err))
-		error_dialog_file_operation(GTK_WINDOW(story), file, err, I7_FILE_ERROR_OPEN, NULL);
-	else
+	/* Import all the files at once, so that they are laid out only once */
+	if(!i7_skein_import_files(i7_story_get_skein(story), files, &err)) {
+		if(files->next == NULL)
+			error_dialog_file_operation(GTK_WINDOW(story), files->data, err, I7_FILE_ERROR_OPEN, NULL);
+		else
+			error_dialog(GTK_WINDOW(story), err, _("The files could not be imported into the skein: "));
+	} else {
+		/* Provide some visual feedback that the command did something */
 		i7_story_show_pane(story, I7_PANE_SKEIN);
+	}
 
-	g_object_unref(file);
+	g_slist_foreach(files, (GFunc)g_object_unref, NULL);
+	g_slist_free(files);
 }
 
 /* File->Save */
@@ -1034,6 +1041,7 @@ void
 action_show_last_command(GtkAction *action, I7Story *story)
 {
 	I7Skein *skein = i7_story_get_skein(story);
+	i7_story_flush_transcript(story);
 	i7_story_show_node_in_transcript(story, i7_skein_get_played_node(skein));
 	i7_story_show_pane(story, I7_PANE_TRANSCRIPT);
 }
@@ -1043,6 +1051,7 @@ void
 action_show_last_command_skein(GtkAction *action, I7Story *story)
 {
 	I7Skein *skein = i7_story_get_skein(story);
+	i7_story_flush_transcript(story);
 	g_signal_emit_by_name(skein, "show-node", I7_REASON_USER_ACTION, i7_skein_get_played_node(skein));
 	i7_story_show_pane(story, I7_PANE_SKEIN);
 }
@@ -0,0 +1,308 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "build-cache.h"
+
+/* A record of the last successful run of each stage of the compiler tool chain,
+ so that a stage can be skipped if it would get exactly the same input again.
+ Each stage's inputs are summed up in a key; the key is stored in the Build
+ folder together with the size and modification time of each of the stage's
+ output files. If the key matches the next time, and the output files haven't
+ been touched since, then the outputs are still the ones that the stage would
+ produce, and they are used as they are. */
+
+#define CACHE_FILE_NAME "build-cache.ini"
+#define TREE_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+	G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+/*
+ * i7_build_cache_key_new:
+ * @stage: the name of the compiler stage
+ *
+ * Starts a key for the inputs of @stage. Add the inputs with the
+ * i7_build_cache_key_add functions.
+ *
+ * Returns: (transfer full): a new #GChecksum.
+ */
+GChecksum *
+i7_build_cache_key_new(const char *stage)
+{
+	GChecksum *key = g_checksum_new(G_CHECKSUM_SHA1);
+	i7_build_cache_key_add_string(key, stage);
+	return key;
+}
+
+/* Adds @string to @key, including its terminating nul byte so that "ab", "c"
+ and "a", "bc" give different keys */
+void
+i7_build_cache_key_add_string(GChecksum *key, const char *string)
+{
+	if(string == NULL)
+		string = "";
+	g_checksum_update(key, (const guchar *)string, strlen(string) + 1);
+}
+
+/* Adds each string of the NULL-terminated array @strv to @key, for example a
+ command line */
+void
+i7_build_cache_key_add_strv(GChecksum *key, char **strv)
+{
+	char **iter;
+	for(iter = strv; *iter; iter++)
+		i7_build_cache_key_add_string(key, *iter);
+	i7_build_cache_key_add_string(key, NULL);
+}
+
+/* Adds the contents of @file to @key; a missing file counts as different from
+ an empty one */
+void
+i7_build_cache_key_add_contents(GChecksum *key, GFile *file)
+{
+	char *contents;
+	gsize length;
+	if(!g_file_load_contents(file, NULL, &contents, &length, NULL, NULL)) {
+		i7_build_cache_key_add_string(key, "missing");
+		return;
+	}
+	i7_build_cache_key_add_string(key, "contents");
+	g_checksum_update(key, (const guchar *)contents, length);
+	g_free(contents);
+}
+
+/* Describes the file in @info by its size and modification time */
+static char *
+get_signature(GFileInfo *info)
+{
+	return g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ".%06u",
+		g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_STANDARD_SIZE),
+		g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+}
+
+/* Returns the signature of @file, or NULL if it doesn't exist */
+static char *
+get_file_signature(GFile *file)
+{
+	GFileInfo *info = g_file_query_info(file, TREE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if(info == NULL)
+		return NULL;
+	char *retval = get_signature(info);
+	g_object_unref(info);
+	return retval;
+}
+
+static int
+compare_file_info_names(GFileInfo **a, GFileInfo **b)
+{
+	return strcmp(g_file_info_get_name(*a), g_file_info_get_name(*b));
+}
+
+static void
+add_tree_info(GChecksum *key, GFile *file, GFileInfo *info, GFile *except)
+{
+	i7_build_cache_key_add_string(key, g_file_info_get_name(info));
+
+	/* A folder's own modification time changes whenever something is added to
+	 it or removed from it, including things in @except, so folders are only
+	 described by what is in them */
+	if(g_file_info_get_file_type(info) != G_FILE_TYPE_DIRECTORY) {
+		char *signature = get_signature(info);
+		i7_build_cache_key_add_string(key, signature);
+		g_free(signature);
+		return;
+	}
+	i7_build_cache_key_add_string(key, "folder");
+
+	GFileEnumerator *children = g_file_enumerate_children(file, TREE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if(children == NULL)
+		return;
+	GPtrArray *infos = g_ptr_array_new_with_free_func(g_object_unref);
+	GFileInfo *child_info;
+	while((child_info = g_file_enumerator_next_file(children, NULL, NULL)) != NULL)
+		g_ptr_array_add(infos, child_info);
+	g_file_enumerator_close(children, NULL, NULL);
+	g_object_unref(children);
+
+	/* The order in which the files are listed isn't guaranteed */
+	g_ptr_array_sort(infos, (GCompareFunc)compare_file_info_names);
+	guint ix;
+	for(ix = 0; ix < infos->len; ix++) {
+		child_info = infos->pdata[ix];
+		GFile *child = g_file_get_child(file, g_file_info_get_name(child_info));
+		if(except == NULL || !g_file_equal(child, except))
+			add_tree_info(key, child, child_info, except);
+		g_object_unref(child);
+	}
+	i7_build_cache_key_add_string(key, NULL);
+	g_ptr_array_free(infos, TRUE);
+}
+
+/*
+ * i7_build_cache_key_add_tree:
+ * @key: a key started with i7_build_cache_key_new()
+ * @file: a file or folder
+ *
+ * Adds the names, sizes and modification times of @file and, if it is a
+ * folder, everything in it, to @key. This is much cheaper than reading the
+ * contents, so use it for large inputs like the installed extensions.
+ */
+void
+i7_build_cache_key_add_tree(GChecksum *key, GFile *file)
+{
+	i7_build_cache_key_add_tree_except(key, file, NULL);
+}
+
+/*
+ * i7_build_cache_key_add_tree_except:
+ * @key: a key started with i7_build_cache_key_new()
+ * @file: a file or folder
+ * @except: a file or folder inside @file to leave out, or %NULL
+ *
+ * Like i7_build_cache_key_add_tree(), but leaves out @except and everything
+ * in it. Use this when a stage writes its output inside one of its inputs.
+ */
+void
+i7_build_cache_key_add_tree_except(GChecksum *key, GFile *file, GFile *except)
+{
+	GFileInfo *info = g_file_query_info(file, TREE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if(info == NULL) {
+		i7_build_cache_key_add_string(key, "missing");
+		return;
+	}
+	add_tree_info(key, file, info, except);
+	g_object_unref(info);
+}
+
+static GKeyFile *
+load_cache_file(GFile *builddir_file)
+{
+	GKeyFile *keyfile = g_key_file_new();
+	GFile *cache_file = g_file_get_child(builddir_file, CACHE_FILE_NAME);
+	char *path = g_file_get_path(cache_file);
+	/* Ignore errors; a missing or broken cache is just empty */
+	g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL);
+	g_free(path);
+	g_object_unref(cache_file);
+	return keyfile;
+}
+
+/*
+ * i7_build_cache_lookup:
+ * @builddir_file: the project's Build folder
+ * @stage: the name of the compiler stage
+ * @key: the key for the inputs @stage would get now
+ * @outputs: NULL-terminated array of the files that @stage writes
+ * @data: (allow-none): return location for the extra data stored with the
+ * outputs, or %NULL
+ *
+ * Checks whether @stage last ran successfully with the same inputs, and its
+ * outputs are still exactly as it left them.
+ *
+ * Returns: %TRUE if @stage can be skipped.
+ */
+gboolean
+i7_build_cache_lookup(GFile *builddir_file, const char *stage, GChecksum *key, GFile **outputs, char **data)
+{
+	GKeyFile *keyfile = load_cache_file(builddir_file);
+	gboolean retval = FALSE;
+
+	char *stored_key = g_key_file_get_string(keyfile, stage, "key", NULL);
+	gsize n_signatures;
+	char **signatures = g_key_file_get_string_list(keyfile, stage, "outputs", &n_signatures, NULL);
+	if(stored_key == NULL || signatures == NULL || strcmp(stored_key, g_checksum_get_string(key)) != 0)
+		goto finally;
+
+	gsize ix;
+	for(ix = 0; outputs[ix]; ix++) {
+		if(ix >= n_signatures)
+			goto finally;
+		char *signature = get_file_signature(outputs[ix]);
+		gboolean same = signature && strcmp(signature, signatures[ix]) == 0;
+		g_free(signature);
+		if(!same)
+			goto finally;
+	}
+	if(ix != n_signatures)
+		goto finally;
+
+	if(data)
+		*data = g_key_file_get_string(keyfile, stage, "data", NULL);
+	retval = TRUE;
+
+finally:
+	g_strfreev(signatures);
+	g_free(stored_key);
+	g_key_file_free(keyfile);
+	return retval;
+}
+
+/*
+ * i7_build_cache_store:
+ * @builddir_file: the project's Build folder
+ * @stage: the name of the compiler stage
+ * @key: the key for the inputs that @stage just ran with
+ * @outputs: NULL-terminated array of the files that @stage wrote
+ * @data: (allow-none): extra data to store with the outputs, or %NULL
+ *
+ * Records that @stage ran successfully with the inputs described by @key.
+ * Only call this after the stage succeeds.
+ */
+void
+i7_build_cache_store(GFile *builddir_file, const char *stage, GChecksum *key, GFile **outputs, const char *data)
+{
+	GKeyFile *keyfile = load_cache_file(builddir_file);
+
+	GPtrArray *signatures = g_ptr_array_new_with_free_func(g_free);
+	gboolean complete = TRUE;
+	GFile **iter;
+	for(iter = outputs; *iter && complete; iter++) {
+		char *signature = get_file_signature(*iter);
+		if(signature)
+			g_ptr_array_add(signatures, signature);
+		else
+			complete = FALSE;
+	}
+
+	g_key_file_remove_group(keyfile, stage, NULL);
+	/* If the stage didn't write all of its outputs, don't remember it */
+	if(complete) {
+		g_key_file_set_string(keyfile, stage, "key", g_checksum_get_string(key));
+		g_key_file_set_string_list(keyfile, stage, "outputs", (const char * const *)signatures->pdata, signatures->len);
+		if(data)
+			g_key_file_set_string(keyfile, stage, "data", data);
+	}
+	g_ptr_array_free(signatures, TRUE);
+
+	gsize length;
+	char *contents = g_key_file_to_data(keyfile, &length, NULL);
+	GFile *cache_file = g_file_get_child(builddir_file, CACHE_FILE_NAME);
+	/* Ignore errors; the stage will just run again next time */
+	g_file_replace_contents(cache_file, contents, length, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL);
+	g_object_unref(cache_file);
+	g_free(contents);
+	g_key_file_free(keyfile);
+}
@@ -0,0 +1,35 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BUILD_CACHE_H_
+#define _BUILD_CACHE_H_
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+GChecksum *i7_build_cache_key_new(const char *stage);
+void i7_build_cache_key_add_string(GChecksum *key, const char *string);
+void i7_build_cache_key_add_strv(GChecksum *key, char **strv);
+void i7_build_cache_key_add_contents(GChecksum *key, GFile *file);
+void i7_build_cache_key_add_tree(GChecksum *key, GFile *file);
+void i7_build_cache_key_add_tree_except(GChecksum *key, GFile *file, GFile *except);
+gboolean i7_build_cache_lookup(GFile *builddir_file, const char *stage, GChecksum *key, GFile **outputs, char **data);
+void i7_build_cache_store(GFile *builddir_file, const char *stage, GChecksum *key, GFile **outputs, const char *data);
+
+#endif /* _BUILD_CACHE_H_ */
@@ -78,6 +78,8 @@ typedef enum {
 #define PREFS_CLEAN_BUILD_FILES    "clean-build-files"
 #define PREFS_CLEAN_INDEX_FILES    "clean-index-files"
 #define PREFS_SHOW_DEBUG_LOG       "show-debug-log"
+#define PREFS_BACKGROUND_COMPILE   "background-compile"
+#define PREFS_BACKGROUND_COMPILE_DELAY "background-compile-delay"
 
 #define PREFS_STATE_SPELL_CHECK       "spell-check"
 #define PREFS_STATE_SHOW_TOOLBAR      "show-toolbar"
@@ -291,6 +291,73 @@ make_directory_unless_exists(GFile *file, GCancellable *cancellable, GError **er
 	return retval;
 }
 
+/**
+ * copy_directory_tree:
+ * @source: a #GFile pointing to a directory.
+ * @dest: a #GFile pointing to the directory to copy it to.
+ * @error: return location for an error, or %NULL.
+ *
+ * Copies everything in @source into @dest, creating @dest if needed and
+ * overwriting files that are already there. Symbolic links are copied as links.
+ *
+ * Returns: %TRUE on success, %FALSE if @error was set.
+ */
+gboolean
+copy_directory_tree(GFile *source, GFile *dest, GError **error)
+{
+	if(!make_directory_unless_exists(dest, NULL, error))
+		return FALSE;
+
+	GFileEnumerator *dir = g_file_enumerate_children(source, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, error);
+	if(dir == NULL)
+		return FALSE;
+
+	gboolean retval = TRUE;
+	GFileInfo *info;
+	while(retval && (info = g_file_enumerator_next_file(dir, NULL, NULL)) != NULL) {
+		const char *name = g_file_info_get_name(info);
+		GFile *source_child = g_file_get_child(source, name);
+		GFile *dest_child = g_file_get_child(dest, name);
+		if(g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+			retval = copy_directory_tree(source_child, dest_child, error);
+		else
+			retval = g_file_copy(source_child, dest_child, G_FILE_COPY_OVERWRITE | G_FILE_COPY_NOFOLLOW_SYMLINKS, NULL, NULL, NULL, error);
+		g_object_unref(source_child);
+		g_object_unref(dest_child);
+		g_object_unref(info);
+	}
+	g_file_enumerator_close(dir, NULL, NULL);
+	g_object_unref(dir);
+	return retval;
+}
+
+/**
+ * delete_directory_tree:
+ * @file: a #GFile.
+ *
+ * Deletes @file and, if it is a directory, everything in it. Symbolic links
+ * are deleted, not followed. Ignores errors and cannot be canceled.
+ */
+void
+delete_directory_tree(GFile *file)
+{
+	if(g_file_query_file_type(file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY) {
+		GFileEnumerator *dir = g_file_enumerate_children(file, G_FILE_ATTRIBUTE_STANDARD_NAME, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+		if(dir) {
+			GFileInfo *info;
+			while((info = g_file_enumerator_next_file(dir, NULL, NULL)) != NULL) {
+				GFile *child = g_file_get_child(file, g_file_info_get_name(info));
+				delete_directory_tree(child);
+				g_object_unref(child);
+				g_object_unref(info);
+			}
+			g_file_enumerator_close(dir, NULL, NULL);
+			g_object_unref(dir);
+		}
+	}
+	g_file_delete(file, NULL, NULL); /* ignore errors */
+}
+
 /**
  * file_exists_and_is_dir:
  * @file: a #GFile.
@@ -31,6 +31,8 @@ void set_source_text(GtkSourceBuffer *buffer, gchar *text);
 void delete_build_files(I7Story *story);
 GFile *get_case_insensitive_extension(GFile *file);
 gboolean make_directory_unless_exists(GFile *file, GCancellable *cancellable, GError **error);
+gboolean copy_directory_tree(GFile *source, GFile *dest, GError **error);
+void delete_directory_tree(GFile *file);
 gboolean file_exists_and_is_dir(GFile *file);
 gboolean file_exists_and_is_symlink(GFile *file);
 char *file_get_display_name(GFile *file);
@@ -20,6 +20,7 @@
 #include <string.h>
 
 #include <cairo.h>
+#include <gio/gio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <goocanvas.h>
@@ -30,6 +31,26 @@
 #include "transcript-diff.h"
 
 #define DIFFERS_BADGE_RADIUS 8.0
+/* Texts loaded from a file that are longer than this are kept compressed until
+they are first needed */
+#define PACK_THRESHOLD 256
+/* Children are looked up by command in a hash table once a knot has this many */
+#define CHILD_INDEX_THRESHOLD 8
+/* Texts shorter than this, together, are compared on the main thread */
+#define DIFF_INLINE_THRESHOLD 4096
+/* Number of threads comparing texts in the background */
+#define DIFF_POOL_THREADS 4
+/* Number of comparison results remembered in case the same texts come up again */
+#define DIFF_CACHE_SIZE 512
+
+/* The outcome of comparing an expected text with a transcript text. Shared
+between all the knots with the same texts, and the diff cache. */
+typedef struct {
+	volatile gint ref_count;
+	I7NodeMatchType match;
+	GArray *expected_diffs; /* guint indices of words that differ */
+	GArray *transcript_diffs;
+} DiffResult;
 
 enum {
 	PROP_0,
@@ -60,16 +81,30 @@ typedef struct _I7NodePrivate {
 	gchar *label; /* Author's annotation that appears above this knot */
 	gchar *transcript_text; /* Response produced by the game to this command */
 	gchar *expected_text; /* Response the author thinks should be produced */
+	GBytes *transcript_bytes; /* Owns transcript_text, see take_text() */
+	GBytes *expected_bytes; /* Owns expected_text */
+	GBytes *transcript_packed; /* Compressed transcript text, if not unpacked yet */
+	gsize transcript_packed_len; /* Uncompressed length of transcript_packed */
+	GBytes *expected_packed; /* Compressed expected text, if not unpacked yet */
+	gsize expected_packed_len; /* Uncompressed length of expected_packed */
 	gboolean changed; /* Whether the response changed since last time this knot was played */
 	gboolean blessed; /* Whether this knot has an expected response */
 	gboolean played; /* Whether this knot is currently in the thread being played */
 	gboolean locked; /* Whether this knot is protected from automatic trimming */
 	gint score; /* The inverse likelihood of this knot being trimmed */
 
+	/* Children by command, built once there are enough children to need it */
+	GHashTable *child_index;
+
+	/* Serialized <item> element, kept until something in it changes */
+	GBytes *xml_fragment;
+	GPtrArray *xml_children; /* Children listed in xml_fragment */
+
 	/* Diffs */
+	gboolean diffs_valid;
+	guint diff_generation; /* To recognize results that are out of date */
 	I7NodeMatchType match;
-	GList *transcript_diffs;
-	GList *expected_diffs;
+	DiffResult *diffs; /* NULL if no diffs or still pending */
 	char *transcript_pango_string;
 	char *expected_pango_string;
 
@@ -99,6 +134,59 @@ G_DEFINE_TYPE(I7Node, i7_node, GOO_TYPE_CANVAS_GROUP_MODEL);
 
 /* STATIC FUNCTIONS */
 
+/* Throw away the cached XML for this node; call whenever anything that is
+saved in the skein file changes */
+static void
+invalidate_xml(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	if(priv->xml_fragment) {
+		g_bytes_unref(priv->xml_fragment);
+		priv->xml_fragment = NULL;
+	}
+}
+
+/* Records @child under its command in the child index, if there is one */
+static void
+child_index_add(I7Node *self, I7Node *child)
+{
+	I7_NODE_USE_PRIVATE;
+	if(!priv->child_index)
+		return;
+	const gchar *command = I7_NODE_PRIVATE(child)->command;
+	GPtrArray *children = g_hash_table_lookup(priv->child_index, command);
+	if(!children) {
+		children = g_ptr_array_new();
+		g_hash_table_insert(priv->child_index, g_strdup(command), children);
+	}
+	g_ptr_array_add(children, child);
+}
+
+/* Removes @child, which was recorded under @command, from the child index */
+static void
+child_index_remove(I7Node *self, I7Node *child, const gchar *command)
+{
+	I7_NODE_USE_PRIVATE;
+	if(!priv->child_index)
+		return;
+	GPtrArray *children = g_hash_table_lookup(priv->child_index, command);
+	if(!children)
+		return;
+	g_ptr_array_remove(children, child);
+	if(children->len == 0)
+		g_hash_table_remove(priv->child_index, command);
+}
+
+static void
+build_child_index(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	GNode *gnode;
+	priv->child_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+	for(gnode = self->gnode->children; gnode; gnode = gnode->next)
+		child_index_add(self, gnode->data);
+}
+
 static void
 draw_differs_badge(I7Node *self)
 {
@@ -141,6 +229,9 @@ static void
 update_node_background(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
+	/* Nothing to do if the knot has never been shown */
+	if(priv->command_shape_item == NULL)
+		return;
 	g_object_set(priv->command_shape_item,
 		"fill-pattern", priv->node_pattern[SELECT_PATTERN(priv->played, priv->blessed)],
 		NULL);
@@ -150,6 +241,154 @@ update_node_background(I7Node *self)
 		g_object_set(priv->badge_item, "visibility", GOO_CANVAS_ITEM_HIDDEN, NULL);
 }
 
+/* Converts all newline separators in @text to \n, in place if possible.
+Takes ownership of @text and returns the converted string. */
+static gchar *
+normalize_newlines(gchar *text)
+{
+	if(strstr(text, "\r\n")) {
+		gchar **lines = g_strsplit(text, "\r\n", 0);
+		g_free(text);
+		text = g_strjoinv("\n", lines);
+		g_strfreev(lines);
+	}
+	return g_strdelimit(text, "\r", '\n');
+}
+
+/* Compresses @len bytes of @text. Returns NULL if that doesn't save anything. */
+static GBytes *
+pack_text(const char *text, gsize len)
+{
+	GConverter *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+	gsize bufsize = len + len / 8 + 64; /* more than zlib's worst case */
+	guint8 *buf = g_malloc(bufsize);
+	gsize bytes_read, bytes_written;
+
+	GConverterResult result = g_converter_convert(compressor, text, len,
+		buf, bufsize, G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, NULL);
+	g_object_unref(compressor);
+
+	if(result != G_CONVERTER_FINISHED || bytes_written >= len) {
+		g_free(buf);
+		return NULL;
+	}
+	return g_bytes_new_take(g_realloc(buf, bytes_written), bytes_written);
+}
+
+/* Decompresses text packed by pack_text() into a newly allocated string */
+static gchar *
+unpack_text(GBytes *packed, gsize len)
+{
+	GConverter *decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+	gchar *text = g_malloc(len + 1);
+	gsize size, bytes_read, bytes_written = 0;
+	gconstpointer data = g_bytes_get_data(packed, &size);
+
+	GConverterResult result = g_converter_convert(decompressor, data, size,
+		text, len, G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, NULL);
+	g_object_unref(decompressor);
+
+	if(result != G_CONVERTER_FINISHED)
+		g_warning("Packed transcript text was corrupted");
+	text[bytes_written] = '\0';
+	return text;
+}
+
+/* Replaces @text with @value, taking ownership of @value. The text is owned by
+@bytes, so that it can be handed to another thread (see get_stored_text())
+without copying it. */
+static void
+take_text(gchar **text, GBytes **bytes, gchar *value)
+{
+	if(*bytes)
+		g_bytes_unref(*bytes);
+	*text = value;
+	*bytes = value? g_bytes_new_with_free_func(value, strlen(value), g_free, value) : NULL;
+}
+
+/* Stores @value either in @text, or compressed in @packed if it is long */
+static void
+restore_text(gchar **text, GBytes **bytes, GBytes **packed, gsize *packed_len, const gchar *value)
+{
+	gsize len = value? strlen(value) : 0;
+
+	take_text(text, bytes, NULL);
+	if(*packed)
+		g_bytes_unref(*packed);
+	*packed = NULL;
+
+	if(len > PACK_THRESHOLD)
+		*packed = pack_text(value, len);
+	if(*packed)
+		*packed_len = len;
+	else
+		take_text(text, bytes, normalize_newlines(g_strdup(value? value : "")));
+}
+
+/* Returns the transcript text, unpacking it first if it is still compressed */
+static const gchar *
+get_transcript(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	if(priv->transcript_packed) {
+		take_text(&priv->transcript_text, &priv->transcript_bytes,
+			normalize_newlines(unpack_text(priv->transcript_packed, priv->transcript_packed_len)));
+		g_bytes_unref(priv->transcript_packed);
+		priv->transcript_packed = NULL;
+	}
+	return priv->transcript_text;
+}
+
+/* Returns the expected text, unpacking it first if it is still compressed */
+static const gchar *
+get_expected(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	if(priv->expected_packed) {
+		take_text(&priv->expected_text, &priv->expected_bytes,
+			normalize_newlines(unpack_text(priv->expected_packed, priv->expected_packed_len)));
+		g_bytes_unref(priv->expected_packed);
+		priv->expected_packed = NULL;
+	}
+	return priv->expected_text;
+}
+
+static DiffResult *
+diff_result_ref(DiffResult *result)
+{
+	g_atomic_int_inc(&result->ref_count);
+	return result;
+}
+
+static void
+diff_result_unref(DiffResult *result)
+{
+	if(g_atomic_int_dec_and_test(&result->ref_count)) {
+		g_array_free(result->expected_diffs, TRUE);
+		g_array_free(result->transcript_diffs, TRUE);
+		g_slice_free(DiffResult, result);
+	}
+}
+
+/* Compares the texts. Doesn't touch any knots, so may be called from any
+thread. */
+static DiffResult *
+compute_diff_result(const char *expected, const char *transcript)
+{
+	DiffResult *result = g_slice_new0(DiffResult);
+	result->ref_count = 1;
+	result->expected_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+	result->transcript_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	if(word_diff_indices(expected, transcript, result->expected_diffs, result->transcript_diffs))
+		result->match = I7_NODE_EXACT_MATCH;
+	else if(result->expected_diffs->len > 0 || result->transcript_diffs->len > 0)
+		result->match = I7_NODE_NO_MATCH;
+	else
+		result->match = I7_NODE_NEAR_MATCH;
+	return result;
+}
+
 static void
 clear_diffs(I7Node *self)
 {
@@ -157,16 +396,200 @@ clear_diffs(I7Node *self)
 	
 	g_free(priv->transcript_pango_string);
 	g_free(priv->expected_pango_string);
-	g_list_free(priv->transcript_diffs);
-	g_list_free(priv->expected_diffs);
+	if(priv->diffs)
+		diff_result_unref(priv->diffs);
 	
+	priv->diffs_valid = FALSE;
+	priv->diff_generation++; /* any comparison still running is out of date */
 	priv->match = I7_NODE_CANT_COMPARE;
-	priv->transcript_diffs = NULL;
+	priv->diffs = NULL;
 	priv->transcript_pango_string = NULL;
-	priv->expected_diffs = NULL;
 	priv->expected_pango_string = NULL;
 }
 
+/* BACKGROUND COMPARISON */
+
+/* Long texts are compared on a pool of worker threads, so that replaying a
+whole skein doesn't hold up the user interface. The knot's match type is
+I7_NODE_DIFF_PENDING until the result comes back. Results are kept in a cache
+keyed by a checksum of the two texts, since the same texts tend to be compared
+over and over again when replaying. Finished comparisons are collected and
+handed back to the main thread in batches, in one idle callback. */
+
+typedef struct {
+	I7Node *node;
+	guint generation;
+	GBytes *transcript;
+	gsize transcript_packed_len;
+	GBytes *expected;
+	gsize expected_packed_len;
+	DiffResult *result;
+} DiffJob;
+
+static GThreadPool *diff_pool = NULL;
+static GMutex diff_cache_lock;
+static GHashTable *diff_cache = NULL; /* checksum string -> DiffResult */
+static GQueue diff_cache_order = G_QUEUE_INIT; /* keys, oldest first */
+static GMutex diff_results_lock;
+static GPtrArray *diff_results = NULL; /* finished DiffJobs */
+static gboolean diff_results_posted = FALSE;
+
+static void
+free_diff_job(DiffJob *job)
+{
+	g_object_unref(job->node);
+	g_bytes_unref(job->transcript);
+	g_bytes_unref(job->expected);
+	if(job->result)
+		diff_result_unref(job->result);
+	g_slice_free(DiffJob, job);
+}
+
+/* Gets a text from the bytes handed to a job */
+static gchar *
+unpack_stored_text(GBytes *stored, gsize packed_len)
+{
+	if(packed_len)
+		return normalize_newlines(unpack_text(stored, packed_len));
+	gsize size;
+	gconstpointer data = g_bytes_get_data(stored, &size);
+	return g_strndup(data, size);
+}
+
+static gchar *
+make_diff_key(const char *expected, const char *transcript)
+{
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	/* Include the terminating zero, so that where one text ends and the
+	 other begins makes a difference */
+	g_checksum_update(checksum, (const guchar *)expected, strlen(expected) + 1);
+	g_checksum_update(checksum, (const guchar *)transcript, strlen(transcript));
+	gchar *key = g_strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	return key;
+}
+
+/* Looks up a result in the cache; must be called with diff_cache_lock held */
+static DiffResult *
+diff_cache_lookup(const gchar *key)
+{
+	if(!diff_cache)
+		return NULL;
+	DiffResult *result = g_hash_table_lookup(diff_cache, key);
+	return result? diff_result_ref(result) : NULL;
+}
+
+/* Adds a result to the cache, throwing out the oldest one if it is full; must
+be called with diff_cache_lock held. Takes ownership of @key. */
+static void
+diff_cache_add(gchar *key, DiffResult *result)
+{
+	if(!diff_cache)
+		diff_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)diff_result_unref);
+	if(g_hash_table_lookup(diff_cache, key)) {
+		/* Another thread got there first */
+		g_free(key);
+		return;
+	}
+	if(g_queue_get_length(&diff_cache_order) >= DIFF_CACHE_SIZE)
+		g_hash_table_remove(diff_cache, g_queue_pop_head(&diff_cache_order));
+	g_hash_table_insert(diff_cache, key, diff_result_ref(result));
+	g_queue_push_tail(&diff_cache_order, key);
+}
+
+static gboolean post_diff_results(gpointer unused);
+
+/* Runs on a worker thread */
+static void
+run_diff_job(DiffJob *job, gpointer unused)
+{
+	gchar *transcript = unpack_stored_text(job->transcript, job->transcript_packed_len);
+	gchar *expected = unpack_stored_text(job->expected, job->expected_packed_len);
+	gchar *key = make_diff_key(expected, transcript);
+
+	g_mutex_lock(&diff_cache_lock);
+	job->result = diff_cache_lookup(key);
+	g_mutex_unlock(&diff_cache_lock);
+
+	if(job->result)
+		g_free(key);
+	else {
+		job->result = compute_diff_result(expected, transcript);
+		g_mutex_lock(&diff_cache_lock);
+		diff_cache_add(key, job->result);
+		g_mutex_unlock(&diff_cache_lock);
+	}
+	g_free(transcript);
+	g_free(expected);
+
+	g_mutex_lock(&diff_results_lock);
+	if(!diff_results)
+		diff_results = g_ptr_array_new();
+	g_ptr_array_add(diff_results, job);
+	if(!diff_results_posted) {
+		diff_results_posted = TRUE;
+		gdk_threads_add_idle(post_diff_results, NULL);
+	}
+	g_mutex_unlock(&diff_results_lock);
+}
+
+static void
+queue_diff_job(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+
+	DiffJob *job = g_slice_new0(DiffJob);
+	job->node = g_object_ref(self);
+	job->generation = priv->diff_generation;
+	job->transcript = i7_node_get_stored_transcript(self, &job->transcript_packed_len);
+	job->expected = i7_node_get_stored_expected(self, &job->expected_packed_len);
+
+	if(!diff_pool)
+		diff_pool = g_thread_pool_new((GFunc)run_diff_job, NULL, DIFF_POOL_THREADS, FALSE, NULL);
+	g_thread_pool_push(diff_pool, job, NULL);
+}
+
+/* Runs on the main thread; hands the finished comparisons to their knots */
+static gboolean
+post_diff_results(gpointer unused)
+{
+	g_mutex_lock(&diff_results_lock);
+	GPtrArray *jobs = diff_results;
+	diff_results = NULL;
+	diff_results_posted = FALSE;
+	g_mutex_unlock(&diff_results_lock);
+
+	unsigned ix;
+	for(ix = 0; jobs && ix < jobs->len; ix++) {
+		DiffJob *job = g_ptr_array_index(jobs, ix);
+		I7Node *self = job->node;
+		I7_NODE_USE_PRIVATE;
+
+		/* Skip it if the texts changed in the meantime */
+		if(job->generation == priv->diff_generation) {
+			priv->diffs = diff_result_ref(job->result);
+			priv->match = job->result->match;
+			/* The Pango strings were made without the diffs */
+			g_free(priv->transcript_pango_string);
+			g_free(priv->expected_pango_string);
+			priv->transcript_pango_string = NULL;
+			priv->expected_pango_string = NULL;
+			update_node_background(self);
+			/* Always notify, so that the new highlighting gets shown */
+			g_object_notify(G_OBJECT(self), "match");
+		}
+		free_diff_job(job);
+	}
+	if(jobs)
+		g_ptr_array_free(jobs, TRUE);
+
+	return FALSE; /* one-shot */
+}
+
+/* Works out the match type and the word diffs. The Pango strings are only
+built when they are asked for, so that nodes which are never shown in the
+Transcript don't need their text unpacked. Long texts are compared in the
+background. */
 static void
 calculate_diffs(I7Node *self)
 {
@@ -178,26 +601,36 @@ calculate_diffs(I7Node *self)
 
 	if(!i7_node_get_blessed(self))
 		priv->match = I7_NODE_CANT_COMPARE;
-	else if(!word_diff(priv->expected_text, priv->transcript_text, &priv->expected_diffs, &priv->transcript_diffs)) {
-		if(priv->expected_diffs || priv->transcript_diffs)
-			priv->match = I7_NODE_NO_MATCH;
-		else
-			priv->match = I7_NODE_NEAR_MATCH;
-	} else
-		priv->match = I7_NODE_EXACT_MATCH;
-
-	if(priv->match == I7_NODE_NO_MATCH) {
-		priv->transcript_pango_string = make_pango_markup_string(priv->transcript_text, priv->transcript_diffs);
-		priv->expected_pango_string = make_pango_markup_string(priv->expected_text, priv->expected_diffs);
+	else if(priv->transcript_packed && priv->expected_packed
+		&& priv->transcript_packed_len == priv->expected_packed_len
+		&& g_bytes_equal(priv->transcript_packed, priv->expected_packed))
+		priv->match = I7_NODE_EXACT_MATCH; /* identical, no need to unpack */
+	else if(!priv->transcript_packed && !priv->expected_packed
+		&& strlen(priv->transcript_text) + strlen(priv->expected_text) < DIFF_INLINE_THRESHOLD) {
+		priv->diffs = compute_diff_result(priv->expected_text, priv->transcript_text);
+		priv->match = priv->diffs->match;
 	} else {
-		priv->transcript_pango_string = g_markup_escape_text(priv->transcript_text? priv->transcript_text : "", -1);
-		priv->expected_pango_string = g_markup_escape_text(priv->expected_text? priv->expected_text : "", -1);
+		priv->match = I7_NODE_DIFF_PENDING;
+		queue_diff_job(self);
 	}
 
+	priv->diffs_valid = TRUE;
+
 	if(old_match_status != priv->match)
 		g_object_notify(G_OBJECT(self), "match");
 }
 
+/* Builds the Pango markup for @text, highlighting @diffs if the texts didn't
+match */
+static char *
+make_pango_string(I7Node *self, const char *text, GArray *diffs)
+{
+	I7_NODE_USE_PRIVATE;
+	if(priv->match == I7_NODE_NO_MATCH)
+		return make_pango_markup_string_indices(text, (const guint *)diffs->data, diffs->len);
+	return g_markup_escape_text(text? text : "", -1);
+}
+
 static void
 transcript_modified(I7Node *self)
 {
@@ -237,18 +670,16 @@ i7_node_set_expected_text(I7Node *self, const gchar *text)
 {
 	I7_NODE_USE_PRIVATE;
 
-	g_free(priv->expected_text);
-	priv->expected_text = g_strdup(text? text : ""); /* silently accept NULL */
+	gchar *new_text = g_strdup(text? text : ""); /* silently accept NULL */
 
-	/* Change newline separators to \n */
-	if(strstr(priv->expected_text, "\r\n")) {
-		gchar **lines = g_strsplit(priv->expected_text, "\r\n", 0);
-		g_free(priv->expected_text);
-		priv->expected_text = g_strjoinv("\n", lines);
-		g_strfreev(lines);
+	if(priv->expected_packed) {
+		g_bytes_unref(priv->expected_packed);
+		priv->expected_packed = NULL;
 	}
-	priv->expected_text = g_strdelimit(priv->expected_text, "\r", '\n');
+	/* Change newline separators to \n */
+	take_text(&priv->expected_text, &priv->expected_bytes, normalize_newlines(new_text));
 	priv->blessed = !(strlen(priv->expected_text) == 0);
+	invalidate_xml(self);
 
 	transcript_modified(self);
 
@@ -271,6 +702,7 @@ i7_node_set_changed(I7Node *self, gboolean changed)
 
 	gboolean old_changed_status = priv->changed;
 	priv->changed = changed;
+	invalidate_xml(self);
 
 	if(old_changed_status != changed)
 		g_object_notify(G_OBJECT(self), "changed");
@@ -289,23 +721,16 @@ create_node_pattern(double r, double g, double b)
 	return retval;
 }
 
-/* TYPE SYSTEM */
-
+/* Creates the gradients and canvas items that draw the knot. A skein that is
+ loaded, compared or replayed without being displayed never needs them, so
+ they are made the first time the knot is laid out in a view. */
 static void
-i7_node_init(I7Node *self)
+ensure_canvas_items(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
-	priv->id = g_strdup_printf("node-%p", self);
-	self->gnode = g_node_new(self);
-	self->tree_item = NULL;
-	self->tree_points = goo_canvas_points_new(4);
 
-	priv->blessed = FALSE;
-	priv->match = I7_NODE_CANT_COMPARE;
-	priv->transcript_diffs = NULL;
-	priv->transcript_pango_string = NULL;
-	priv->expected_diffs = NULL;
-	priv->expected_pango_string = NULL;
+	if(priv->command_item)
+		return;
 
 	/* Create the cairo gradients */
 	/* Label */
@@ -331,8 +756,8 @@ i7_node_init(I7Node *self)
 		"stroke-pattern", NULL,
 		"fill-pattern", priv->label_pattern,
 		NULL);
-	priv->command_item = goo_canvas_text_model_new(GOO_CANVAS_ITEM_MODEL(self), "", 0.0, 0.0, -1, GTK_ANCHOR_CENTER, NULL);
-	priv->label_item = goo_canvas_text_model_new(GOO_CANVAS_ITEM_MODEL(self), "", 0.0, 0.0, -1, GTK_ANCHOR_CENTER, NULL);
+	priv->command_item = goo_canvas_text_model_new(GOO_CANVAS_ITEM_MODEL(self), priv->command, 0.0, 0.0, -1, GTK_ANCHOR_CENTER, NULL);
+	priv->label_item = goo_canvas_text_model_new(GOO_CANVAS_ITEM_MODEL(self), priv->label, 0.0, 0.0, -1, GTK_ANCHOR_CENTER, NULL);
 	priv->badge_item = goo_canvas_path_model_new(GOO_CANVAS_ITEM_MODEL(self), "",
 	  "fill-color", "red",
 	  "line-width", 0,
@@ -343,6 +768,45 @@ i7_node_init(I7Node *self)
 	/* Avoid drawing the differs badges unless they're actually needed, otherwise
 	it really slows down the story startup */
 
+	update_node_background(self);
+}
+
+/* TYPE SYSTEM */
+
+static void
+i7_node_init(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	priv->id = g_strdup_printf("node-%p", self);
+	self->gnode = g_node_new(self);
+	self->tree_item = NULL;
+	self->tree_points = NULL;
+	self->tree_style = -1;
+
+	priv->blessed = FALSE;
+	priv->transcript_bytes = NULL;
+	priv->expected_bytes = NULL;
+	priv->transcript_packed = NULL;
+	priv->expected_packed = NULL;
+	priv->child_index = NULL;
+	priv->xml_fragment = NULL;
+	priv->xml_children = g_ptr_array_new();
+	priv->diffs_valid = FALSE;
+	priv->diff_generation = 0;
+	priv->match = I7_NODE_CANT_COMPARE;
+	priv->diffs = NULL;
+	priv->transcript_pango_string = NULL;
+	priv->expected_pango_string = NULL;
+
+	/* The patterns and canvas items are only made when the knot is first
+	shown; see ensure_canvas_items() */
+	priv->label_pattern = NULL;
+	priv->command_item = NULL;
+	priv->label_item = NULL;
+	priv->badge_item = NULL;
+	priv->command_shape_item = NULL;
+	priv->label_shape_item = NULL;
+
 	priv->x = 0.0;
 	priv->command_width = -1.0;
 	priv->command_height = -1.0;
@@ -379,6 +843,7 @@ i7_node_set_property(GObject *self, guint prop_id, const GValue *value, GParamSp
 			break;
 		case PROP_SCORE: /* Construct only */
 			priv->score = g_value_get_int(value);
+			invalidate_xml(I7_NODE(self));
 			g_object_notify(self, "score");
 			break;
 		default:
@@ -399,10 +864,10 @@ i7_node_get_property(GObject *self, guint prop_id, GValue *value, GParamSpec *ps
 			g_value_set_string(value, priv->label);
 			break;
 		case PROP_TRANSCRIPT_TEXT:
-			g_value_set_string(value, priv->transcript_text);
+			g_value_set_string(value, get_transcript(I7_NODE(self)));
 			break;
 		case PROP_EXPECTED_TEXT:
-			g_value_set_string(value, priv->expected_text);
+			g_value_set_string(value, get_expected(I7_NODE(self)));
 			break;
 		case PROP_CHANGED:
 			g_value_set_boolean(value, priv->changed);
@@ -438,21 +903,32 @@ i7_node_finalize(GObject *self)
 {
 	I7_NODE_USE_PRIVATE;
 
-	cairo_pattern_destroy(priv->label_pattern);
-	cairo_pattern_destroy(priv->node_pattern[NODE_UNPLAYED_UNBLESSED]);
-	cairo_pattern_destroy(priv->node_pattern[NODE_UNPLAYED_BLESSED]);
-	cairo_pattern_destroy(priv->node_pattern[NODE_PLAYED_UNBLESSED]);
-	cairo_pattern_destroy(priv->node_pattern[NODE_PLAYED_BLESSED]);
+	if(priv->label_pattern) {
+		int i;
+		cairo_pattern_destroy(priv->label_pattern);
+		for(i = 0; i < NODE_NUM_PATTERNS; i++)
+			cairo_pattern_destroy(priv->node_pattern[i]);
+	}
 	g_free(priv->command);
 	g_free(priv->label);
-	g_free(priv->transcript_text);
-	g_free(priv->expected_text);
+	take_text(&priv->transcript_text, &priv->transcript_bytes, NULL);
+	take_text(&priv->expected_text, &priv->expected_bytes, NULL);
+	if(priv->transcript_packed)
+		g_bytes_unref(priv->transcript_packed);
+	if(priv->expected_packed)
+		g_bytes_unref(priv->expected_packed);
 	g_free(priv->transcript_pango_string);
 	g_free(priv->expected_pango_string);
+	if(priv->xml_fragment)
+		g_bytes_unref(priv->xml_fragment);
+	g_ptr_array_free(priv->xml_children, TRUE);
+	if(priv->child_index)
+		g_hash_table_destroy(priv->child_index);
 	g_free(priv->id);
-	goo_canvas_points_unref(I7_NODE(self)->tree_points);
-	g_list_free(priv->transcript_diffs);
-	g_list_free(priv->expected_diffs);
+	if(I7_NODE(self)->tree_points)
+		goo_canvas_points_unref(I7_NODE(self)->tree_points);
+	if(priv->diffs)
+		diff_result_unref(priv->diffs);
 
 	/* recurse */
 	g_node_children_foreach(I7_NODE(self)->gnode, G_TRAVERSE_ALL, (GNodeForeachFunc)unref_node, NULL);
@@ -511,7 +987,7 @@ i7_node_class_init(I7NodeClass *klass)
 	g_object_class_install_property(object_class, PROP_MATCH,
 	    g_param_spec_int("match", "Match type",
 		    "How this node's transcript and expected text differ",
-		    -1, 2, -1, flags | G_PARAM_READABLE));
+		    -1, 3, -1, flags | G_PARAM_READABLE));
 
 	/* Private data */
 	g_type_class_add_private(klass, sizeof(I7NodePrivate));
@@ -543,15 +1019,31 @@ i7_node_get_command(I7Node *self)
 	return g_strdup(priv->command);
 }
 
+/* Returns the command without copying it; don't free */
+const gchar *
+i7_node_peek_command(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	return priv->command;
+}
+
 void
 i7_node_set_command(I7Node *self, const gchar *command)
 {
 	I7_NODE_USE_PRIVATE;
+	I7Node *parent = self->gnode->parent? self->gnode->parent->data : NULL;
+
+	if(parent)
+		child_index_remove(parent, self, priv->command);
 	g_free(priv->command);
 	priv->command = g_strdup(command? command : ""); /* silently accept NULL */
+	if(parent)
+		child_index_add(parent, self);
+	invalidate_xml(self);
 
 	/* Update the graphics */
-	g_object_set(priv->command_item, "text", priv->command, NULL);
+	if(priv->command_item)
+		g_object_set(priv->command_item, "text", priv->command, NULL);
 	priv->command_width = priv->command_height = -1.0;
 
 	g_object_notify(G_OBJECT(self), "command");
@@ -565,16 +1057,25 @@ i7_node_get_label(I7Node *self)
 	return g_strdup(priv->label);
 }
 
+/* Returns the label without copying it; don't free */
+const gchar *
+i7_node_peek_label(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	return priv->label;
+}
+
 void
 i7_node_set_label(I7Node *self, const gchar *label)
 {
 	I7_NODE_USE_PRIVATE;
 	g_free(priv->label);
 	priv->label = g_strdup(label? label : ""); /* silently accept NULL */
+	invalidate_xml(self);
 
 	/* Update the graphics */
-
-	g_object_set(priv->label_item, "text", priv->label, NULL);
+	if(priv->label_item)
+		g_object_set(priv->label_item, "text", priv->label, NULL);
 	priv->label_width = priv->label_height = -1.0;
 	priv->command_width = priv->command_height = -1.0;
 
@@ -591,8 +1092,7 @@ i7_node_has_label(I7Node *self)
 gchar *
 i7_node_get_transcript_text(I7Node *self)
 {
-	I7_NODE_USE_PRIVATE;
-	return g_strdup(priv->transcript_text);
+	return g_strdup(get_transcript(self));
 }
 
 void
@@ -600,19 +1100,13 @@ i7_node_set_transcript_text(I7Node *self, const gchar *transcript)
 {
 	I7_NODE_USE_PRIVATE;
 
-	char *old_transcript_text = g_strdup(priv->transcript_text? priv->transcript_text : "");
-
-	g_free(priv->transcript_text);
-	priv->transcript_text = g_strdup(transcript? transcript : ""); /* silently accept NULL */
+	const gchar *old = get_transcript(self);
+	char *old_transcript_text = g_strdup(old? old : "");
 
-	/* Change newline separators to \n */
-	if(strstr(priv->transcript_text, "\r\n")) {
-		gchar **lines = g_strsplit(priv->transcript_text, "\r\n", 0);
-		g_free(priv->transcript_text);
-		priv->transcript_text = g_strjoinv("\n", lines);
-		g_strfreev(lines);
-	}
-	priv->transcript_text = g_strdelimit(priv->transcript_text, "\r", '\n');
+	/* silently accept NULL; change newline separators to \n */
+	take_text(&priv->transcript_text, &priv->transcript_bytes,
+		normalize_newlines(g_strdup(transcript? transcript : "")));
+	invalidate_xml(self);
 
 	if(strcmp(old_transcript_text, priv->transcript_text) != 0)
 		i7_node_set_changed(self, TRUE);
@@ -627,9 +1121,129 @@ i7_node_set_transcript_text(I7Node *self, const gchar *transcript)
 
 gchar *
 i7_node_get_expected_text(I7Node *self)
+{
+	return g_strdup(get_expected(self));
+}
+
+/*
+ * i7_node_restore_texts:
+ * @self: the knot
+ * @transcript: transcript text read from a saved skein
+ * @expected: expected text read from a saved skein
+ *
+ * For use while loading a skein. Sets both texts without emitting any
+ * notifications. Long texts are kept compressed and only unpacked when
+ * something asks for them, so a skein with a lot of transcript text doesn't
+ * take up much memory while it is not being looked at.
+ */
+void
+i7_node_restore_texts(I7Node *self, const gchar *transcript, const gchar *expected)
 {
 	I7_NODE_USE_PRIVATE;
-	return g_strdup(priv->expected_text);
+
+	restore_text(&priv->transcript_text, &priv->transcript_bytes, &priv->transcript_packed, &priv->transcript_packed_len, transcript);
+	restore_text(&priv->expected_text, &priv->expected_bytes, &priv->expected_packed, &priv->expected_packed_len, expected);
+	/* Newline conversion never makes a non-empty string empty */
+	priv->blessed = (expected && *expected);
+	invalidate_xml(self);
+
+	transcript_modified(self);
+}
+
+/* Gets a text as it is stored: either the compressed bytes, with the length
+of the text in @packed_len, or the text itself with @packed_len set to 0. Either
+way this only takes a reference, it doesn't copy the text. */
+static GBytes *
+get_stored_text(GBytes *bytes, GBytes *packed, gsize packed_len, gsize *stored_len)
+{
+	if(packed) {
+		*stored_len = packed_len;
+		return g_bytes_ref(packed);
+	}
+	*stored_len = 0;
+	return g_bytes_ref(bytes);
+}
+
+/*
+ * i7_node_get_stored_transcript:
+ * @self: the knot
+ * @packed_len: return location for the length of the unpacked text, or 0 if
+ * the returned bytes are not compressed
+ *
+ * Gets the transcript text without unpacking it, for writing to the skein
+ * cache.
+ *
+ * Returns: (transfer full): an immutable #GBytes, safe to pass to another
+ * thread.
+ */
+GBytes *
+i7_node_get_stored_transcript(I7Node *self, gsize *packed_len)
+{
+	I7_NODE_USE_PRIVATE;
+	return get_stored_text(priv->transcript_bytes, priv->transcript_packed, priv->transcript_packed_len, packed_len);
+}
+
+/*
+ * i7_node_get_stored_expected:
+ * @self: the knot
+ * @packed_len: return location for the length of the unpacked text, or 0 if
+ * the returned bytes are not compressed
+ *
+ * Like i7_node_get_stored_transcript(), but for the expected text.
+ *
+ * Returns: (transfer full): an immutable #GBytes.
+ */
+GBytes *
+i7_node_get_stored_expected(I7Node *self, gsize *packed_len)
+{
+	I7_NODE_USE_PRIVATE;
+	return get_stored_text(priv->expected_bytes, priv->expected_packed, priv->expected_packed_len, packed_len);
+}
+
+/* Stores a text obtained from get_stored_text(), keeping a reference to the
+compressed bytes rather than copying them */
+static void
+restore_stored_text(gchar **text, GBytes **bytes, GBytes **packed, gsize *packed_len, GBytes *stored, gsize stored_len)
+{
+	if(stored_len == 0) {
+		gsize size;
+		gconstpointer data = g_bytes_get_data(stored, &size);
+		gchar *value = g_strndup(data, size);
+		restore_text(text, bytes, packed, packed_len, value);
+		g_free(value);
+		return;
+	}
+
+	take_text(text, bytes, NULL);
+	if(*packed)
+		g_bytes_unref(*packed);
+	*packed = g_bytes_ref(stored);
+	*packed_len = stored_len;
+}
+
+/*
+ * i7_node_restore_stored_texts:
+ * @self: the knot
+ * @transcript: transcript text as returned by i7_node_get_stored_transcript()
+ * @transcript_packed_len: the length that came with @transcript
+ * @expected: expected text as returned by i7_node_get_stored_expected()
+ * @expected_packed_len: the length that came with @expected
+ *
+ * Like i7_node_restore_texts(), but for texts read from the skein cache.
+ * Compressed texts are not copied, so @transcript and @expected can point
+ * into a memory-mapped file.
+ */
+void
+i7_node_restore_stored_texts(I7Node *self, GBytes *transcript, gsize transcript_packed_len, GBytes *expected, gsize expected_packed_len)
+{
+	I7_NODE_USE_PRIVATE;
+
+	restore_stored_text(&priv->transcript_text, &priv->transcript_bytes, &priv->transcript_packed, &priv->transcript_packed_len, transcript, transcript_packed_len);
+	restore_stored_text(&priv->expected_text, &priv->expected_bytes, &priv->expected_packed, &priv->expected_packed_len, expected, expected_packed_len);
+	priv->blessed = (expected_packed_len > 0 || g_bytes_get_size(expected) > 0);
+	invalidate_xml(self);
+
+	transcript_modified(self);
 }
 
 const char *
@@ -637,8 +1251,10 @@ i7_node_get_transcript_pango_string(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
 
-	if(!priv->transcript_pango_string)
+	if(!priv->diffs_valid)
 		calculate_diffs(self);
+	if(!priv->transcript_pango_string)
+		priv->transcript_pango_string = make_pango_string(self, get_transcript(self), priv->diffs? priv->diffs->transcript_diffs : NULL);
 	
 	return priv->transcript_pango_string;
 }
@@ -648,8 +1264,10 @@ i7_node_get_expected_pango_string(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
 
-	if(!priv->expected_pango_string)
+	if(!priv->diffs_valid)
 		calculate_diffs(self);
+	if(!priv->expected_pango_string)
+		priv->expected_pango_string = make_pango_string(self, get_expected(self), priv->diffs? priv->diffs->expected_diffs : NULL);
 	
 	return priv->expected_pango_string;
 }
@@ -659,7 +1277,7 @@ i7_node_get_match_type(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
 
-	if(!priv->expected_pango_string || !priv->transcript_pango_string)
+	if(!priv->diffs_valid)
 		calculate_diffs(self);
 
 	return priv->match;
@@ -681,7 +1299,7 @@ i7_node_get_different(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
 
-	if(!priv->expected_pango_string || !priv->transcript_pango_string)
+	if(!priv->diffs_valid)
 		calculate_diffs(self);
 
 	return (priv->match == I7_NODE_NEAR_MATCH || priv->match == I7_NODE_NO_MATCH);
@@ -706,6 +1324,7 @@ i7_node_set_locked(I7Node *self, gboolean locked)
 {
 	I7_NODE_USE_PRIVATE;
 	priv->locked = locked;
+	invalidate_xml(self);
 	g_object_notify(G_OBJECT(self), "locked");
 }
 
@@ -720,6 +1339,8 @@ void
 i7_node_set_played(I7Node *self, gboolean played)
 {
 	I7_NODE_USE_PRIVATE;
+	if(priv->played != played)
+		invalidate_xml(self);
 	priv->played = played;
 	update_node_background(self);
 	g_object_notify(G_OBJECT(self), "played");
@@ -735,8 +1356,7 @@ i7_node_get_blessed(I7Node *self)
 void
 i7_node_bless(I7Node *self)
 {
-	I7_NODE_USE_PRIVATE;
-	i7_node_set_expected_text(self, priv->transcript_text);
+	i7_node_set_expected_text(self, get_transcript(self));
 }
 
 gint i7_node_get_score(I7Node *self)
@@ -749,6 +1369,7 @@ void i7_node_set_score(I7Node *self, gint score)
 {
 	I7_NODE_USE_PRIVATE;
 	priv->score = score;
+	invalidate_xml(self);
 	g_object_notify(G_OBJECT(self), "score");
 }
 
@@ -794,133 +1415,141 @@ i7_node_is_root(I7Node *self)
 }
 
 /* Is there a child node with the given command? (@command should already be
-escaped.) */
+escaped.) Knots with many children, such as the root, keep an index of their
+children by command, so this doesn't have to compare against each one. */
 I7Node *
 i7_node_find_child(I7Node *self, const gchar *command)
 {
-	I7Node *node = NULL;
-	GNode *gnode = self->gnode->children;
+	I7_NODE_USE_PRIVATE;
+	GNode *gnode;
+
 	/* Special case: NULL is treated as "" */
 	if (!command) {
 		command = "";
 	}
-	while(gnode != NULL) {
-		gchar *cmp_command = i7_node_get_command(I7_NODE(gnode->data));
-		if((strlen(cmp_command) == 0 && strlen(command) == 0) || strcmp(cmp_command, command) == 0) {
-			g_free(cmp_command);
-			node = gnode->data;
-			break;
+
+	if(!priv->child_index) {
+		if(g_node_n_children(self->gnode) < CHILD_INDEX_THRESHOLD) {
+			for(gnode = self->gnode->children; gnode; gnode = gnode->next)
+				if(strcmp(I7_NODE_PRIVATE(gnode->data)->command, command) == 0)
+					return gnode->data;
+			return NULL;
 		}
-		gnode = gnode->next;
-		g_free(cmp_command);
+		build_child_index(self);
 	}
 
-	return node;
-}
-
-/*
- * i7_node_get_next_difference_below:
- * @node: reference node to get next difference from
- *
- * Finds the next difference below @node in the skein.
- * Returns: pointer to next different node.
- */
-I7Node *
-i7_node_get_next_difference_below(I7Node *node) {
-	GNode *child = node->gnode->children;
-
-	if(!child)
+	GPtrArray *children = g_hash_table_lookup(priv->child_index, command);
+	if(!children)
 		return NULL;
+	if(children->len == 1)
+		return g_ptr_array_index(children, 0);
+
+	/* More than one child has this command; return the first one */
+	I7Node *first = NULL;
+	gint first_pos = G_MAXINT;
+	unsigned ix;
+	for(ix = 0; ix < children->len; ix++) {
+		I7Node *child = g_ptr_array_index(children, ix);
+		gint pos = g_node_child_position(self->gnode, child->gnode);
+		if(pos < first_pos) {
+			first = child;
+			first_pos = pos;
+		}
+	}
+	return first;
+}
 
-	do {
-		I7Node *child_node = I7_NODE(child->data);
-		if(i7_node_get_different(child_node))
-			return child_node;
-
-		I7Node *child_diff = i7_node_get_next_difference_below(child_node);
-		if(child_diff)
-			return child_diff;
-	} while((child = child->next));
+/* The following functions must be used instead of the GNode equivalents for
+rearranging the skein, in order to keep the child index up to date. */
 
-	return NULL;
+void
+i7_node_append_child(I7Node *self, I7Node *child)
+{
+	g_node_append(self->gnode, child->gnode);
+	child_index_add(self, child);
 }
 
-/*
- * i7_node_get_next_difference:
- * @node: reference node to get next difference from
- *
- * Finds the next difference (either below @node, or to the right in the skein).
- * Returns: pointer to next different node.
- */
-I7Node *
-i7_node_get_next_difference(I7Node *node)
+void
+i7_node_insert_child(I7Node *self, gint position, I7Node *child)
 {
-	I7Node *diff_below;
-	if((diff_below = i7_node_get_next_difference_below(node)) != NULL)
-		return diff_below;
-
-	/* Iterate up from this point */
-	GNode *top, *our_branch;
-	top = node->gnode;
-
-	while(top) {
-		our_branch = top;
-		top = top->parent;
-
-		while(top && g_node_n_children(top) <= 1) {
-			our_branch = top;
-			top = top->parent;
-		}
-
-		if(!top)
-			return NULL;
-
-		/* Find the item to the right */
-		gboolean found_branch = FALSE;
-		GNode *child = top->children;
-		do {
-			if(child == our_branch) {
-				found_branch = TRUE;
-				break;
-			}
-		} while((child = child->next));
-
-		if(!found_branch)
-			return FALSE;
+	g_node_insert(self->gnode, position, child->gnode);
+	child_index_add(self, child);
+}
 
-		/* See if we can find any differences there */
-		while((child = child->next)) {
-			I7Node *child_node = I7_NODE(child->data);
-			if(i7_node_get_different(child_node))
-				return child_node;
+/* Inserts @child after @sibling, or at the start if @sibling is NULL */
+void
+i7_node_insert_child_after(I7Node *self, I7Node *sibling, I7Node *child)
+{
+	g_node_insert_after(self->gnode, sibling? sibling->gnode : NULL, child->gnode);
+	child_index_add(self, child);
+}
 
-			I7Node *child_diff = i7_node_get_next_difference_below(child_node);
-			if(child_diff)
-				return child_diff;
-		}
-	}
+/* Detaches @self from its parent */
+void
+i7_node_unlink(I7Node *self)
+{
+	I7_NODE_USE_PRIVATE;
+	if(self->gnode->parent)
+		child_index_remove(self->gnode->parent->data, self, priv->command);
+	g_node_unlink(self->gnode);
+}
 
-	return NULL;
+/* Escapes a text for the skein file without leaving it unpacked in memory */
+static gchar *
+escape_stored_text(const gchar *text, GBytes *packed, gsize packed_len)
+{
+	if(!packed)
+		return g_markup_escape_text(text, -1);
+	gchar *unpacked = normalize_newlines(unpack_text(packed, packed_len));
+	gchar *retval = g_markup_escape_text(unpacked, -1);
+	g_free(unpacked);
+	return retval;
 }
 
-static void
-write_child_pointer(GNode *gnode, GString *string)
+/* Whether the children listed in the cached XML are still this node's
+children, in the same order */
+static gboolean
+xml_children_valid(I7Node *self)
 {
-	g_string_append_printf(string, "      <child nodeId=\"%s\"/>\n", I7_NODE_PRIVATE(gnode->data)->id);
+	I7_NODE_USE_PRIVATE;
+	GNode *child;
+	unsigned ix = 0;
+	for(child = self->gnode->children; child; child = child->next, ix++)
+		if(ix >= priv->xml_children->len || g_ptr_array_index(priv->xml_children, ix) != child->data)
+			return FALSE;
+	return ix == priv->xml_children->len;
 }
 
-gchar *
-i7_node_get_xml(I7Node *self)
+/*
+ * i7_node_get_xml_fragment:
+ * @self: the knot
+ *
+ * Gets the <item> element describing this knot in the skein file. The XML is
+ * cached, and only regenerated if the knot or its list of children changed
+ * since last time, so saving a large skein doesn't re-escape all of its
+ * transcript text.
+ *
+ * Returns: (transfer full): a #GBytes containing the XML. It is immutable and
+ * safe to pass to another thread.
+ */
+GBytes *
+i7_node_get_xml_fragment(I7Node *self)
 {
 	I7_NODE_USE_PRIVATE;
 
+	if(priv->xml_fragment && xml_children_valid(self))
+		return g_bytes_ref(priv->xml_fragment);
+
+	invalidate_xml(self);
+	g_ptr_array_set_size(priv->xml_children, 0);
+
 	/* Escape the following strings if necessary */
 	gchar *command = g_markup_escape_text(priv->command, -1);
-	gchar *transcript_text = g_markup_escape_text(priv->transcript_text, -1);
-	gchar *expected_text = g_markup_escape_text(priv->expected_text, -1);
+	gchar *transcript_text = escape_stored_text(priv->transcript_text, priv->transcript_packed, priv->transcript_packed_len);
+	gchar *expected_text = escape_stored_text(priv->expected_text, priv->expected_packed, priv->expected_packed_len);
 	gchar *label = g_markup_escape_text(priv->label, -1);
 
-	GString *string = g_string_new("");
+	GString *string = g_string_sized_new(strlen(transcript_text) + strlen(expected_text) + 512);
 	g_string_append_printf(string, "  <item nodeId=\"%s\">\n", priv->id);
 	g_string_append_printf(string, "    <command xml:space=\"preserve\">%s</command>\n", command);
 	g_string_append_printf(string, "    <result xml:space=\"preserve\">%s</result>\n", transcript_text);
@@ -932,8 +1561,12 @@ i7_node_get_xml(I7Node *self)
 	if(label)
 		g_string_append_printf(string, "    <annotation xml:space=\"preserve\">%s</annotation>\n", label);
 	if(self->gnode->children) {
+		GNode *child;
 		g_string_append(string, "    <children>\n");
-		g_node_children_foreach(self->gnode, G_TRAVERSE_ALL, (GNodeForeachFunc)write_child_pointer, string);
+		for(child = self->gnode->children; child; child = child->next) {
+			g_string_append_printf(string, "      <child nodeId=\"%s\"/>\n", I7_NODE_PRIVATE(child->data)->id);
+			g_ptr_array_add(priv->xml_children, child->data);
+		}
 		g_string_append(string, "    </children>\n");
 	}
 	g_string_append(string, "  </item>\n");
@@ -943,7 +1576,9 @@ i7_node_get_xml(I7Node *self)
 	g_free(expected_text);
 	g_free(label);
 
-	return g_string_free(string, FALSE); /* return cstr */
+	gsize len = string->len;
+	priv->xml_fragment = g_bytes_new_take(g_string_free(string, FALSE), len);
+	return g_bytes_ref(priv->xml_fragment);
 }
 
 gdouble
@@ -1062,6 +1697,8 @@ i7_node_calculate_size(I7Node *self, GooCanvasItemModel *skein, GooCanvas *canva
 	gboolean command_width_changed, command_height_changed;
 	gboolean label_width_changed, label_height_changed;
 
+	ensure_canvas_items(self);
+
 	/* Calculate the bounds of the command text and label text */
 	item = goo_canvas_get_item(canvas, priv->command_item);
 	goo_canvas_item_get_bounds(item, &size);
@@ -1171,6 +1808,7 @@ i7_node_get_command_coordinates(I7Node *self, gint *x, gint *y, GooCanvas *canva
 
 	I7_NODE_USE_PRIVATE;
 
+	ensure_canvas_items(self);
 	return i7_goo_canvas_item_get_onscreen_coordinates(goo_canvas_get_item(canvas, GOO_CANVAS_ITEM_MODEL(priv->command_item)), canvas, x, y);
 }
 
@@ -1182,5 +1820,6 @@ i7_node_get_label_coordinates(I7Node *self, gint *x, gint *y, GooCanvas *canvas)
 
 	I7_NODE_USE_PRIVATE;
 
+	ensure_canvas_items(self);
 	return i7_goo_canvas_item_get_onscreen_coordinates(goo_canvas_get_item(canvas, GOO_CANVAS_ITEM_MODEL(priv->label_item)), canvas, x, y);
 }
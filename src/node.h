@@ -44,6 +44,7 @@ struct _I7Node {
 	GNode *gnode;
 	GooCanvasItemModel *tree_item; /* The tree line associated with the node */
 	GooCanvasPoints *tree_points; /* The points of tree_item */
+	int tree_style; /* The line style last applied to tree_item, or -1 */
 };
 
 /* Clickable parts of the node */
@@ -56,7 +57,8 @@ typedef enum {
 	I7_NODE_CANT_COMPARE = -1,
 	I7_NODE_NO_MATCH,
 	I7_NODE_NEAR_MATCH,
-	I7_NODE_EXACT_MATCH
+	I7_NODE_EXACT_MATCH,
+	I7_NODE_DIFF_PENDING /* still being compared in the background */
 } I7NodeMatchType;
 
 GType i7_node_get_type(void) G_GNUC_CONST;
@@ -66,13 +68,19 @@ I7Node *i7_node_new(const gchar *line, const gchar *label, const gchar *transcri
 
 /* Properties */
 gchar *i7_node_get_command(I7Node *self);
+const gchar *i7_node_peek_command(I7Node *self);
 void i7_node_set_command(I7Node *self, const gchar *line);
 gchar *i7_node_get_label(I7Node *self);
+const gchar *i7_node_peek_label(I7Node *self);
 void i7_node_set_label(I7Node *self, const gchar *label);
 gboolean i7_node_has_label(I7Node *self);
 gchar *i7_node_get_transcript_text(I7Node *self);
 void i7_node_set_transcript_text(I7Node *self, const gchar *transcript);
 gchar *i7_node_get_expected_text(I7Node *self);
+void i7_node_restore_texts(I7Node *self, const gchar *transcript, const gchar *expected);
+GBytes *i7_node_get_stored_transcript(I7Node *self, gsize *packed_len);
+GBytes *i7_node_get_stored_expected(I7Node *self, gsize *packed_len);
+void i7_node_restore_stored_texts(I7Node *self, GBytes *transcript, gsize transcript_packed_len, GBytes *expected, gsize expected_packed_len);
 const char *i7_node_get_transcript_pango_string(I7Node *self);
 const char *i7_node_get_expected_pango_string(I7Node *self);
 I7NodeMatchType i7_node_get_match_type(I7Node *self);
@@ -91,12 +99,14 @@ void i7_node_set_score(I7Node *self, gint score);
 gboolean i7_node_in_thread(I7Node *self, I7Node *endnode);
 gboolean i7_node_is_root(I7Node *self);
 I7Node *i7_node_find_child(I7Node *self, const gchar *command);
-I7Node *i7_node_get_next_difference_below(I7Node *node);
-I7Node *i7_node_get_next_difference(I7Node *node);
+void i7_node_append_child(I7Node *self, I7Node *child);
+void i7_node_insert_child(I7Node *self, gint position, I7Node *child);
+void i7_node_insert_child_after(I7Node *self, I7Node *sibling, I7Node *child);
+void i7_node_unlink(I7Node *self);
 
 /* Serialization */
 const gchar *i7_node_get_unique_id(I7Node *self);
-gchar *i7_node_get_xml(I7Node *self);
+GBytes *i7_node_get_xml_fragment(I7Node *self);
 
 /* Drawing on a GooCanvas */
 gdouble i7_node_get_x(I7Node *self);
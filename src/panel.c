@@ -38,6 +38,7 @@
 #include "html.h"
 #include "panel.h"
 #include "panel-private.h"
+#include "skein.h"
 #include "skein-view.h"
 #include "transcript-renderer.h"
 
@@ -736,6 +737,17 @@ i7_panel_init(I7Panel *self)
 	self->labels_action = gtk_action_group_get_action(priv->skein_action_group, "labels");
 	gtk_activatable_set_related_action(GTK_ACTIVATABLE(self->labels), self->labels_action);
 
+	/* Add the count of differences in front of the Transcript buttons; it is
+	 only shown along with them */
+	self->differences = gtk_tool_item_new();
+	self->differences_label = gtk_label_new(NULL);
+	gtk_container_add(GTK_CONTAINER(self->differences), self->differences_label);
+	gtk_widget_show(self->differences_label);
+	gtk_widget_set_no_show_all(GTK_WIDGET(self->differences), TRUE);
+	GtkWidget *first_transcript_button = gtk_ui_manager_get_widget(priv->ui_manager, "/PanelToolbar/next_difference_skein");
+	gtk_toolbar_insert(GTK_TOOLBAR(self->toolbar), self->differences,
+		gtk_toolbar_get_item_index(GTK_TOOLBAR(self->toolbar), GTK_TOOL_ITEM(first_transcript_button)));
+
 	/* Reparent the widgets into our new VBox */
 	self->notebook = GTK_WIDGET(load_object(builder, "panel"));
 	gtk_box_pack_start(GTK_BOX(self), self->toolbar, FALSE, FALSE, 0);
@@ -786,6 +798,7 @@ i7_panel_init(I7Panel *self)
 	LOAD_WIDGET(glulx);
 	LOAD_WIDGET(blorb);
 	LOAD_WIDGET(nobble_rng);
+	LOAD_WIDGET(timeline);
 	LOAD_WIDGET(debugging_scrolledwindow);
 	LOAD_WIDGET(inform6_scrolledwindow);
 	LOAD_WIDGET(transcript_menu);
@@ -941,6 +954,9 @@ on_notebook_switch_page(GtkNotebook *notebook, GtkWidget *page, unsigned page_nu
 
 	gtk_action_group_set_visible(priv->skein_action_group, skein);
 	gtk_action_group_set_visible(priv->transcript_action_group, transcript);
+	gtk_widget_set_visible(GTK_WIDGET(panel->differences), transcript);
+	if(transcript)
+		i7_panel_update_differences(panel);
 	gtk_action_group_set_visible(priv->documentation_action_group, documentation);
 	gtk_action_group_set_visible(priv->extensions_action_group, extensions);
 }
@@ -1400,3 +1416,21 @@ i7_panel_update_font_sizes(I7Panel *self)
 	pango_font_description_free(stdfont);
 	pango_font_description_free(monofont);
 }
+
+/* Update the count of differences in the Transcript toolbar. Counting them may
+ mean comparing every knot's transcript, so it is only done while the count is
+ visible. */
+void
+i7_panel_update_differences(I7Panel *self)
+{
+	if(!gtk_widget_get_visible(GTK_WIDGET(self->differences)))
+		return;
+	GtkTreeModel *skein = gtk_tree_view_get_model(GTK_TREE_VIEW(self->tabs[I7_PANE_TRANSCRIPT]));
+	if(skein == NULL)
+		return;
+
+	guint count = i7_skein_get_n_differences(I7_SKEIN(skein), I7_SKEIN_DIFFERENCE_EXPECTED);
+	char *text = g_strdup_printf(ngettext("%u difference", "%u differences", count), count);
+	gtk_label_set_text(GTK_LABEL(self->differences_label), text);
+	g_free(text);
+}
@@ -80,10 +80,13 @@ typedef struct {
 	GtkToolItem *labels;
 	GtkWidget *labels_menu;
 	GtkAction *labels_action;
+	GtkToolItem *differences;
+	GtkWidget *differences_label;
 	GtkWidget *z8;
 	GtkWidget *glulx;
 	GtkWidget *blorb;
 	GtkWidget *nobble_rng;
+	GtkWidget *timeline;
 	GtkWidget *debugging_scrolledwindow;
 	GtkWidget *inform6_scrolledwindow;
 	GtkWidget *transcript_menu;
@@ -116,5 +119,6 @@ void i7_panel_goto_extensions_docpage(I7Panel *self, GFile *file);
 void i7_panel_update_tabs(I7Panel *self);
 void i7_panel_update_fonts(I7Panel *self);
 void i7_panel_update_font_sizes(I7Panel *self);
+void i7_panel_update_differences(I7Panel *self);
 
 #endif /* _PANEL_H_ */
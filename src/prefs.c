@@ -122,6 +122,7 @@ create_prefs_window(GSettings *prefs, GtkBuilder *builder)
 	BIND(PREFS_CLEAN_BUILD_FILES, "clean_index_files", "sensitive");
 	BIND(PREFS_CLEAN_INDEX_FILES, "clean_index_files", "active");
 	BIND(PREFS_SHOW_DEBUG_LOG, "show_debug_tabs", "active");
+	BIND(PREFS_BACKGROUND_COMPILE, "background_compile", "active");
 	BIND_COMBO_BOX(PREFS_FONT_SET, "font_set", font_set_enum);
 	BIND_COMBO_BOX(PREFS_FONT_SIZE, "font_size", font_size_enum);
 	BIND_COMBO_BOX(PREFS_INTERPRETER, "glulx_combo", interpreter_enum);
@@ -0,0 +1,210 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* i7-replay: headless helper for replaying one thread of the skein. The story
+ * file is run in a Chimara widget that is never shown on screen, the commands
+ * given on the command line are fed to it, and each response is written to
+ * standard output as one line:
+ *
+ *   T<tab><escaped text printed before the first prompt>
+ *   C<tab><escaped command><tab><escaped response>
+ *
+ * The strings are escaped with g_strescape(), so they contain no tabs or
+ * newlines. If the story waits for input that the commands can't give it, such
+ * as a keypress, the helper stops and exits with a failure status. The IDE runs
+ * several of these processes at once; see skein-replay.c. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+#include <libchimara/chimara-glk.h>
+#include <libchimara/chimara-if.h>
+
+/* How long the interpreter may wait with commands still queued before it is
+ * taken to be waiting for input they can't give it, such as a keypress */
+#define STALL_TIMEOUT 10 /* seconds */
+
+typedef struct {
+	ChimaraGlk *glk;
+	char **commands;
+	int exit_status;
+	guint responses; /* number of commands processed so far */
+	guint responses_at_wait; /* number processed when the interpreter waited */
+	guint stall_source;
+} ReplayData;
+
+/* Write one record to standard output; @input is NULL for the text printed
+ * before the first prompt */
+static void
+on_command(ChimaraIF *glk, char *input, char *response, ReplayData *data)
+{
+	char *escaped_response = g_strescape(response? response : "", NULL);
+	if(input == NULL) {
+		g_print("T\t%s\n", escaped_response);
+	} else {
+		char *escaped_input = g_strescape(input, NULL);
+		g_print("C\t%s\t%s\n", escaped_input, escaped_response);
+		g_free(escaped_input);
+	}
+	g_free(escaped_response);
+	fflush(stdout);
+	data->responses++;
+}
+
+/* Feed the commands once the interpreter is ready for them */
+static void
+on_started(ChimaraGlk *glk, ReplayData *data)
+{
+	char **iter;
+	for(iter = data->commands; iter && *iter; iter++)
+		chimara_glk_feed_line_input(glk, *iter);
+}
+
+/* Timeout callback; the GDK lock is held. If no command has been processed
+ * since the interpreter started waiting, it is waiting for something else, such
+ * as a keypress, and nobody is there to give it. */
+static gboolean
+check_stalled(ReplayData *data)
+{
+	data->stall_source = 0;
+	if(chimara_glk_is_line_input_pending(data->glk)
+		&& data->responses == data->responses_at_wait) {
+		g_printerr(_("The story is waiting for input other than a command\n"));
+		data->exit_status = EXIT_FAILURE;
+		chimara_glk_stop(data->glk);
+	}
+	return FALSE; /* one-shot */
+}
+
+/* Stop as soon as all the forced input has been processed. If the interpreter
+ * waits with commands still queued, check later whether it took them. */
+static void
+on_waiting(ChimaraGlk *glk, ReplayData *data)
+{
+	if(!chimara_glk_is_line_input_pending(glk)) {
+		chimara_glk_stop(glk);
+		return;
+	}
+	data->responses_at_wait = data->responses;
+	if(data->stall_source)
+		g_source_remove(data->stall_source);
+	data->stall_source = gdk_threads_add_timeout_seconds(STALL_TIMEOUT,
+		(GSourceFunc)check_stalled, data);
+}
+
+static void
+on_stopped(ChimaraGlk *glk, ReplayData *data)
+{
+	if(data->stall_source) {
+		g_source_remove(data->stall_source);
+		data->stall_source = 0;
+	}
+	gtk_main_quit();
+}
+
+int
+main(int argc, char *argv[])
+{
+#ifdef ENABLE_NLS
+	bindtextdomain(GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR);
+	bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+	textdomain(GETTEXT_PACKAGE);
+#endif
+
+	GError *error = NULL;
+	ReplayData data = { NULL, NULL, EXIT_SUCCESS, 0, 0, 0 };
+
+	gboolean use_git = FALSE;
+	char **remaining_args = NULL;
+	GOptionEntry entries[] = {
+		{
+			.long_name = "git",
+			.arg = G_OPTION_ARG_NONE,
+			.arg_data = &use_git,
+			.description = N_("Use Git instead of Glulxe for Glulx games"),
+		},
+		{
+			.long_name = G_OPTION_REMAINING,
+			.arg = G_OPTION_ARG_STRING_ARRAY,
+			.arg_data = &remaining_args,
+			.description = "",
+			.arg_description = N_("STORYFILE [COMMAND ...]"),
+		},
+		{ .long_name = NULL }
+	};
+	GOptionContext *context = g_option_context_new(
+		_("- Replay a thread of the skein without displaying it"));
+	g_option_context_add_main_entries(context, entries, GETTEXT_PACKAGE);
+	g_option_context_add_group(context, gtk_get_option_group(TRUE));
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if(remaining_args == NULL || remaining_args[0] == NULL) {
+		g_printerr(_("No story file given\n"));
+		return EXIT_FAILURE;
+	}
+	data.commands = remaining_args + 1;
+
+	gdk_threads_init();
+	gtk_init(&argc, &argv);
+
+	/* The interpreter runs in an offscreen window, so it has somewhere to lay
+	 out its text, but nothing is ever drawn on the screen */
+	GtkWidget *window = gtk_offscreen_window_new();
+	GtkWidget *glk = chimara_if_new();
+	data.glk = CHIMARA_GLK(glk);
+	gtk_container_add(GTK_CONTAINER(window), glk);
+	gtk_widget_show_all(window);
+
+	chimara_if_set_preferred_interpreter(CHIMARA_IF(glk), CHIMARA_IF_FORMAT_Z8, CHIMARA_IF_INTERPRETER_FROTZ);
+	chimara_if_set_preferred_interpreter(CHIMARA_IF(glk), CHIMARA_IF_FORMAT_GLULX,
+		use_git? CHIMARA_IF_INTERPRETER_GIT : CHIMARA_IF_INTERPRETER_GLULXE);
+	/* Nobody is there to answer -- more -- prompts or file dialogs */
+	chimara_glk_set_interactive(CHIMARA_GLK(glk), FALSE);
+	chimara_glk_set_protect(CHIMARA_GLK(glk), TRUE);
+
+	g_signal_connect(glk, "command", G_CALLBACK(on_command), &data);
+	g_signal_connect_after(glk, "started", G_CALLBACK(on_started), &data);
+	g_signal_connect_after(glk, "waiting", G_CALLBACK(on_waiting), &data);
+	g_signal_connect(glk, "stopped", G_CALLBACK(on_stopped), &data);
+
+	GFile *story_file = g_file_new_for_commandline_arg(remaining_args[0]);
+	if(!chimara_if_run_game_file(CHIMARA_IF(glk), story_file, &error)) {
+		g_printerr(_("Could not load interpreter: %s\n"), error->message);
+		g_error_free(error);
+		data.exit_status = EXIT_FAILURE;
+	} else {
+		gdk_threads_enter();
+		gtk_main();
+		gdk_threads_leave();
+		chimara_glk_wait(CHIMARA_GLK(glk));
+	}
+
+	g_object_unref(story_file);
+	gtk_widget_destroy(window);
+	g_strfreev(remaining_args);
+	return data.exit_status;
+}
@@ -0,0 +1,478 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* i7-skein-check: run a project's skein as a regression test, without the
+ * GUI. The project is compiled with ni and Inform 6 the same way the Go button
+ * does it, the blessed threads are replayed with i7-replay, and each blessed
+ * knot is reported as a test case, in TAP or JUnit XML format. The exit code
+ * is 0 if all knots match their blessed transcripts, 1 if any differ, and 2 if
+ * the project could not be compiled or replayed. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <osxcart/plist.h>
+
+#include "node.h"
+#include "skein.h"
+#include "skein-replay.h"
+#include "story.h"
+#include "transcript-diff.h"
+
+#define EXIT_MISMATCH 1
+#define EXIT_ERROR 2
+
+typedef struct {
+	GMainLoop *loop;
+	GHashTable *timings; /* I7Node -> seconds, for each knot that was played */
+	GError *error;
+} CheckData;
+
+typedef struct {
+	I7Node *node;
+	char *name;
+	gboolean played;
+	gdouble seconds;
+	gboolean passed;
+} KnotResult;
+
+/* Locate a program installed alongside this one; the environment variable is
+ the same one the IDE uses */
+static GFile *
+get_libexec_file(const char *filename)
+{
+	const char *env = g_getenv("GNOME_INFORM_LIBEXEC_DIR");
+	char *path = g_build_filename(env? env : PACKAGE_LIBEXEC_DIR, filename, NULL);
+	GFile *retval = g_file_new_for_path(path);
+	g_free(path);
+	return retval;
+}
+
+/* The directory ni considers its "internal" directory */
+static char *
+get_internal_path(void)
+{
+	const char *env = g_getenv("GNOME_INFORM_DATA_DIR");
+	if(env)
+		return g_strdup(env);
+	return g_build_filename(PACKAGE_DATA_DIR, "gnome-inform7", NULL);
+}
+
+/* Run one compiler stage synchronously in @builddir; if it fails, its output
+ goes into @error */
+static gboolean
+run_compiler_stage(GFile *builddir, char **argv, gdouble *seconds, GError **error)
+{
+	char *wd = g_file_get_path(builddir);
+	char *output = NULL, *errors = NULL;
+	int status;
+
+	GTimer *timer = g_timer_new();
+	gboolean success = g_spawn_sync(wd, argv, NULL, 0, NULL, NULL,
+		&output, &errors, &status, error);
+	*seconds = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+	g_free(wd);
+
+	if(success) {
+		int exit_code = WIFEXITED(status)? WEXITSTATUS(status) : -1;
+		if(exit_code != 0) {
+			g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+				_("%s finished with code %d:\n%s%s"), argv[0], exit_code,
+				output, errors);
+			success = FALSE;
+		}
+	}
+
+	g_free(output);
+	g_free(errors);
+	return success;
+}
+
+/* Compile the project in @project_file with ni and Inform 6, and return the
+ story file */
+static GFile *
+compile_project(GFile *project_file, gdouble *ni_seconds, gdouble *i6_seconds, GError **error)
+{
+	/* Read the story format from the project settings */
+	int format = I7_STORY_FORMAT_GLULX;
+	gboolean nobble_rng = FALSE;
+	GFile *settings_file = g_file_get_child(project_file, "Settings.plist");
+	PlistObject *settings = plist_read_file(settings_file, NULL, NULL);
+	g_object_unref(settings_file);
+	if(settings) {
+		PlistObject *obj = plist_object_lookup(settings, "IFOutputSettings", "IFSettingZCodeVersion", -1);
+		if(obj && plist_object_get_integer(obj) != I7_STORY_FORMAT_GLULX)
+			format = I7_STORY_FORMAT_Z8; /* also converts old Z5 and Z6 projects */
+		obj = plist_object_lookup(settings, "IFOutputSettings", "IFSettingNobbleRng", -1);
+		if(obj)
+			nobble_rng = obj->boolean.val;
+		plist_object_free(settings);
+	}
+	const char *extension = format == I7_STORY_FORMAT_GLULX? "ulx" : "z8";
+
+	GFile *builddir = g_file_get_child(project_file, "Build");
+	char *output_name = g_strconcat("output.", extension, NULL);
+	GFile *output_file = g_file_get_child(builddir, output_name);
+	g_free(output_name);
+
+	/* Same command lines as in story-compile.c, without -release */
+	GFile *ni_compiler = get_libexec_file("ni");
+	GPtrArray *args = g_ptr_array_new_full(7, g_free);
+	g_ptr_array_add(args, g_file_get_path(ni_compiler));
+	g_ptr_array_add(args, g_strdup("-internal"));
+	g_ptr_array_add(args, get_internal_path());
+	g_ptr_array_add(args, g_strconcat("-format=", extension, NULL));
+	g_ptr_array_add(args, g_strdup("-project"));
+	g_ptr_array_add(args, g_file_get_path(project_file));
+	if(nobble_rng)
+		g_ptr_array_add(args, g_strdup("-rng"));
+	g_ptr_array_add(args, NULL);
+	g_object_unref(ni_compiler);
+	char **commandline = (char **)g_ptr_array_free(args, FALSE);
+	gboolean success = run_compiler_stage(builddir, commandline, ni_seconds, error);
+	g_strfreev(commandline);
+
+	if(success) {
+		GFile *i6_compiler = get_libexec_file(INFORM6_COMPILER_NAME);
+		commandline = g_new(char *, 6);
+		commandline[0] = g_file_get_path(i6_compiler);
+		commandline[1] = i7_story_get_i6_compiler_switches(TRUE, format);
+		commandline[2] = g_strdup("$huge");
+		commandline[3] = g_strdup("auto.inf");
+		commandline[4] = g_file_get_path(output_file);
+		commandline[5] = NULL;
+		g_object_unref(i6_compiler);
+		success = run_compiler_stage(builddir, commandline, i6_seconds, error);
+		g_strfreev(commandline);
+	}
+
+	g_object_unref(builddir);
+	if(!success) {
+		g_object_unref(output_file);
+		return NULL;
+	}
+	return output_file;
+}
+
+static void
+on_knot_replayed(I7Skein *skein, I7Node *node, gdouble seconds, CheckData *data)
+{
+	gdouble *value = g_new(gdouble, 1);
+	*value = seconds;
+	g_hash_table_insert(data->timings, node, value);
+}
+
+static void
+on_replay_finished(I7Skein *skein, GError *error, CheckData *data)
+{
+	if(error)
+		data->error = g_error_copy(error);
+	g_main_loop_quit(data->loop);
+}
+
+/* Name a knot after the commands leading up to it */
+static char *
+get_knot_name(I7Node *node)
+{
+	if(i7_node_is_root(node))
+		return g_strdup(i7_node_peek_command(node));
+
+	GString *name = g_string_new(i7_node_peek_command(node));
+	GNode *gnode;
+	for(gnode = node->gnode->parent; gnode && !G_NODE_IS_ROOT(gnode); gnode = gnode->parent) {
+		g_string_prepend(name, " > ");
+		g_string_prepend(name, i7_node_peek_command(gnode->data));
+	}
+	return g_string_free(name, FALSE);
+}
+
+static gboolean
+check_knot(GNode *gnode, GPtrArray *results)
+{
+	I7Node *node = gnode->data;
+	if(!i7_node_get_blessed(node))
+		return FALSE; /* keep going */
+
+	KnotResult *result = g_slice_new0(KnotResult);
+	result->node = node;
+	result->name = get_knot_name(node);
+	g_ptr_array_add(results, result);
+	return FALSE;
+}
+
+/* Print @text as a YAML block literal under @key */
+static void
+print_block(const char *key, const char *text)
+{
+	g_print("  %s: |\n", key);
+	char **lines = g_strsplit(text, "\n", -1);
+	char **iter;
+	for(iter = lines; *iter; iter++)
+		g_print("    %s\n", *iter);
+	g_strfreev(lines);
+}
+
+static void
+print_tap(GPtrArray *results, gdouble ni_seconds, gdouble i6_seconds)
+{
+	g_print("TAP version 13\n");
+	g_print("1..%u\n", results->len);
+	g_print("# ni: %.3f s, inform6: %.3f s\n", ni_seconds, i6_seconds);
+
+	guint i;
+	for(i = 0; i < results->len; i++) {
+		KnotResult *result = results->pdata[i];
+		g_print("%s %u - %s\n", result->passed? "ok" : "not ok", i + 1, result->name);
+		g_print("  ---\n");
+		if(result->played)
+			g_print("  duration_ms: %.3f\n", result->seconds * 1000.0);
+		else
+			g_print("  message: %s\n", _("The knot was not reached"));
+		if(!result->passed) {
+			char *text = i7_node_get_expected_text(result->node);
+			print_block("expected", text);
+			g_free(text);
+			text = i7_node_get_transcript_text(result->node);
+			print_block("got", text);
+			g_free(text);
+		}
+		g_print("  ...\n");
+	}
+}
+
+static void
+print_junit(GPtrArray *results, const char *project_name, gdouble ni_seconds, gdouble i6_seconds)
+{
+	guint i, failures = 0;
+	gdouble total = 0.0;
+	for(i = 0; i < results->len; i++) {
+		KnotResult *result = results->pdata[i];
+		if(!result->passed)
+			failures++;
+		total += result->seconds;
+	}
+
+	char *text = g_markup_printf_escaped("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<testsuite name=\"%s\" tests=\"%u\" failures=\"%u\" errors=\"0\" time=\"%.3f\">\n"
+		"  <properties>\n"
+		"    <property name=\"ni-time\" value=\"%.3f\"/>\n"
+		"    <property name=\"inform6-time\" value=\"%.3f\"/>\n"
+		"  </properties>\n",
+		project_name, results->len, failures, total, ni_seconds, i6_seconds);
+	g_print("%s", text);
+	g_free(text);
+
+	for(i = 0; i < results->len; i++) {
+		KnotResult *result = results->pdata[i];
+		text = g_markup_printf_escaped("  <testcase classname=\"%s\" name=\"%s\" time=\"%.3f\"",
+			project_name, result->name, result->seconds);
+		g_print("%s", text);
+		g_free(text);
+
+		if(result->passed) {
+			g_print("/>\n");
+			continue;
+		}
+
+		char *expected = i7_node_get_expected_text(result->node);
+		char *transcript = i7_node_get_transcript_text(result->node);
+		text = g_markup_printf_escaped(">\n"
+			"    <failure message=\"%s\">Expected:\n%s\n\nGot:\n%s</failure>\n"
+			"  </testcase>\n",
+			result->played? _("The transcript differs from the blessed transcript") : _("The knot was not reached"),
+			expected, transcript);
+		g_print("%s", text);
+		g_free(text);
+		g_free(expected);
+		g_free(transcript);
+	}
+	g_print("</testsuite>\n");
+}
+
+static void
+knot_result_free(KnotResult *result)
+{
+	g_free(result->name);
+	g_slice_free(KnotResult, result);
+}
+
+int
+main(int argc, char *argv[])
+{
+#ifdef ENABLE_NLS
+	bindtextdomain(GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR);
+	bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+	textdomain(GETTEXT_PACKAGE);
+#endif
+
+	GError *error = NULL;
+	int jobs = 0;
+	gboolean junit = FALSE, use_git = FALSE;
+	char **remaining_args = NULL;
+	GOptionEntry entries[] = {
+		{
+			.long_name = "jobs",
+			.short_name = 'j',
+			.arg = G_OPTION_ARG_INT,
+			.arg_data = &jobs,
+			.description = N_("Number of threads to replay at once (default: one per processor)"),
+			.arg_description = "N",
+		},
+		{
+			.long_name = "junit",
+			.arg = G_OPTION_ARG_NONE,
+			.arg_data = &junit,
+			.description = N_("Print JUnit XML instead of TAP"),
+		},
+		{
+			.long_name = "git",
+			.arg = G_OPTION_ARG_NONE,
+			.arg_data = &use_git,
+			.description = N_("Use Git instead of Glulxe for Glulx games"),
+		},
+		{
+			.long_name = G_OPTION_REMAINING,
+			.arg = G_OPTION_ARG_FILENAME_ARRAY,
+			.arg_data = &remaining_args,
+			.description = "",
+			.arg_description = N_("PROJECT"),
+		},
+		{ .long_name = NULL }
+	};
+	GOptionContext *context = g_option_context_new(
+		_("- Check a project's skein against its blessed transcripts"));
+	g_option_context_add_main_entries(context, entries, GETTEXT_PACKAGE);
+	g_option_context_set_description(context,
+		_("The interpreter needs a display; on machines without one, run this "
+		"program under xvfb-run."));
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_ERROR;
+	}
+	g_option_context_free(context);
+
+	if(remaining_args == NULL || remaining_args[0] == NULL || remaining_args[1] != NULL || jobs < 0) {
+		g_printerr(_("Usage: %s [-j N] [--junit] PROJECT\n"), g_get_prgname());
+		g_strfreev(remaining_args);
+		return EXIT_ERROR;
+	}
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+	g_type_init();
+#endif
+
+	GFile *project_file = g_file_new_for_commandline_arg(remaining_args[0]);
+	char *project_name = g_file_get_basename(project_file);
+	g_strfreev(remaining_args);
+	int exit_status = EXIT_SUCCESS;
+
+	/* Load the skein */
+	I7Skein *skein = i7_skein_new();
+	GFile *skein_file = g_file_get_child(project_file, "Skein.skein");
+	GFile *cache_file = g_file_resolve_relative_path(project_file, "Build/Skein.cache");
+	i7_skein_set_cache_file(skein, cache_file);
+	g_object_unref(cache_file);
+	gboolean loaded = i7_skein_load(skein, skein_file, &error);
+	g_object_unref(skein_file);
+	if(!loaded) {
+		g_printerr(_("Could not load the skein: %s\n"), error->message);
+		g_error_free(error);
+		exit_status = EXIT_ERROR;
+		goto finally;
+	}
+
+	/* Compile */
+	gdouble ni_seconds = 0.0, i6_seconds = 0.0;
+	GFile *story_file = compile_project(project_file, &ni_seconds, &i6_seconds, &error);
+	if(story_file == NULL) {
+		g_printerr(_("Could not compile the project: %s\n"), error->message);
+		g_error_free(error);
+		exit_status = EXIT_ERROR;
+		goto finally;
+	}
+
+	/* Replay */
+	CheckData data;
+	data.loop = g_main_loop_new(NULL, FALSE);
+	data.timings = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	data.error = NULL;
+	GFile *helper = get_libexec_file("i7-replay");
+	i7_skein_replay_blessed_threads(skein, helper, story_file, use_git, jobs,
+		(I7SkeinReplayKnotFunc)on_knot_replayed,
+		(I7SkeinReplayFunc)on_replay_finished, &data);
+	g_main_loop_run(data.loop);
+	g_main_loop_unref(data.loop);
+	g_object_unref(helper);
+	g_object_unref(story_file);
+
+	if(data.error) {
+		g_printerr(_("Could not replay the skein: %s\n"), data.error->message);
+		g_error_free(data.error);
+		exit_status = EXIT_ERROR;
+	}
+
+	/* Compare */
+	GPtrArray *results = g_ptr_array_new_with_free_func((GDestroyNotify)knot_result_free);
+	g_node_traverse(i7_skein_get_root_node(skein)->gnode, G_PRE_ORDER,
+		G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)check_knot, results);
+	guint i;
+	for(i = 0; i < results->len; i++) {
+		KnotResult *result = results->pdata[i];
+		gdouble *seconds = g_hash_table_lookup(data.timings, result->node);
+		result->played = (seconds != NULL);
+		result->seconds = seconds? *seconds : 0.0;
+
+		if(result->played) {
+			char *expected = i7_node_get_expected_text(result->node);
+			char *transcript = i7_node_get_transcript_text(result->node);
+			GArray *expected_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+			GArray *transcript_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+			/* Differences in whitespace only are a near match, which passes */
+			word_diff_indices(expected, transcript, expected_diffs, transcript_diffs);
+			result->passed = expected_diffs->len == 0 && transcript_diffs->len == 0;
+			g_array_free(expected_diffs, TRUE);
+			g_array_free(transcript_diffs, TRUE);
+			g_free(expected);
+			g_free(transcript);
+		}
+
+		if(!result->passed && exit_status == EXIT_SUCCESS)
+			exit_status = EXIT_MISMATCH;
+	}
+	g_hash_table_destroy(data.timings);
+
+	if(junit)
+		print_junit(results, project_name, ni_seconds, i6_seconds);
+	else
+		print_tap(results, ni_seconds, i6_seconds);
+	g_ptr_array_free(results, TRUE);
+
+finally:
+	g_object_unref(skein);
+	g_object_unref(project_file);
+	g_free(project_name);
+	return exit_status;
+}
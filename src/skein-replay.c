@@ -0,0 +1,440 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <gdk/gdk.h>
+#include <gio/gio.h>
+
+#include "node.h"
+#include "skein.h"
+#include "skein-replay.h"
+
+/* Replays the blessed threads of a skein without using the Story pane. Each
+ thread is played by a separate i7-replay process (see replay.c), at most
+ max_jobs of them at a time, and each transcript is stored in its knot as soon
+ as the process writes it.
+
+ Every process plays its thread from the start, so the commands of knots that
+ several threads share are run once per thread. Resuming from a saved state at
+ the branch knots instead would need the interpreter to save and restore
+ without asking the user where, which Chimara can't do. What is avoided is
+ updating those knots more than once: only the first job to reach a shared knot
+ stores its transcript and compares it with the expected text. */
+
+#define BUFSIZE 4096
+/* A process that writes nothing for this long is taken to be stuck, and is
+ killed */
+#define JOB_TIMEOUT 60 /* seconds */
+
+typedef struct {
+	I7Skein *skein;
+	char *helper_path;
+	char *story_path;
+	gboolean use_git;
+	guint max_jobs;
+	GQueue pending; /* threads waiting for a free slot */
+	guint running;
+	GError *error; /* the first error that occurred */
+	I7SkeinReplayKnotFunc knot_callback;
+	I7SkeinReplayFunc callback;
+	gpointer data;
+} ReplayRun;
+
+typedef struct {
+	ReplayRun *run;
+	GPtrArray *thread; /* the knots of the thread, root first */
+	guint position; /* index in @thread of the last knot played */
+	guint first_new; /* index in @thread of the first knot no other job updates */
+	GString *buffer; /* output not yet terminated by a newline */
+	GTimer *timer; /* running since the process was started */
+	gdouble last_response; /* time of the previous response */
+	GPid pid;
+	guint timeout_source;
+	gboolean timed_out;
+	gboolean output_done;
+	gboolean exited;
+	int exit_code;
+} ReplayJob;
+
+static void start_pending_jobs(ReplayRun *run);
+
+/*
+ * i7_skein_replay_get_default_jobs:
+ *
+ * Returns: the number of threads to replay at once if the caller has no
+ * preference: one per processor.
+ */
+guint
+i7_skein_replay_get_default_jobs(void)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	return processors > 0? (guint)processors : 1;
+}
+
+/* @visited holds the knots already covered by earlier jobs; the knots of this
+ thread are added to it */
+static ReplayJob *
+replay_job_new(ReplayRun *run, I7Node *thread_end, GHashTable *visited)
+{
+	ReplayJob *job = g_slice_new0(ReplayJob);
+	job->run = run;
+	job->thread = g_ptr_array_new_with_free_func(g_object_unref);
+	job->buffer = g_string_new("");
+
+	GNode *gnode;
+	for(gnode = thread_end->gnode; gnode; gnode = gnode->parent)
+		g_ptr_array_add(job->thread, g_object_ref(gnode->data));
+	/* Reverse the array so that the root comes first */
+	guint i;
+	for(i = 0; i < job->thread->len / 2; i++) {
+		gpointer tmp = job->thread->pdata[i];
+		job->thread->pdata[i] = job->thread->pdata[job->thread->len - 1 - i];
+		job->thread->pdata[job->thread->len - 1 - i] = tmp;
+	}
+
+	/* Knots shared with an earlier thread get their transcript from that
+	 thread's job only, so they are not compared over and over again */
+	while(job->first_new < job->thread->len
+		&& g_hash_table_lookup(visited, job->thread->pdata[job->first_new]))
+		job->first_new++;
+	for(i = job->first_new; i < job->thread->len; i++)
+		g_hash_table_insert(visited, job->thread->pdata[i], GINT_TO_POINTER(TRUE));
+
+	return job;
+}
+
+static void
+replay_job_free(ReplayJob *job)
+{
+	g_ptr_array_free(job->thread, TRUE);
+	g_string_free(job->buffer, TRUE);
+	if(job->timer)
+		g_timer_destroy(job->timer);
+	g_slice_free(ReplayJob, job);
+}
+
+static void
+replay_run_free(ReplayRun *run)
+{
+	g_object_unref(run->skein);
+	g_free(run->helper_path);
+	g_free(run->story_path);
+	g_clear_error(&run->error);
+	g_slice_free(ReplayRun, run);
+}
+
+/* Store one line of the helper's output in the corresponding knot. Must be
+ called with the GDK lock held, inside a batch of skein changes. */
+static void
+process_line(ReplayJob *job, const char *line)
+{
+	char **fields = g_strsplit(line, "\t", 3);
+	const char *response = NULL;
+	I7Node *node = NULL;
+
+	if(fields[0] == NULL) {
+		/* blank line, ignore it */
+	} else if(strcmp(fields[0], "T") == 0 && fields[1] != NULL) {
+		/* Text printed before the first prompt belongs to the root knot */
+		if(job->position == 0) {
+			node = job->thread->pdata[0];
+			response = fields[1];
+		}
+	} else if(strcmp(fields[0], "C") == 0 && fields[1] != NULL && fields[2] != NULL) {
+		if(job->position + 1 < job->thread->len) {
+			job->position++;
+			node = job->thread->pdata[job->position];
+			response = fields[2];
+		}
+	}
+
+	if(node == NULL) {
+		g_strfreev(fields);
+		return;
+	}
+
+	gdouble now = g_timer_elapsed(job->timer, NULL);
+	gdouble elapsed = now - job->last_response;
+	job->last_response = now;
+
+	if(job->position >= job->first_new) {
+		char *transcript = g_strcompress(response);
+		i7_node_set_transcript_text(node, transcript);
+		if(job->run->knot_callback)
+			job->run->knot_callback(job->run->skein, node, elapsed, job->run->data);
+		g_free(transcript);
+	}
+
+	g_strfreev(fields);
+}
+
+/* Called when both the output pipe is closed and the process has exited */
+static void
+maybe_finish_job(ReplayJob *job)
+{
+	if(!job->output_done || !job->exited)
+		return;
+
+	ReplayRun *run = job->run;
+
+	/* Anything left in the buffer is an unterminated last line */
+	if(job->buffer->len > 0) {
+		gdk_threads_enter();
+		i7_skein_begin_batch(run->skein);
+		process_line(job, job->buffer->str);
+		i7_skein_end_batch(run->skein);
+		gdk_threads_leave();
+	}
+
+	if(job->timed_out && run->error == NULL)
+		run->error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_REPLAY,
+			_("The interpreter stopped responding and was stopped after %d "
+			"seconds."), JOB_TIMEOUT);
+	else if(job->exit_code != 0 && run->error == NULL)
+		run->error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_REPLAY,
+			_("The interpreter stopped with exit code %d."), job->exit_code);
+
+	replay_job_free(job);
+	run->running--;
+	start_pending_jobs(run);
+}
+
+/* Timeout callback; kill a process that has stopped writing output */
+static gboolean
+job_timed_out(ReplayJob *job)
+{
+	job->timeout_source = 0;
+	job->timed_out = TRUE;
+	kill(job->pid, SIGTERM);
+	return FALSE; /* one-shot */
+}
+
+/* (Re)start the timeout that kills the process if it writes nothing for
+ JOB_TIMEOUT seconds */
+static void
+reset_job_timeout(ReplayJob *job)
+{
+	if(job->timeout_source)
+		g_source_remove(job->timeout_source);
+	job->timeout_source = g_timeout_add_seconds(JOB_TIMEOUT,
+		(GSourceFunc)job_timed_out, job);
+}
+
+static gboolean
+read_helper_output(GIOChannel *ioc, GIOCondition cond, ReplayJob *job)
+{
+	if(cond & (G_IO_IN | G_IO_PRI | G_IO_HUP)) {
+		char scratch[BUFSIZE];
+		gsize chars_read = 0;
+		GIOStatus result = g_io_channel_read_chars(ioc, scratch, BUFSIZE,
+			&chars_read, NULL);
+
+		if(result == G_IO_STATUS_NORMAL && chars_read > 0) {
+			g_string_append_len(job->buffer, scratch, chars_read);
+			if(!job->exited)
+				reset_job_timeout(job);
+
+			/* Process all the complete lines in the buffer, as one batch of
+			 changes to the skein */
+			char *start = job->buffer->str, *newline;
+			gdk_threads_enter();
+			i7_skein_begin_batch(job->run->skein);
+			while((newline = memchr(start, '\n', job->buffer->str + job->buffer->len - start)) != NULL) {
+				*newline = '\0';
+				process_line(job, start);
+				start = newline + 1;
+			}
+			i7_skein_end_batch(job->run->skein);
+			gdk_threads_leave();
+			g_string_erase(job->buffer, 0, start - job->buffer->str);
+			return TRUE;
+		}
+		if(result == G_IO_STATUS_AGAIN)
+			return TRUE;
+	}
+
+	/* End of file or error */
+	job->output_done = TRUE;
+	maybe_finish_job(job);
+	return FALSE;
+}
+
+static void
+helper_exited(GPid pid, gint status, ReplayJob *job)
+{
+	/* The process ID may be reused once the child is reaped */
+	if(job->timeout_source) {
+		g_source_remove(job->timeout_source);
+		job->timeout_source = 0;
+	}
+	g_spawn_close_pid(pid);
+	job->exit_code = WIFEXITED(status)? WEXITSTATUS(status) : -1;
+	job->exited = TRUE;
+	maybe_finish_job(job);
+}
+
+/* Spawn the helper process for @job. On failure, sets @error and frees @job. */
+static gboolean
+start_job(ReplayJob *job, GError **error)
+{
+	ReplayRun *run = job->run;
+	GPid pid;
+	int stdout_fd;
+
+	GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(argv, g_strdup(run->helper_path));
+	if(run->use_git)
+		g_ptr_array_add(argv, g_strdup("--git"));
+	/* Commands starting with a dash must not be taken for options */
+	g_ptr_array_add(argv, g_strdup("--"));
+	g_ptr_array_add(argv, g_strdup(run->story_path));
+	guint i;
+	for(i = 1; i < job->thread->len; i++) {
+		/* Knots store their commands escaped */
+		char *command = i7_node_get_command(job->thread->pdata[i]);
+		g_ptr_array_add(argv, g_strcompress(command));
+		g_free(command);
+	}
+	g_ptr_array_add(argv, NULL);
+
+	gboolean success = g_spawn_async_with_pipes(NULL, (char **)argv->pdata,
+		NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, NULL, &stdout_fd,
+		NULL, error);
+	g_ptr_array_free(argv, TRUE);
+	if(!success) {
+		replay_job_free(job);
+		return FALSE;
+	}
+
+	GIOChannel *ioc = g_io_channel_unix_new(stdout_fd);
+	g_io_channel_set_encoding(ioc, NULL, NULL);
+	g_io_channel_set_buffered(ioc, FALSE);
+	g_io_channel_set_close_on_unref(ioc, TRUE);
+	g_io_add_watch(ioc, G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+		(GIOFunc)read_helper_output, job);
+	g_io_channel_unref(ioc);
+
+	g_child_watch_add(pid, (GChildWatchFunc)helper_exited, job);
+	job->pid = pid;
+	job->timer = g_timer_new();
+	reset_job_timeout(job);
+	return TRUE;
+}
+
+/* Fill the free slots with pending threads; call the callback when there is
+ nothing left to do */
+static void
+start_pending_jobs(ReplayRun *run)
+{
+	while(run->running < run->max_jobs && !g_queue_is_empty(&run->pending)) {
+		ReplayJob *job = g_queue_pop_head(&run->pending);
+		GError *error = NULL;
+		if(start_job(job, &error)) {
+			run->running++;
+		} else {
+			if(run->error == NULL)
+				run->error = error;
+			else
+				g_error_free(error);
+		}
+	}
+
+	if(run->running == 0 && g_queue_is_empty(&run->pending)) {
+		if(run->callback) {
+			gdk_threads_enter();
+			run->callback(run->skein, run->error, run->data);
+			gdk_threads_leave();
+		}
+		replay_run_free(run);
+	}
+}
+
+static int
+compare_thread_lengths(ReplayJob *a, ReplayJob *b)
+{
+	return (int)b->thread->len - (int)a->thread->len;
+}
+
+static gboolean
+start_pending_jobs_idle(ReplayRun *run)
+{
+	start_pending_jobs(run);
+	return FALSE; /* one-shot */
+}
+
+/*
+ * i7_skein_replay_blessed_threads:
+ * @skein: the skein
+ * @helper: the i7-replay program
+ * @story_file: the compiled story file to run
+ * @use_git: whether to prefer Git over Glulxe for Glulx games
+ * @max_jobs: maximum number of threads to replay at once, or 0 for the default
+ * @knot_callback: function to call each time a knot's transcript is updated,
+ * or %NULL
+ * @callback: function to call when all threads have been replayed, or %NULL
+ * @data: user data for @knot_callback and @callback
+ *
+ * Plays through as many threads as necessary to visit each blessed knot in
+ * @skein at least once, like the Story pane does when replaying the entire
+ * skein, but in separate processes and without displaying anything. The
+ * transcript of each knot is updated as soon as it is known. Must be called
+ * from the main loop; @callback is called with the first error, if any.
+ * @knot_callback also gets the time the interpreter took to respond to the
+ * knot's command.
+ */
+void
+i7_skein_replay_blessed_threads(I7Skein *skein, GFile *helper, GFile *story_file, gboolean use_git, guint max_jobs, I7SkeinReplayKnotFunc knot_callback, I7SkeinReplayFunc callback, gpointer data)
+{
+	g_return_if_fail(I7_IS_SKEIN(skein));
+	g_return_if_fail(G_IS_FILE(helper));
+	g_return_if_fail(G_IS_FILE(story_file));
+
+	ReplayRun *run = g_slice_new0(ReplayRun);
+	run->skein = g_object_ref(skein);
+	run->helper_path = g_file_get_path(helper);
+	run->story_path = g_file_get_path(story_file);
+	run->use_git = use_git;
+	run->max_jobs = max_jobs > 0? max_jobs : i7_skein_replay_get_default_jobs();
+	g_queue_init(&run->pending);
+	run->knot_callback = knot_callback;
+	run->callback = callback;
+	run->data = data;
+
+	GSList *blessed_nodes = i7_skein_get_blessed_thread_ends(skein);
+	GHashTable *visited = g_hash_table_new(NULL, NULL);
+	GSList *iter;
+	for(iter = blessed_nodes; iter; iter = g_slist_next(iter))
+		g_queue_push_tail(&run->pending, replay_job_new(run, iter->data, visited));
+	g_hash_table_destroy(visited);
+	g_slist_free(blessed_nodes);
+
+	/* Start the longest threads first, so that a long one doesn't end up
+	 running on its own after all the others have finished */
+	g_queue_sort(&run->pending, (GCompareDataFunc)compare_thread_lengths, NULL);
+
+	/* Start from the main loop, so that the callback is never called before
+	 this function returns */
+	g_idle_add((GSourceFunc)start_pending_jobs_idle, run);
+}
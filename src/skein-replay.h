@@ -0,0 +1,34 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SKEIN_REPLAY_H_
+#define _SKEIN_REPLAY_H_
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "skein.h"
+
+typedef void (*I7SkeinReplayKnotFunc)(I7Skein *skein, I7Node *node, gdouble seconds, gpointer data);
+typedef void (*I7SkeinReplayFunc)(I7Skein *skein, GError *error, gpointer data);
+
+guint i7_skein_replay_get_default_jobs(void);
+void i7_skein_replay_blessed_threads(I7Skein *skein, GFile *helper, GFile *story_file, gboolean use_git, guint max_jobs, I7SkeinReplayKnotFunc knot_callback, I7SkeinReplayFunc callback, gpointer data);
+
+#endif /* _SKEIN_REPLAY_H_ */
@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <string.h>
 
 #include <gio/gio.h>
 #include <glib/gi18n.h>
@@ -25,9 +26,11 @@
 #include <gtk/gtk.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 
 #include "node.h"
 #include "skein.h"
+#include "text-extents.h"
 
 #define VALID_ITER(iter, priv) ( \
 	(iter) != NULL \
@@ -35,13 +38,38 @@
 	&& I7_IS_NODE((iter)->user_data) \
 	&& (iter)->stamp == (priv)->stamp)
 
+/* Notifications that are held back while a batch of changes is in progress */
+typedef enum {
+	BATCH_THREAD = 1 << 0, /* the current thread has changed shape */
+	BATCH_LAYOUT = 1 << 1,
+	BATCH_LABELS = 1 << 2,
+	BATCH_MODIFIED = 1 << 3,
+	BATCH_DIFFERENCES = 1 << 4
+} BatchFlags;
+
 typedef struct _I7SkeinPrivate
 {
 	I7Node *root;
 	I7Node *current; /* Node currently displayed in Transcript */
 	I7Node *played;  /* Node currently played (yellow) */
+	GPtrArray *thread; /* Rows of the tree model: the knots from the root to the
+	bottom of the current knot's thread, so that row n is at depth n */
 	gboolean modified;
 
+	/* Batches of changes; see i7_skein_begin_batch() */
+	guint batch_depth;
+	BatchFlags batch_pending;
+	I7Node *batch_current; /* Current node when the batch began */
+	I7Node *batch_show_node; /* Last knot played during the batch */
+
+	/* Index of the knots with differences; see DIFFERENCE INDEX. NULL when it
+	must be rebuilt. */
+	GHashTable *indexed; /* Set of the knots in the index */
+	GHashTable *differences[I7_SKEIN_N_DIFFERENCE_TYPES]; /* Sets of knots */
+	GPtrArray *sorted_differences[I7_SKEIN_N_DIFFERENCE_TYPES]; /* Same knots in
+	pre-order, or NULL when they must be sorted again */
+	gboolean building_index;
+
 	gdouble hspacing;
 	gdouble vspacing;
 	GdkColor locked;
@@ -49,15 +77,119 @@ typedef struct _I7SkeinPrivate
 
 	GooCanvasLineDash *locked_dash;
 	GooCanvasLineDash *unlocked_dash;
+	gboolean tree_styles_stale; /* Restyle every tree line on the next draw */
 
 	GSettings *settings; /* skein settings */
 
 	int stamp; /* Stamp for identifying tree iterators belonging to this model */
+
+	GFile *cache_file; /* Binary copy of the skein file, or NULL */
+
+	/* Saving in the background */
+	GThread *save_thread;
+	struct _SkeinSnapshot *save_running;
+	struct _SkeinSnapshot *save_pending;
 } I7SkeinPrivate;
 
 #define I7_SKEIN_PRIVATE(o)  (G_TYPE_INSTANCE_GET_PRIVATE ((o), I7_TYPE_SKEIN, I7SkeinPrivate))
 #define I7_SKEIN_USE_PRIVATE I7SkeinPrivate *priv = I7_SKEIN_PRIVATE(self)
 
+/* Size of the buffer through which the skein file is written */
+#define SAVE_BUFFER_SIZE 65536
+
+/* The skein cache is a binary copy of the skein file, which can be loaded
+ much faster than the XML. It is only used if the skein file's size,
+ modification time and checksum are the same as when the cache was written;
+ the skein file itself is always the authoritative copy. The file consists of
+ a CacheHeader, an array of CacheKnots in depth-first order, and a table of
+ strings which the knots point into. Numbers are stored in the machine's own
+ byte order. */
+#define CACHE_MAGIC "I7SKEIN\x1a"
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_HASH_TYPE G_CHECKSUM_SHA256
+#define CACHE_HASH_SIZE 32
+#define CACHE_NO_PARENT G_MAXUINT32
+
+typedef enum {
+	CACHE_STRING_COMMAND,
+	CACHE_STRING_LABEL,
+	CACHE_STRING_TRANSCRIPT,
+	CACHE_STRING_EXPECTED,
+	CACHE_N_STRINGS
+} CacheStringType;
+
+typedef enum {
+	CACHE_KNOT_LOCKED = 1 << 0,
+	CACHE_KNOT_CHANGED = 1 << 1
+} CacheKnotFlags;
+
+/* What the cache was made from */
+typedef struct {
+	guint64 size;
+	guint64 mtime;
+	guint32 mtime_usec;
+	guint8 hash[CACHE_HASH_SIZE];
+} CacheKey;
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 byte_order;
+	guint64 xml_size;
+	guint64 xml_mtime;
+	guint32 xml_mtime_usec;
+	guint32 n_knots;
+	guint8 xml_hash[CACHE_HASH_SIZE];
+	guint32 active;
+	guint32 reserved;
+	guint64 strings_size;
+} CacheHeader;
+
+typedef struct {
+	guint64 offset; /* from the start of the string table */
+	guint64 size;
+	guint64 packed_len; /* length of the text if compressed, or 0 */
+} CacheString;
+
+typedef struct {
+	guint32 parent; /* index of parent knot, or CACHE_NO_PARENT for the root */
+	guint32 flags;
+	gint32 score;
+	guint32 reserved;
+	CacheString strings[CACHE_N_STRINGS];
+} CacheKnot;
+
+G_STATIC_ASSERT(sizeof(CacheHeader) == 88);
+G_STATIC_ASSERT(sizeof(CacheKnot) == 112);
+
+/* A knot's contents, taken on the main thread for writing to the cache */
+typedef struct {
+	guint32 parent;
+	guint32 flags;
+	gint32 score;
+	GBytes *strings[CACHE_N_STRINGS];
+	gsize packed_lens[CACHE_N_STRINGS];
+} CacheKnotSnapshot;
+
+/* Everything needed to write the skein file, taken on the main thread. The
+ fragments are immutable, so the snapshot can be written on another thread
+ while the skein goes on changing. */
+typedef struct _SkeinSnapshot {
+	I7Skein *skein;
+	GFile *file;
+	GBytes *header;
+	GPtrArray *fragments; /* GBytes, one <item> per knot */
+	GFile *cache_file; /* NULL if not writing the cache */
+	GArray *cache_knots; /* CacheKnotSnapshot, in depth-first order */
+	guint32 cache_active;
+	I7SkeinSaveFunc callback;
+	gpointer data;
+	gboolean success;
+	gboolean finished; /* callback has been called */
+	GError *error;
+} SkeinSnapshot;
+
 enum
 {
 	NEEDS_LAYOUT,
@@ -67,6 +199,7 @@ enum
 	LABELS_CHANGED,
 	SHOW_NODE,
 	MODIFIED,
+	DIFFERENCES_CHANGED,
 	LAST_SIGNAL
 };
 
@@ -88,19 +221,445 @@ static void i7_skein_tree_model_init(GtkTreeModelIface *iface);
 G_DEFINE_TYPE_EXTENDED(I7Skein, i7_skein, GOO_TYPE_CANVAS_GROUP_MODEL, 0,
     G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, i7_skein_tree_model_init));
 
+/* CURRENT THREAD */
+
+/* Is @node in @thread at @row? @row must be the depth of @node, counting the
+ root as 0 */
+static gboolean
+thread_has_node_at(GPtrArray *thread, I7Node *node, int row)
+{
+	return row >= 0 && (unsigned)row < thread->len && thread->pdata[row] == node;
+}
+
+/* Returns the row of @node in the tree model, or -1 if it is not in the current
+ thread. This is O(depth); code that walks the tree should keep track of the
+ depth and call thread_has_node_at() instead. */
+static int
+get_thread_row(I7Skein *self, I7Node *node)
+{
+	I7_SKEIN_USE_PRIVATE;
+	int row = g_node_depth(node->gnode) - 1;
+	if(!thread_has_node_at(priv->thread, node, row))
+		return -1;
+	return row;
+}
+
+static void
+set_thread_iter(I7Skein *self, GtkTreeIter *iter, int row)
+{
+	I7_SKEIN_USE_PRIVATE;
+	iter->stamp = priv->stamp;
+	iter->user_data = priv->thread->pdata[row];
+	iter->user_data2 = GINT_TO_POINTER(row);
+}
+
+static void
+emit_thread_row_changed(I7Skein *self, int row)
+{
+	GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+	GtkTreeIter iter;
+	set_thread_iter(self, &iter, row);
+	gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
+	gtk_tree_path_free(path);
+}
+
+/* Brings the rows of the tree model up to date after the current node or the
+ shape of its thread has changed. Only the rows below the part the old and new
+ threads have in common are deleted and inserted. */
+static void
+update_thread(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
+	guint len = g_node_depth(last->gnode);
+	I7Node **thread = g_new(I7Node *, len);
+	GNode *gnode;
+	guint i = len;
+	for(gnode = last->gnode; gnode; gnode = gnode->parent)
+		thread[--i] = gnode->data;
+
+	guint common = 0;
+	while(common < len && common < priv->thread->len && priv->thread->pdata[common] == thread[common])
+		common++;
+
+	while(priv->thread->len > common) {
+		g_ptr_array_remove_index(priv->thread, priv->thread->len - 1);
+		GtkTreePath *path = gtk_tree_path_new_from_indices(priv->thread->len, -1);
+		gtk_tree_model_row_deleted(GTK_TREE_MODEL(self), path);
+		gtk_tree_path_free(path);
+	}
+	for(i = common; i < len; i++) {
+		g_ptr_array_add(priv->thread, g_object_ref(thread[i]));
+		GtkTreePath *path = gtk_tree_path_new_from_indices(i, -1);
+		GtkTreeIter iter;
+		set_thread_iter(self, &iter, i);
+		gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
+		gtk_tree_path_free(path);
+	}
+
+	g_free(thread);
+}
+
+/* The "current" column changes in the rows of the old and new current nodes */
+static void
+emit_current_rows_changed(I7Skein *self, I7Node *old_current)
+{
+	I7_SKEIN_USE_PRIVATE;
+	int row = get_thread_row(self, old_current);
+	if(row != -1)
+		emit_thread_row_changed(self, row);
+	row = get_thread_row(self, priv->current);
+	if(row != -1)
+		emit_thread_row_changed(self, row);
+}
+
+static void
+emit_changes(I7Skein *self, BatchFlags changes)
+{
+	if(changes & BATCH_THREAD)
+		update_thread(self);
+	if(changes & BATCH_LABELS)
+		g_signal_emit_by_name(self, "labels-changed");
+	if(changes & BATCH_LAYOUT)
+		g_signal_emit_by_name(self, "needs-layout");
+	if(changes & BATCH_MODIFIED)
+		g_signal_emit_by_name(self, "modified");
+	if(changes & BATCH_DIFFERENCES)
+		g_signal_emit_by_name(self, "differences-changed");
+}
+
+/* Sends the notifications for @changes now, or when the current batch ends */
+static void
+queue_changes(I7Skein *self, BatchFlags changes)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	if(priv->batch_depth > 0)
+		priv->batch_pending |= changes;
+	else
+		emit_changes(self, changes);
+}
+
+/* DIFFERENCE INDEX */
+
+/* The knots with each kind of difference are kept in sets, so that they can be
+ counted without looking at the rest of the skein. The sets are built when they
+ are first needed, and after that are kept up to date one knot at a time, as
+ knots are added, removed, or change their state. For Find Next Difference,
+ each set is also kept as an array sorted in the order of a pre-order walk of
+ the skein; the arrays are only sorted again, from the sets, when they are next
+ needed after a change. */
+
+static gboolean
+node_has_difference(I7Node *node, I7SkeinDifferenceType type)
+{
+	if(type == I7_SKEIN_DIFFERENCE_CHANGED)
+		return i7_node_get_changed(node);
+	return i7_node_get_different(node);
+}
+
+/* Compares the positions of @a and @b in a pre-order walk of the skein, in
+ O(depth) plus the number of siblings between their branches */
+static int
+compare_preorder(I7Node *a, I7Node *b)
+{
+	GNode *gnode_a = a->gnode, *gnode_b = b->gnode;
+	guint depth_a = g_node_depth(gnode_a), depth_b = g_node_depth(gnode_b);
+
+	/* A knot comes after its ancestors */
+	for(; depth_a > depth_b; depth_a--) {
+		gnode_a = gnode_a->parent;
+		if(gnode_a == gnode_b)
+			return 1;
+	}
+	for(; depth_b > depth_a; depth_b--) {
+		gnode_b = gnode_b->parent;
+		if(gnode_b == gnode_a)
+			return -1;
+	}
+	if(gnode_a == gnode_b)
+		return 0;
+
+	/* Otherwise, it depends on which of their branches comes first */
+	while(gnode_a->parent != gnode_b->parent) {
+		gnode_a = gnode_a->parent;
+		gnode_b = gnode_b->parent;
+	}
+	for(; gnode_a; gnode_a = gnode_a->next)
+		if(gnode_a == gnode_b)
+			return -1;
+	return 1;
+}
+
+static int
+compare_preorder_ptrs(I7Node **a, I7Node **b)
+{
+	return compare_preorder(*a, *b);
+}
+
+/* Returns the index in @differences of the first knot after @node, or at or
+ after it if @inclusive */
+static guint
+find_difference_slot(GPtrArray *differences, I7Node *node, gboolean inclusive)
+{
+	guint low = 0, high = differences->len;
+	while(low < high) {
+		guint mid = low + (high - low) / 2;
+		int cmp = compare_preorder(differences->pdata[mid], node);
+		if(cmp < 0 || (cmp == 0 && !inclusive))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static void
+invalidate_sorted_differences(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	int type;
+	for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++) {
+		if(priv->sorted_differences[type]) {
+			g_ptr_array_free(priv->sorted_differences[type], TRUE);
+			priv->sorted_differences[type] = NULL;
+		}
+	}
+}
+
+static void
+invalidate_index(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->indexed == NULL)
+		return;
+	g_hash_table_destroy(priv->indexed);
+	priv->indexed = NULL;
+	int type;
+	for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++) {
+		g_hash_table_destroy(priv->differences[type]);
+		priv->differences[type] = NULL;
+	}
+	invalidate_sorted_differences(self);
+}
+
+static void
+ensure_index(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->indexed)
+		return;
+
+	/* Working out whether a knot differs can notify its "match" property, which
+	 would otherwise try to update the half-built index */
+	priv->building_index = TRUE;
+	invalidate_sorted_differences(self);
+	priv->indexed = g_hash_table_new(g_direct_hash, g_direct_equal);
+	int type;
+	for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++) {
+		priv->differences[type] = g_hash_table_new(g_direct_hash, g_direct_equal);
+		priv->sorted_differences[type] = g_ptr_array_new();
+	}
+
+	/* Walking the skein in pre-order fills the sorted arrays in order */
+	GNode *gnode = priv->root->gnode;
+	while(gnode) {
+		I7Node *node = gnode->data;
+		g_hash_table_add(priv->indexed, node);
+		for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++) {
+			if(node_has_difference(node, type)) {
+				g_hash_table_add(priv->differences[type], node);
+				g_ptr_array_add(priv->sorted_differences[type], node);
+			}
+		}
+
+		/* Next knot in pre-order */
+		if(gnode->children) {
+			gnode = gnode->children;
+			continue;
+		}
+		while(gnode && !gnode->next)
+			gnode = gnode->parent;
+		if(gnode)
+			gnode = gnode->next;
+	}
+	priv->building_index = FALSE;
+}
+
+/* Returns the knots with a difference of type @type, sorted in pre-order */
+static GPtrArray *
+get_sorted_differences(I7Skein *self, I7SkeinDifferenceType type)
+{
+	I7_SKEIN_USE_PRIVATE;
+	ensure_index(self);
+	if(priv->sorted_differences[type] == NULL) {
+		GHashTable *differences = priv->differences[type];
+		GPtrArray *sorted = g_ptr_array_sized_new(g_hash_table_size(differences));
+		GHashTableIter iter;
+		gpointer node;
+		g_hash_table_iter_init(&iter, differences);
+		while(g_hash_table_iter_next(&iter, &node, NULL))
+			g_ptr_array_add(sorted, node);
+		g_ptr_array_sort(sorted, (GCompareFunc)compare_preorder_ptrs);
+		priv->sorted_differences[type] = sorted;
+	}
+	return priv->sorted_differences[type];
+}
+
+/* Moves @node into or out of the sets after its state changed, and returns
+ whether it moved */
+static gboolean
+index_knot(I7Skein *self, I7Node *node)
+{
+	I7_SKEIN_USE_PRIVATE;
+	gboolean changed = FALSE;
+	int type;
+	for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++) {
+		/* Ask first; it may update the index again from inside */
+		gboolean has_difference = node_has_difference(node, type);
+		GHashTable *differences = priv->differences[type];
+		gboolean in_index = g_hash_table_contains(differences, node);
+
+		if(has_difference && !in_index) {
+			g_hash_table_add(differences, node);
+			changed = TRUE;
+		} else if(!has_difference && in_index) {
+			g_hash_table_remove(differences, node);
+			changed = TRUE;
+		}
+	}
+	if(changed)
+		invalidate_sorted_differences(self);
+	return changed;
+}
+
+/* Updates the index after @node's state changed */
+static void
+update_index(I7Skein *self, I7Node *node)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->building_index)
+		return;
+	if(priv->indexed == NULL) {
+		queue_changes(self, BATCH_DIFFERENCES);
+		return;
+	}
+	/* Ignore knots that are not in the skein, such as ones being loaded */
+	if(!g_hash_table_contains(priv->indexed, node))
+		return;
+	if(index_knot(self, node))
+		queue_changes(self, BATCH_DIFFERENCES);
+}
+
+/* Adds @node to the index; call after a new knot is linked into the skein */
+static void
+index_add_knot(I7Skein *self, I7Node *node)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->indexed == NULL)
+		return;
+	g_hash_table_add(priv->indexed, node);
+	if(index_knot(self, node))
+		queue_changes(self, BATCH_DIFFERENCES);
+}
+
+/* Removes @node from the index; call when a knot is removed from the skein */
+static void
+index_remove_knot(I7Skein *self, I7Node *node)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->indexed == NULL || !g_hash_table_remove(priv->indexed, node))
+		return;
+	gboolean changed = FALSE;
+	int type;
+	for(type = 0; type < I7_SKEIN_N_DIFFERENCE_TYPES; type++)
+		changed |= g_hash_table_remove(priv->differences[type], node);
+	if(changed) {
+		invalidate_sorted_differences(self);
+		queue_changes(self, BATCH_DIFFERENCES);
+	}
+}
+
+/*
+ * i7_skein_get_n_differences:
+ * @self: the skein
+ * @type: the kind of difference to count
+ *
+ * Returns: the number of knots in the skein with a difference of type @type.
+ */
+guint
+i7_skein_get_n_differences(I7Skein *self, I7SkeinDifferenceType type)
+{
+	I7_SKEIN_USE_PRIVATE;
+	ensure_index(self);
+	return g_hash_table_size(priv->differences[type]);
+}
+
+/*
+ * i7_skein_get_next_difference:
+ * @self: the skein
+ * @node: the knot to start after, or %NULL to start at the beginning
+ * @type: the kind of difference to look for
+ *
+ * Finds the first knot after @node in a pre-order walk of the skein, that is,
+ * below it or to the right of it, with a difference of type @type.
+ *
+ * Returns: the knot, or %NULL if there is none.
+ */
+I7Node *
+i7_skein_get_next_difference(I7Skein *self, I7Node *node, I7SkeinDifferenceType type)
+{
+	I7_SKEIN_USE_PRIVATE;
+	GPtrArray *differences = get_sorted_differences(self, type);
+
+	guint slot = 0;
+	if(node) {
+		if(!g_hash_table_contains(priv->indexed, node))
+			return NULL;
+		slot = find_difference_slot(differences, node, FALSE);
+	}
+	return slot < differences->len? differences->pdata[slot] : NULL;
+}
+
+/*
+ * i7_skein_get_previous_difference:
+ * @self: the skein
+ * @node: the knot to start before, or %NULL to start at the end
+ * @type: the kind of difference to look for
+ *
+ * Finds the last knot before @node in a pre-order walk of the skein with a
+ * difference of type @type.
+ *
+ * Returns: the knot, or %NULL if there is none.
+ */
+I7Node *
+i7_skein_get_previous_difference(I7Skein *self, I7Node *node, I7SkeinDifferenceType type)
+{
+	I7_SKEIN_USE_PRIVATE;
+	GPtrArray *differences = get_sorted_differences(self, type);
+
+	guint slot = differences->len;
+	if(node) {
+		if(!g_hash_table_contains(priv->indexed, node))
+			return NULL;
+		slot = find_difference_slot(differences, node, TRUE);
+	}
+	return slot > 0? differences->pdata[slot - 1] : NULL;
+}
+
 /* SIGNAL HANDLERS */
 
 static void
 on_node_other_notify(I7Node *node, GParamSpec *pspec, I7Skein *self)
 {
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, BATCH_MODIFIED);
 }
 
 static void
 on_node_layout_notify(I7Node *node, GParamSpec *pspec, I7Skein *self)
 {
-	g_signal_emit_by_name(self, "needs-layout");
-	on_node_other_notify(node, pspec, self);
+	queue_changes(self, BATCH_LAYOUT | BATCH_MODIFIED);
 }
 
 static void
@@ -108,20 +667,22 @@ on_node_label_notify(I7Node *node, GParamSpec *pspec, I7Skein *self)
 {
 	if(i7_node_has_label(node))
 		i7_skein_lock(self, i7_skein_get_thread_bottom(self, node));
-	g_signal_emit_by_name(self, "labels-changed");
-	on_node_layout_notify(node, pspec, self);
+	queue_changes(self, BATCH_LABELS | BATCH_LAYOUT | BATCH_MODIFIED);
 }
 
 static void
 on_node_transcript_notify(I7Node *node, GParamSpec *pspec, I7Skein *self)
 {
-	I7_SKEIN_USE_PRIVATE;
-	if(!i7_skein_is_node_in_current_thread(self, node))
+	int row = get_thread_row(self, node);
+	if(row == -1)
 		return;
-	GtkTreePath *path = gtk_tree_path_new_from_indices(g_node_depth(node->gnode) - 1, -1);
-	GtkTreeIter iter = { .stamp = priv->stamp, .user_data = node };
-	gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
-	gtk_tree_path_free(path);
+	emit_thread_row_changed(self, row);
+}
+
+static void
+on_node_difference_notify(I7Node *node, GParamSpec *pspec, I7Skein *self)
+{
+	update_index(self, node);
 }
 
 static void
@@ -134,6 +695,9 @@ node_listen(I7Skein *self, I7Node *node)
 	g_signal_connect(node, "notify::transcript-text", G_CALLBACK(on_node_transcript_notify), self);
 	g_signal_connect(node, "notify::expected-text", G_CALLBACK(on_node_layout_notify), self);
 	g_signal_connect(node, "notify::expected-text", G_CALLBACK(on_node_transcript_notify), self);
+	g_signal_connect(node, "notify::match", G_CALLBACK(on_node_transcript_notify), self);
+	g_signal_connect(node, "notify::match", G_CALLBACK(on_node_difference_notify), self);
+	g_signal_connect(node, "notify::changed", G_CALLBACK(on_node_difference_notify), self);
 	g_signal_connect(node, "notify::locked", G_CALLBACK(on_node_layout_notify), self);
 }
 
@@ -147,6 +711,8 @@ i7_skein_init(I7Skein *self)
 	node_listen(self, priv->root);
 	priv->current = priv->root;
 	priv->played = priv->root;
+	priv->thread = g_ptr_array_new_with_free_func(g_object_unref);
+	g_ptr_array_add(priv->thread, g_object_ref(priv->root));
 	priv->modified = TRUE;
 	priv->locked_dash = goo_canvas_line_dash_new(0);
 	priv->unlocked_dash = goo_canvas_line_dash_new(2, 5.0, 5.0);
@@ -159,6 +725,11 @@ i7_skein_init(I7Skein *self)
 	g_settings_bind(priv->settings, "vertical-spacing", self, "vertical-spacing", G_SETTINGS_BIND_DEFAULT);
 
 	priv->stamp = g_random_int();
+
+	priv->cache_file = NULL;
+	priv->save_thread = NULL;
+	priv->save_running = NULL;
+	priv->save_pending = NULL;
 }
 
 static void
@@ -183,12 +754,14 @@ i7_skein_set_property(GObject *self, guint prop_id, const GValue *value, GParamS
 		case PROP_LOCKED_COLOR:
 			gdk_color_parse(g_value_get_string(value), &priv->locked);
 			g_object_notify(self, "locked-color");
-			/* TODO: Change the color of all the locked threads */
+			priv->tree_styles_stale = TRUE;
+			g_signal_emit_by_name(self, "needs-layout");
 			break;
 		case PROP_UNLOCKED_COLOR:
 			gdk_color_parse(g_value_get_string(value), &priv->unlocked);
 			g_object_notify(self, "unlocked-color");
-			/* TODO: Change the color of all the unlocked threads */
+			priv->tree_styles_stale = TRUE;
+			g_signal_emit_by_name(self, "needs-layout");
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(self, prop_id, pspec);
@@ -223,8 +796,12 @@ i7_skein_finalize(GObject *self)
 {
 	I7_SKEIN_USE_PRIVATE;
 
+	invalidate_index(self);
+	g_ptr_array_free(priv->thread, TRUE);
 	g_object_unref(priv->root);
 	goo_canvas_line_dash_unref(priv->unlocked_dash);
+	if(priv->cache_file)
+		g_object_unref(priv->cache_file);
 
 	G_OBJECT_CLASS(i7_skein_parent_class)->finalize(self);
 }
@@ -283,6 +860,12 @@ i7_skein_class_init(I7SkeinClass *klass)
 		G_OBJECT_CLASS_TYPE(klass), 0,
 		G_STRUCT_OFFSET(I7SkeinClass, modified), NULL, NULL,
 		g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+	/* differences-changed - the number of knots with differences may have
+	 changed */
+	i7_skein_signals[DIFFERENCES_CHANGED] = g_signal_new("differences-changed",
+		G_OBJECT_CLASS_TYPE(klass), 0,
+		G_STRUCT_OFFSET(I7SkeinClass, differences_changed), NULL, NULL,
+		g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 
 	/* Install properties */
 	GParamFlags flags = G_PARAM_LAX_VALIDATION | G_PARAM_STATIC_STRINGS;
@@ -351,7 +934,7 @@ i7_skein_get_column_type(GtkTreeModel *model, int ncol)
 }
 
 /* We fill in the first user_data field of GtkTreeIter with a pointer to the
- I7Node referenced by the iter. */
+ I7Node referenced by the iter, and the second with its row number. */
 static gboolean
 i7_skein_get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
 {
@@ -359,31 +942,10 @@ i7_skein_get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
 	I7_SKEIN_USE_PRIVATE;
 
 	int i = gtk_tree_path_get_indices(path)[0];
-	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-	int thread_depth = g_node_depth(last->gnode) - 1;
-	/* g_node_depth returns 0 for NULL and 1 for the root node */
-	
-	if(i > thread_depth)
+	if(i < 0 || (unsigned)i >= priv->thread->len)
 		return FALSE;
 
-	iter->stamp = priv->stamp;
-	
-	if(i == 0) {
-		iter->user_data = priv->root;
-		return TRUE;
-	}
-	if(i == thread_depth) {
-		iter->user_data = last;
-		return TRUE;
-	}
-	
-	/* Make the uninitialized iterator point to the i'th node between the root
-	 node and the bottom of the current node's thread */
-	GNode *gnode = last->gnode;
-	for( ; thread_depth > i; thread_depth--)
-		gnode = gnode->parent;
-	
-	iter->user_data = gnode->data;
+	set_thread_iter(self, iter, i);
 	return TRUE;
 }
 
@@ -396,8 +958,7 @@ i7_skein_get_path(GtkTreeModel *model, GtkTreeIter *iter)
 	g_return_val_if_fail(VALID_ITER(iter, priv), NULL);
 
 	GtkTreePath *path = gtk_tree_path_new();
-	int index = g_node_depth(((I7Node *)iter->user_data)->gnode) - 1;
-	gtk_tree_path_append_index(path, index);
+	gtk_tree_path_append_index(path, GPOINTER_TO_INT(iter->user_data2));
 	return path;
 }
 
@@ -454,6 +1015,7 @@ invalidate_iter(GtkTreeIter *iter)
 {
 	iter->stamp = 0;
 	iter->user_data = NULL;
+	iter->user_data2 = NULL;
 }
 
 static gboolean
@@ -465,21 +1027,13 @@ i7_skein_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
 	g_return_val_if_fail(VALID_ITER(iter, priv), FALSE);
 
 	/* Don't go beyond the bottom of "current" node's thread (end of the list) */
-	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-	if(iter->user_data == last) {
+	int next = GPOINTER_TO_INT(iter->user_data2) + 1;
+	if((unsigned)next >= priv->thread->len) {
 		invalidate_iter(iter);
 		return FALSE;
 	}
-	
-	GNode *gnode = ((I7Node *)iter->user_data)->gnode;
-
-	for(gnode = gnode->children; gnode; gnode = gnode->next) {
-		if(i7_node_in_thread(gnode->data, last))
-			break;
-	}
-	g_assert(gnode);
 
-	iter->user_data = gnode->data;
+	set_thread_iter(self, iter, next);
 	return TRUE;
 }
 
@@ -493,11 +1047,7 @@ i7_skein_iter_children(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *pare
 	}
 
 	/* If parent was NULL, return the root node */
-	I7Skein *self = I7_SKEIN(model);
-	I7_SKEIN_USE_PRIVATE;
-
-	iter->stamp = priv->stamp;
-	iter->user_data = priv->root;
+	set_thread_iter(I7_SKEIN(model), iter, 0);
 	return TRUE;
 }
 
@@ -515,10 +1065,8 @@ i7_skein_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
 	
 	/* If iter is NULL, return the number of toplevel nodes, i.e. the length of
 	 the list */
-	if(!iter) {
-		I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-		return g_node_depth(last->gnode);
-	}
+	if(!iter)
+		return priv->thread->len;
 	return 0;
 }
 
@@ -536,33 +1084,12 @@ i7_skein_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *par
 	I7Skein *self = I7_SKEIN(model);
 	I7_SKEIN_USE_PRIVATE;
 
-	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-	int thread_depth = g_node_depth(last->gnode) - 1;
-	/* g_node_depth returns 0 for NULL and 1 for the root node */
-	
-	if(n > thread_depth) {
+	if(n < 0 || (unsigned)n >= priv->thread->len) {
 		invalidate_iter(iter);
 		return FALSE;
 	}
 
-	iter->stamp = priv->stamp;
-	
-	if(n == 0) {
-		iter->user_data = priv->root;
-		return TRUE;
-	}
-	if(n == thread_depth) {
-		iter->user_data = last;
-		return TRUE;
-	}
-	
-	/* Make the uninitialized iterator point to the i'th node between the root
-	 node and the bottom of the current node's thread */
-	GNode *gnode = last->gnode;
-	for( ; thread_depth > n; thread_depth--)
-		gnode = gnode->parent;
-	
-	iter->user_data = gnode->data;
+	set_thread_iter(self, iter, n);
 	return TRUE;
 }
 
@@ -629,62 +1156,93 @@ i7_skein_set_current_node(I7Skein *self, I7Node *node)
 	if(priv->current == node)
 		return;
 
-	/* Old end of the list */
-	I7Node *old_last = i7_skein_get_thread_bottom(self, priv->current);
-	/* New end of the list */
-	I7Node *last = i7_skein_get_thread_bottom(self, node);
-	GNode *gnode = old_last->gnode;
-	
-	/* Emit row-inserted and row-deleted signals on our tree model interface */
-	if(old_last != last) {
-		/* Find a common ancestor of the old and new list bottoms */
-		int depth = g_node_depth(gnode) - 1;
-		for( ; gnode && !i7_node_in_thread(gnode->data, last); gnode = gnode->parent) {
-			GtkTreePath *path = gtk_tree_path_new_from_indices(depth--, -1);
-			gtk_tree_model_row_deleted(GTK_TREE_MODEL(self), path);
-			gtk_tree_path_free(path);
-		}
-		/* gnode is now the common ancestor, possibly the root node if no
-		 common ancestor, or possibly NULL if the tree is being rebuilt; in
-		 the latter case, first add the root node to the model */
-		if(gnode == NULL) {
-			gnode = priv->root->gnode;
-			GtkTreePath *path = gtk_tree_path_new_from_indices(0, -1);
-			GtkTreeIter iter = { .stamp = priv->stamp, .user_data = priv->root };
-			gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
-			gtk_tree_path_free(path);
-			depth = 0;
-		}
-		while(gnode != last->gnode) {
-			for(gnode = gnode->children; gnode; gnode = gnode->next) {
-				if(i7_node_in_thread(gnode->data, last))
-					break;
-			}
-			GtkTreePath *path = gtk_tree_path_new_from_indices(++depth, -1);
-			GtkTreeIter iter = { .stamp = priv->stamp, .user_data = gnode->data };
-			gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
-			gtk_tree_path_free(path);
-		}
-	}
-	
+	/* The old current node is still referenced by the thread array */
+	I7Node *old_current = g_object_ref(priv->current);
 	priv->current = node;
+	if(priv->batch_depth > 0) {
+		priv->batch_pending |= BATCH_THREAD;
+	} else {
+		update_thread(self);
+		emit_current_rows_changed(self, old_current);
+	}
+	g_object_unref(old_current);
+
 	g_object_notify(G_OBJECT(self), "current-node");
-	g_signal_emit_by_name(self, "needs-layout");
+	queue_changes(self, BATCH_LAYOUT);
 }
 
 gboolean
 i7_skein_is_node_in_current_thread(I7Skein *self, I7Node *node)
 {
 	I7_SKEIN_USE_PRIVATE;
-	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-	return i7_node_in_thread(node, last);
+	/* During a batch the rows may not have caught up with the tree yet */
+	if(priv->batch_pending & BATCH_THREAD)
+		return i7_node_in_thread(node, i7_skein_get_thread_bottom(self, priv->current));
+	return get_thread_row(self, node) != -1;
 }
 
-I7Node *
-i7_skein_get_played_node(I7Skein *self)
-{
-	I7_SKEIN_USE_PRIVATE;
-	return priv->played;
+/*
+ * i7_skein_begin_batch:
+ * @self: the skein
+ *
+ * Starts a batch of changes to the skein. Until the matching call to
+ * i7_skein_end_batch(), the tree model rows, property notifications and the
+ * #I7Skein::needs-layout, #I7Skein::labels-changed and #I7Skein::modified
+ * signals are held back, and each is sent at most once when the batch ends.
+ * Of the knots played during the batch, only the last one is passed to
+ * #I7Skein::show-node, after the skein has been laid out. Batches may be
+ * nested.
+ */
+void
+i7_skein_begin_batch(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(priv->batch_depth++ > 0)
+		return;
+	priv->batch_current = g_object_ref(priv->current);
+	g_object_freeze_notify(G_OBJECT(self));
+}
+
+/*
+ * i7_skein_end_batch:
+ * @self: the skein
+ *
+ * Ends a batch of changes started with i7_skein_begin_batch(), and sends the
+ * notifications that were held back if this was the outermost batch.
+ */
+void
+i7_skein_end_batch(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	g_return_if_fail(priv->batch_depth > 0);
+	if(--priv->batch_depth > 0)
+		return;
+
+	BatchFlags changes = priv->batch_pending;
+	I7Node *old_current = priv->batch_current;
+	priv->batch_pending = 0;
+	priv->batch_current = NULL;
+
+	emit_changes(self, changes);
+	if(old_current != priv->current)
+		emit_current_rows_changed(self, old_current);
+	g_object_unref(old_current);
+
+	I7Node *show_node = priv->batch_show_node;
+	priv->batch_show_node = NULL;
+	if(show_node) {
+		if(g_node_get_root(show_node->gnode) == priv->root->gnode)
+			g_signal_emit_by_name(self, "show-node", I7_REASON_COMMAND, show_node);
+		g_object_unref(show_node);
+	}
+	g_object_thaw_notify(G_OBJECT(self));
+}
+
+I7Node *
+i7_skein_get_played_node(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	return priv->played;
 }
 
 static gboolean
@@ -728,52 +1286,414 @@ i7_skein_set_played_node(I7Skein *self, I7Node *node)
 	g_object_notify(G_OBJECT(self), "played-node");
 }
 
-/* Search an xmlNode's properties for a certain one and return its content.
-String must be freed. Return NULL if not found */
+/* Elements inside an <item> element whose text content we are interested in */
+typedef enum {
+	ITEM_FIELD_NONE = -1,
+	ITEM_FIELD_COMMAND,
+	ITEM_FIELD_LABEL,
+	ITEM_FIELD_TRANSCRIPT,
+	ITEM_FIELD_EXPECTED,
+	ITEM_FIELD_CHANGED,
+	ITEM_FIELD_TEMPORARY,
+	ITEM_N_FIELDS
+} ItemField;
+
+static const char * const item_field_names[ITEM_N_FIELDS] = {
+	"command", "annotation", "result", "commentary", "changed", "temporary"
+};
+
+/* Children of a knot, recorded by ID until all the knots have been read */
+typedef struct {
+	I7Node *node;
+	GPtrArray *child_ids;
+} PendingChildren;
+
+/* Get an attribute of the reader's current element. String must be freed.
+Return NULL if not found */
 static gchar *
-get_property_from_node(xmlNode *node, const gchar *propertyname)
+get_attribute_from_reader(xmlTextReaderPtr reader, const gchar *name)
 {
-	xmlAttr *props;
-	for(props = node->properties; props; props = props->next)
-		if(xmlStrEqual(props->name, (const xmlChar *)propertyname))
-			return g_strdup((gchar *)props->children->content);
-	return NULL;
+	xmlChar *value = xmlTextReaderGetAttribute(reader, (const xmlChar *)name);
+	if(!value)
+		return NULL;
+	gchar *retval = g_strdup((gchar *)value);
+	xmlFree(value);
+	return retval;
 }
 
 /* Read the ObjectiveC "YES" and "NO" into a boolean, or return default_val if
  content is malformed */
 static gboolean
-get_boolean_from_content(xmlNode *node, gboolean default_val)
+get_boolean_from_content(GString *content, gboolean default_val)
 {
-	if(xmlStrEqual(node->children->content, (xmlChar *)"YES"))
+	if(strcmp(content->str, "YES") == 0)
 		return TRUE;
-	else if(xmlStrEqual(node->children->content, (xmlChar *)"NO"))
+	else if(strcmp(content->str, "NO") == 0)
 		return FALSE;
 	else
 		return default_val;
 }
 
-static gchar *
-get_text_content_from_node(xmlNode *node)
+static ItemField
+lookup_item_field(const xmlChar *name)
 {
-	if(node->children)
-		if(xmlStrEqual(node->children->name, (xmlChar *)"text"))
-			return g_strdup((gchar *)node->children->content);
-	return NULL;
+	ItemField field;
+	for(field = 0; field < ITEM_N_FIELDS; field++)
+		if(xmlStrEqual(name, (const xmlChar *)item_field_names[field]))
+			return field;
+	return ITEM_FIELD_NONE;
 }
 
-/* Doesn't actually free the node itself, but removes it from the canvas so that
- it gets freed. Has reversed arguments and returns FALSE for use in tree
- traversals. */
+/* Doesn't actually free the node itself, but removes it from the canvas and the
+ difference index so that it gets freed. Has reversed arguments and returns
+ FALSE for use in tree traversals. */
 static gboolean
 remove_node_from_canvas(GNode *gnode, I7Skein *self)
 {
+	index_remove_knot(self, I7_NODE(gnode->data));
 	if(I7_NODE(gnode->data)->tree_item)
 		goo_canvas_item_model_remove(I7_NODE(gnode->data)->tree_item);
 	goo_canvas_item_model_remove(GOO_CANVAS_ITEM_MODEL(gnode->data));
 	return FALSE;
 }
 
+/* Replaces the skein's knots with a newly loaded tree */
+static void
+replace_skein(I7Skein *self, I7Node *root, I7Node *active)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	i7_skein_begin_batch(self);
+
+	/* Discard the current skein and replace with the new */
+	invalidate_index(self);
+	g_node_traverse(priv->root->gnode, G_POST_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)remove_node_from_canvas, self);
+	priv->root = root;
+	priv->played = NULL;
+	if(!active || !i7_node_in_thread(root, active))
+		active = root;
+	i7_skein_set_played_node(self, active);
+	i7_skein_set_current_node(self, priv->root);
+	/* A freshly loaded skein is not modified */
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_LABELS | BATCH_DIFFERENCES);
+	priv->batch_pending &= ~BATCH_MODIFIED;
+
+	i7_skein_end_batch(self);
+	priv->modified = FALSE;
+}
+
+/* Fills in the size and modification time of @file; the hash is left alone */
+static gboolean
+query_cache_key(GFile *file, CacheKey *key, GError **error)
+{
+	GFileInfo *info = g_file_query_info(file,
+		G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+		G_FILE_QUERY_INFO_NONE, NULL, error);
+	if(!info)
+		return FALSE;
+	key->size = g_file_info_get_size(info);
+	key->mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	key->mtime_usec = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+	g_object_unref(info);
+	return TRUE;
+}
+
+/* Calculates the checksum of the skein file for the cache key */
+static gboolean
+hash_file(GFile *file, guint8 *hash)
+{
+	char *filename = g_file_get_path(file);
+	GMappedFile *mapped = filename? g_mapped_file_new(filename, FALSE, NULL) : NULL;
+	g_free(filename);
+	if(!mapped)
+		return FALSE;
+
+	GChecksum *checksum = g_checksum_new(CACHE_HASH_TYPE);
+	gsize hash_size = CACHE_HASH_SIZE;
+	g_checksum_update(checksum, (const guchar *)g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped));
+	g_checksum_get_digest(checksum, hash, &hash_size);
+	g_checksum_free(checksum);
+	g_mapped_file_unref(mapped);
+	return TRUE;
+}
+
+/* Checks that @string lies within the string table */
+static gboolean
+cache_string_valid(const CacheString *string, guint64 strings_size)
+{
+	/* zlib can't compress by much more than 1000:1 */
+	return string->offset <= strings_size
+		&& string->size <= strings_size - string->offset
+		&& string->packed_len / 1024 <= string->size;
+}
+
+/* Copies a command or label out of the string table */
+static gchar *
+get_cache_string(const gchar *strings, const CacheKnot *knot, CacheStringType type)
+{
+	return g_strndup(strings + knot->strings[type].offset, knot->strings[type].size);
+}
+
+/* Gets a transcript or expected text from the string table, without copying */
+static GBytes *
+get_cache_text(GBytes *table, const CacheKnot *knot, CacheStringType type)
+{
+	return g_bytes_new_from_bytes(table, knot->strings[type].offset, knot->strings[type].size);
+}
+
+/* Reads the skein from the cache file, if it was made from @file as it is now.
+The cache is memory-mapped, and the compressed texts are left in the mapped
+file until something asks for them. Returns FALSE if the cache could not be
+used, without changing the skein. */
+static gboolean
+load_cache(I7Skein *self, GFile *file, const CacheKey *key)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	char *filename = g_file_get_path(priv->cache_file);
+	GMappedFile *mapped = filename? g_mapped_file_new(filename, FALSE, NULL) : NULL;
+	g_free(filename);
+	if(!mapped)
+		return FALSE;
+
+	gsize length = g_mapped_file_get_length(mapped);
+	const gchar *contents = g_mapped_file_get_contents(mapped);
+	const CacheHeader *header = (const CacheHeader *)contents;
+	guint8 hash[CACHE_HASH_SIZE];
+	unsigned ix;
+	CacheStringType type;
+
+	if(length < sizeof(CacheHeader)
+		|| memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0
+		|| header->version != CACHE_VERSION
+		|| header->byte_order != CACHE_BYTE_ORDER
+		|| header->xml_size != key->size
+		|| header->xml_mtime != key->mtime
+		|| header->xml_mtime_usec != key->mtime_usec
+		|| header->n_knots == 0
+		|| header->active >= header->n_knots
+		|| header->n_knots > (length - sizeof(CacheHeader)) / sizeof(CacheKnot)
+		|| header->strings_size != length - sizeof(CacheHeader) - header->n_knots * sizeof(CacheKnot))
+		goto fail;
+
+	/* The size and date match, so it's worth checking the contents */
+	if(!hash_file(file, hash) || memcmp(hash, header->xml_hash, CACHE_HASH_SIZE) != 0)
+		goto fail;
+
+	const CacheKnot *knots = (const CacheKnot *)(contents + sizeof(CacheHeader));
+	const gchar *strings = (const gchar *)(knots + header->n_knots);
+
+	/* Knots are in depth-first order, so a parent always comes before its
+	 children; check everything before creating any knots */
+	for(ix = 0; ix < header->n_knots; ix++) {
+		if(ix == 0? knots[ix].parent != CACHE_NO_PARENT : knots[ix].parent >= ix)
+			goto fail;
+		for(type = 0; type < CACHE_N_STRINGS; type++)
+			if(!cache_string_valid(&knots[ix].strings[type], header->strings_size))
+				goto fail;
+	}
+
+	/* The string table keeps the file mapped as long as any knot needs it */
+	GBytes *table = g_bytes_new_with_free_func(strings, header->strings_size, (GDestroyNotify)g_mapped_file_unref, mapped);
+	I7Node **nodes = g_new(I7Node *, header->n_knots);
+
+	for(ix = 0; ix < header->n_knots; ix++) {
+		const CacheKnot *knot = &knots[ix];
+		gchar *command = get_cache_string(strings, knot, CACHE_STRING_COMMAND);
+		gchar *label = get_cache_string(strings, knot, CACHE_STRING_LABEL);
+		nodes[ix] = i7_node_new(command, label, NULL, NULL, FALSE,
+			(knot->flags & CACHE_KNOT_LOCKED) != 0, (knot->flags & CACHE_KNOT_CHANGED) != 0,
+			knot->score, GOO_CANVAS_ITEM_MODEL(self));
+		g_free(command);
+		g_free(label);
+
+		GBytes *transcript = get_cache_text(table, knot, CACHE_STRING_TRANSCRIPT);
+		GBytes *expected = get_cache_text(table, knot, CACHE_STRING_EXPECTED);
+		i7_node_restore_stored_texts(nodes[ix],
+			transcript, knot->strings[CACHE_STRING_TRANSCRIPT].packed_len,
+			expected, knot->strings[CACHE_STRING_EXPECTED].packed_len);
+		g_bytes_unref(transcript);
+		g_bytes_unref(expected);
+
+		node_listen(self, nodes[ix]);
+		if(ix > 0)
+			i7_node_append_child(nodes[knot->parent], nodes[ix]);
+	}
+
+	replace_skein(self, nodes[0], nodes[header->active]);
+
+	g_free(nodes);
+	g_bytes_unref(table);
+	return TRUE;
+
+fail:
+	g_mapped_file_unref(mapped);
+	return FALSE;
+}
+
+static void
+clear_cache_knot(CacheKnotSnapshot *knot)
+{
+	CacheStringType type;
+	for(type = 0; type < CACHE_N_STRINGS; type++)
+		g_bytes_unref(knot->strings[type]);
+}
+
+static void
+cache_snapshot_add_knot(GArray *knots, GNode *gnode, guint32 parent, I7Node *active, guint32 *active_index)
+{
+	I7Node *node = I7_NODE(gnode->data);
+	CacheKnotSnapshot knot;
+	gchar *command = i7_node_get_command(node);
+	gchar *label = i7_node_get_label(node);
+
+	knot.parent = parent;
+	knot.flags = (i7_node_get_locked(node)? CACHE_KNOT_LOCKED : 0)
+		| (i7_node_get_changed(node)? CACHE_KNOT_CHANGED : 0);
+	knot.score = i7_node_get_score(node);
+	knot.strings[CACHE_STRING_COMMAND] = g_bytes_new_take(command, strlen(command));
+	knot.packed_lens[CACHE_STRING_COMMAND] = 0;
+	knot.strings[CACHE_STRING_LABEL] = g_bytes_new_take(label, strlen(label));
+	knot.packed_lens[CACHE_STRING_LABEL] = 0;
+	knot.strings[CACHE_STRING_TRANSCRIPT] = i7_node_get_stored_transcript(node, &knot.packed_lens[CACHE_STRING_TRANSCRIPT]);
+	knot.strings[CACHE_STRING_EXPECTED] = i7_node_get_stored_expected(node, &knot.packed_lens[CACHE_STRING_EXPECTED]);
+	g_array_append_val(knots, knot);
+
+	guint32 index = knots->len - 1;
+	if(node == active)
+		*active_index = index;
+
+	for(gnode = gnode->children; gnode; gnode = gnode->next)
+		cache_snapshot_add_knot(knots, gnode, index, active, active_index);
+}
+
+/* Collects the contents of all the knots for writing to the cache; the texts
+are shared with the knots, not copied */
+static GArray *
+take_cache_snapshot(I7Skein *self, I7Node *active, guint32 *active_index)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	GArray *knots = g_array_new(FALSE, FALSE, sizeof(CacheKnotSnapshot));
+	g_array_set_clear_func(knots, (GDestroyNotify)clear_cache_knot);
+	*active_index = 0;
+	cache_snapshot_add_knot(knots, priv->root->gnode, CACHE_NO_PARENT, active, active_index);
+	return knots;
+}
+
+/* Writes @bytes to @stream, adding them to @checksum if it is not NULL */
+static gboolean
+write_bytes(GOutputStream *stream, GBytes *bytes, GChecksum *checksum, GError **error)
+{
+	gsize size;
+	gconstpointer data = g_bytes_get_data(bytes, &size);
+	if(checksum)
+		g_checksum_update(checksum, data, size);
+	return g_output_stream_write_all(stream, data, size, NULL, NULL, error);
+}
+
+/* Finishes writing a file opened with g_file_replace(). If anything went
+wrong, closes it with a cancelled cancellable, which discards the temporary
+file and leaves the old file intact. */
+static gboolean
+close_replaced_file(GFileOutputStream *fstream, gboolean success, GError **error)
+{
+	if(success)
+		return g_output_stream_close(G_OUTPUT_STREAM(fstream), NULL, error);
+
+	GCancellable *cancellable = g_cancellable_new();
+	g_cancellable_cancel(cancellable);
+	g_output_stream_close(G_OUTPUT_STREAM(fstream), cancellable, NULL);
+	g_object_unref(cancellable);
+	return FALSE;
+}
+
+/* Writes the cache file. Does not touch the skein, so may be called from any
+thread. */
+static gboolean
+write_cache(GFile *cache_file, const CacheKey *key, GArray *knots, guint32 active, GError **error)
+{
+	CacheHeader header;
+	CacheKnot record;
+	guint64 offset = 0;
+	unsigned ix;
+	CacheStringType type;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.byte_order = CACHE_BYTE_ORDER;
+	header.xml_size = key->size;
+	header.xml_mtime = key->mtime;
+	header.xml_mtime_usec = key->mtime_usec;
+	header.n_knots = knots->len;
+	memcpy(header.xml_hash, key->hash, CACHE_HASH_SIZE);
+	header.active = active;
+	for(ix = 0; ix < knots->len; ix++)
+		for(type = 0; type < CACHE_N_STRINGS; type++)
+			header.strings_size += g_bytes_get_size(g_array_index(knots, CacheKnotSnapshot, ix).strings[type]);
+
+	GFileOutputStream *fstream = g_file_replace(cache_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+	if(!fstream)
+		return FALSE;
+	GOutputStream *stream = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(fstream), SAVE_BUFFER_SIZE);
+	g_filter_output_stream_set_close_base_stream(G_FILTER_OUTPUT_STREAM(stream), FALSE);
+
+	gboolean success = g_output_stream_write_all(stream, &header, sizeof(header), NULL, NULL, error);
+
+	memset(&record, 0, sizeof(record));
+	for(ix = 0; success && ix < knots->len; ix++) {
+		CacheKnotSnapshot *knot = &g_array_index(knots, CacheKnotSnapshot, ix);
+		record.parent = knot->parent;
+		record.flags = knot->flags;
+		record.score = knot->score;
+		for(type = 0; type < CACHE_N_STRINGS; type++) {
+			record.strings[type].offset = offset;
+			record.strings[type].size = g_bytes_get_size(knot->strings[type]);
+			record.strings[type].packed_len = knot->packed_lens[type];
+			offset += record.strings[type].size;
+		}
+		success = g_output_stream_write_all(stream, &record, sizeof(record), NULL, NULL, error);
+	}
+
+	for(ix = 0; success && ix < knots->len; ix++)
+		for(type = 0; success && type < CACHE_N_STRINGS; type++)
+			success = write_bytes(stream, g_array_index(knots, CacheKnotSnapshot, ix).strings[type], NULL, error);
+
+	if(success)
+		success = g_output_stream_close(stream, NULL, error);
+	g_object_unref(stream);
+
+	success = close_replaced_file(fstream, success, error);
+	g_object_unref(fstream);
+	return success;
+}
+
+/* Writes the cache for a skein file that was just read. Failing to write the
+cache is not an error; the skein file will be read again next time. */
+static void
+update_cache(I7Skein *self, const CacheKey *key)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	guint32 active;
+	GArray *knots = take_cache_snapshot(self, priv->played, &active);
+	write_cache(priv->cache_file, key, knots, active, NULL);
+	g_array_free(knots, TRUE);
+}
+
+/* Reads the skein in one pass with a streaming reader, so that the whole XML
+document is never held in memory. The text content of each <item>'s fields is
+collected into a set of reusable buffers, and the knot is created when the
+</item> tag is reached; long transcripts are stored compressed by the knot
+until they are needed. Parent-child links are resolved at the end, since a
+<child> may refer to an item that comes later in the file.
+
+If a cache file has been set with i7_skein_set_cache_file(), and it was made
+from the same skein file, it is loaded instead; otherwise it is brought up to
+date after reading the XML. */
 gboolean
 i7_skein_load(I7Skein *self, GFile *file, GError **error)
 {
@@ -782,141 +1702,210 @@ i7_skein_load(I7Skein *self, GFile *file, GError **error)
 
 	I7_SKEIN_USE_PRIVATE;
 
+	/* Skip parsing the XML if the cache is up to date */
+	CacheKey key;
+	gboolean have_key = priv->cache_file && query_cache_key(file, &key, NULL);
+	if(have_key && load_cache(self, file, &key))
+		return TRUE;
+
 	char *filename = g_file_get_path(file);
-	xmlDoc *xmldoc = xmlParseFile(filename);
+	xmlTextReaderPtr reader = xmlReaderForFile(filename, NULL, XML_PARSE_NONET);
 	g_free(filename);
-	if(!xmldoc) {
+	if(!reader) {
 		xmlErrorPtr xml_error = xmlGetLastError();
 		if(error)
-			*error = g_error_new_literal(I7_SKEIN_ERROR, I7_SKEIN_ERROR_XML, g_strdup(xml_error->message));
+			*error = g_error_new_literal(I7_SKEIN_ERROR, I7_SKEIN_ERROR_XML, xml_error? xml_error->message : "Could not open skein file.");
 		return FALSE;
 	}
 
-	/* Get the top XML node */
-	xmlNode *top = xmlDocGetRootElement(xmldoc);
-	if(!xmlStrEqual(top->name, (xmlChar *)"Skein")) {
+	GHashTable *nodetable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GArray *pending = g_array_new(FALSE, FALSE, sizeof(PendingChildren));
+	GString *fields[ITEM_N_FIELDS];
+	ItemField field = ITEM_FIELD_NONE, count;
+	gboolean found_skein = FALSE, in_item = FALSE;
+	gchar *root_id = NULL, *active_id = NULL, *item_id = NULL;
+	GPtrArray *child_ids = NULL;
+	I7Node *root, *active, *node;
+	GHashTableIter iter;
+	int score = 0, status;
+	unsigned ix, jx;
+
+	for(count = 0; count < ITEM_N_FIELDS; count++)
+		fields[count] = g_string_sized_new(64);
+
+	while((status = xmlTextReaderRead(reader)) == 1) {
+		int type = xmlTextReaderNodeType(reader);
+		int depth = xmlTextReaderDepth(reader);
+
+		if(type == XML_READER_TYPE_ELEMENT) {
+			const xmlChar *name = xmlTextReaderConstLocalName(reader);
+			gboolean empty = xmlTextReaderIsEmptyElement(reader);
+
+			if(depth == 0) {
+				if(!xmlStrEqual(name, (xmlChar *)"Skein")) {
+					if(error)
+						*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "<Skein> element not found.");
+					goto fail;
+				}
+				/* Get the ID of the root node */
+				root_id = get_attribute_from_reader(reader, "rootNode");
+				if(!root_id) {
+					if(error)
+						*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "rootNode attribute not found.");
+					goto fail;
+				}
+				found_skein = TRUE;
+			} else if(depth == 1) {
+				if(xmlStrEqual(name, (xmlChar *)"activeNode")) {
+					g_free(active_id);
+					active_id = get_attribute_from_reader(reader, "nodeId");
+				} else if(xmlStrEqual(name, (xmlChar *)"item") && !empty) {
+					in_item = TRUE;
+					g_free(item_id);
+					item_id = get_attribute_from_reader(reader, "nodeId");
+					child_ids = NULL;
+					score = 0;
+					for(count = 0; count < ITEM_N_FIELDS; count++)
+						g_string_truncate(fields[count], 0);
+				}
+			} else if(in_item && depth == 2) {
+				/* Ignore "played"; it is calculated */
+				field = empty? ITEM_FIELD_NONE : lookup_item_field(name);
+				if(xmlStrEqual(name, (xmlChar *)"temporary")) {
+					gchar *trash = get_attribute_from_reader(reader, "score");
+					if(trash)
+						sscanf(trash, "%d", &score);
+					g_free(trash);
+				}
+			} else if(in_item && depth == 3 && xmlStrEqual(name, (xmlChar *)"child")) {
+				gchar *child_id = get_attribute_from_reader(reader, "nodeId");
+				if(child_id) {
+					if(!child_ids)
+						child_ids = g_ptr_array_new_with_free_func(g_free);
+					g_ptr_array_add(child_ids, child_id);
+				}
+			}
+		} else if(type == XML_READER_TYPE_TEXT
+			|| type == XML_READER_TYPE_CDATA
+			|| type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE
+			|| type == XML_READER_TYPE_WHITESPACE) {
+			if(in_item && depth == 3 && field != ITEM_FIELD_NONE)
+				g_string_append(fields[field], (const char *)xmlTextReaderConstValue(reader));
+		} else if(type == XML_READER_TYPE_END_ELEMENT) {
+			if(depth == 2) {
+				field = ITEM_FIELD_NONE;
+			} else if(depth == 1 && in_item) {
+				in_item = FALSE;
+				if(!item_id) {
+					if(error)
+						*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "nodeId attribute not found.");
+					if(child_ids)
+						g_ptr_array_free(child_ids, TRUE);
+					goto fail;
+				}
+
+				gboolean unlocked = get_boolean_from_content(fields[ITEM_FIELD_TEMPORARY], TRUE);
+				gboolean changed = get_boolean_from_content(fields[ITEM_FIELD_CHANGED], FALSE);
+				I7Node *skein_node = i7_node_new(fields[ITEM_FIELD_COMMAND]->str,
+					fields[ITEM_FIELD_LABEL]->str, NULL, NULL, FALSE, !unlocked,
+					changed, score, GOO_CANVAS_ITEM_MODEL(self));
+				i7_node_restore_texts(skein_node, fields[ITEM_FIELD_TRANSCRIPT]->str, fields[ITEM_FIELD_EXPECTED]->str);
+				node_listen(self, skein_node);
+				g_hash_table_insert(nodetable, item_id, skein_node); /* item_id freed by table */
+				item_id = NULL;
+
+				if(child_ids) {
+					PendingChildren link = { skein_node, child_ids };
+					g_array_append_val(pending, link);
+					child_ids = NULL;
+				}
+			}
+		}
+	}
+
+	if(status != 0) {
+		xmlErrorPtr xml_error = xmlGetLastError();
 		if(error)
-			*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "<Skein> element not found.");
+			*error = g_error_new_literal(I7_SKEIN_ERROR, I7_SKEIN_ERROR_XML, xml_error? xml_error->message : "Error reading skein file.");
 		goto fail;
 	}
-
-	/* Get the ID of the root node */
-	gchar *root_id = get_property_from_node(top, "rootNode");
-	if(!root_id) {
+	if(!found_skein) {
 		if(error)
-			*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "rootNode attribute not found.");
+			*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "<Skein> element not found.");
 		goto fail;
 	}
 
-	/* Get all the item nodes and the ID of the active node */
-	GHashTable *nodetable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-	gchar *active_id = NULL;
-	xmlNode *item;
-	/* Create a node object for each of the XML item nodes */
-	for(item = top->children; item; item = item->next) {
-		if(xmlStrEqual(item->name, (xmlChar *)"activeNode"))
-			active_id = get_property_from_node(item, "nodeId");
-		else if(xmlStrEqual(item->name, (xmlChar *)"item")) {
-			gchar *id, *command = NULL, *label = NULL;
-			gchar *transcript = NULL, *expected = NULL;
-			gboolean unlocked = TRUE, changed = FALSE;
-			int score = 0;
-
-			xmlNode *child;
-			for(child = item->children; child; child = child->next) {
-				/* Ignore "played" and "changed"; these are calculated */
-				if(xmlStrEqual(child->name, (xmlChar *)"command"))
-					command = get_text_content_from_node(child);
-				else if(xmlStrEqual(child->name, (xmlChar *)"annotation"))
-					label = get_text_content_from_node(child);
-				else if(xmlStrEqual(child->name, (xmlChar *)"result"))
-					transcript = get_text_content_from_node(child);
-				else if(xmlStrEqual(child->name, (xmlChar *)"commentary"))
-					expected = get_text_content_from_node(child);
-				else if(xmlStrEqual(child->name, (xmlChar *)"changed"))
-					changed = get_boolean_from_content(child, FALSE);
-				else if(xmlStrEqual(child->name, (xmlChar *)"temporary")) {
-					unlocked = get_boolean_from_content(child, TRUE);
-					gchar *trash = get_property_from_node(child, "score");
-					sscanf(trash, "%d", &score);
-					g_free(trash);
-				}
-			}
-			id = get_property_from_node(item, "nodeId"); /* freed by table */
-
-			I7Node *skein_node = i7_node_new(command, label, transcript, expected, FALSE, !unlocked, changed, score, GOO_CANVAS_ITEM_MODEL(self));
-			node_listen(self, skein_node);
-			g_hash_table_insert(nodetable, id, skein_node);
-			g_free(command);
-			g_free(label);
-			g_free(transcript);
-			g_free(expected);
-		}
+	root = g_hash_table_lookup(nodetable, root_id);
+	if(!root) {
+		if(error)
+			*error = g_error_new(I7_SKEIN_ERROR, I7_SKEIN_ERROR_BAD_FORMAT, "Root node %s not found.", root_id);
+		goto fail;
 	}
 
-	/* Loop through the item nodes again, adding the children to each parent */
-	for(item = top->children; item; item = item->next) {
-		if(!xmlStrEqual(item->name, (xmlChar *)"item"))
-			continue;
-		gchar *id = get_property_from_node(item, "nodeId");
-		I7Node *parent_node = g_hash_table_lookup(nodetable, id);
-		xmlNode *child;
-		for(child = item->children; child; child = child->next) {
-			if(!xmlStrEqual(child->name, (xmlChar *)"children"))
-				continue;
-			xmlNode *list;
-			for(list = child->children; list; list = list->next) {
-				if(!xmlStrEqual(list->name, (xmlChar *)"child"))
-					continue;
-				gchar *child_id = get_property_from_node(list, "nodeId");
-				g_node_append(parent_node->gnode, I7_NODE(g_hash_table_lookup(nodetable, child_id))->gnode);
-				g_free(child_id);
-			}
+	/* Add the children to each parent, now that all the knots exist */
+	for(ix = 0; ix < pending->len; ix++) {
+		PendingChildren *link = &g_array_index(pending, PendingChildren, ix);
+		for(jx = 0; jx < link->child_ids->len; jx++) {
+			I7Node *child = g_hash_table_lookup(nodetable, g_ptr_array_index(link->child_ids, jx));
+			/* Skip dangling references and knots that already have a parent */
+			if(child && child != root && G_NODE_IS_ROOT(child->gnode))
+				i7_node_append_child(link->node, child);
 		}
-		g_free(id);
 	}
 
-	/* Discard the current skein and replace with the new */
-	g_node_traverse(priv->root->gnode, G_POST_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)remove_node_from_canvas, self);
-	priv->root = I7_NODE(g_hash_table_lookup(nodetable, root_id));
-	priv->played = NULL;
-	i7_skein_set_played_node(self, I7_NODE(g_hash_table_lookup(nodetable, active_id)));
-	i7_skein_set_current_node(self, priv->root);
+	active = active_id? g_hash_table_lookup(nodetable, active_id) : NULL;
+	replace_skein(self, root, active);
 
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "labels-changed");
-	priv->modified = FALSE;
+	/* Make the next load faster */
+	if(have_key && hash_file(file, key.hash))
+		update_cache(self, &key);
 
+	for(count = 0; count < ITEM_N_FIELDS; count++)
+		g_string_free(fields[count], TRUE);
+	for(ix = 0; ix < pending->len; ix++)
+		g_ptr_array_free(g_array_index(pending, PendingChildren, ix).child_ids, TRUE);
+	g_array_free(pending, TRUE);
 	g_free(root_id);
 	g_free(active_id);
 	g_hash_table_destroy(nodetable);
+	xmlFreeTextReader(reader);
 
 	return TRUE;
 fail:
-	xmlFreeDoc(xmldoc);
+	/* Throw away any knots that were already created; they aren't linked
+	 together yet */
+	g_hash_table_iter_init(&iter, nodetable);
+	while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&node))
+		remove_node_from_canvas(node->gnode, self);
+
+	for(count = 0; count < ITEM_N_FIELDS; count++)
+		g_string_free(fields[count], TRUE);
+	for(ix = 0; ix < pending->len; ix++)
+		g_ptr_array_free(g_array_index(pending, PendingChildren, ix).child_ids, TRUE);
+	g_array_free(pending, TRUE);
+	g_free(item_id);
+	g_free(root_id);
+	g_free(active_id);
+	g_hash_table_destroy(nodetable);
+	xmlFreeTextReader(reader);
 	return FALSE;
 }
 
 static gboolean
-node_write_xml(GNode *gnode, GDataOutputStream *stream)
+snapshot_add_node(GNode *gnode, GPtrArray *fragments)
 {
-	gchar *xml = i7_node_get_xml(I7_NODE(gnode->data));
-	g_data_output_stream_put_string(stream, xml, NULL, NULL);
-	g_free(xml);
+	g_ptr_array_add(fragments, i7_node_get_xml_fragment(I7_NODE(gnode->data)));
 	return FALSE; /* Do not stop the traversal */
 }
 
-gboolean
-i7_skein_save(I7Skein *self, GFile *file, GError **error)
+static SkeinSnapshot *
+take_snapshot(I7Skein *self, GFile *file)
 {
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-
 	I7_SKEIN_USE_PRIVATE;
 
-	GFileOutputStream *fstream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
-	if(!fstream)
-		return FALSE;
-	GDataOutputStream *skein_stream = g_data_output_stream_new(G_OUTPUT_STREAM(fstream));
+	SkeinSnapshot *snapshot = g_slice_new0(SkeinSnapshot);
+	snapshot->skein = self;
+	snapshot->file = g_file_dup(file);
 
 	char *header = g_strdup_printf(
 			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
@@ -926,74 +1915,362 @@ i7_skein_save(I7Skein *self, GFile *file, GError **error)
 			"  <activeNode nodeId=\"%s\"/>\n",
 			i7_node_get_unique_id(priv->root),
 			i7_node_get_unique_id(priv->current));
-	if(!g_data_output_stream_put_string(skein_stream, header, NULL, error))
-		return FALSE;
+	snapshot->header = g_bytes_new_take(header, strlen(header));
+
+	snapshot->fragments = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+	g_node_traverse(priv->root->gnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)snapshot_add_node, snapshot->fragments);
 
-	g_node_traverse(priv->root->gnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)node_write_xml, skein_stream);
+	if(priv->cache_file) {
+		snapshot->cache_file = g_file_dup(priv->cache_file);
+		snapshot->cache_knots = take_cache_snapshot(self, priv->current, &snapshot->cache_active);
+	}
+
+	return snapshot;
+}
 
-	if(!g_data_output_stream_put_string(skein_stream, "</Skein>\n", NULL, error))
+static void
+free_snapshot(SkeinSnapshot *snapshot)
+{
+	g_object_unref(snapshot->file);
+	g_bytes_unref(snapshot->header);
+	g_ptr_array_free(snapshot->fragments, TRUE);
+	if(snapshot->cache_file) {
+		g_object_unref(snapshot->cache_file);
+		g_array_free(snapshot->cache_knots, TRUE);
+	}
+	if(snapshot->error)
+		g_error_free(snapshot->error);
+	g_slice_free(SkeinSnapshot, snapshot);
+}
+
+/* Writes the snapshot out. Does not touch the skein, so may be called from any
+thread. g_file_replace() writes to a temporary file which is only renamed over
+the old skein when the stream is closed, so a failed save leaves the old file
+intact. The cache is written afterwards, keyed to the new skein file. */
+static gboolean
+write_snapshot(SkeinSnapshot *snapshot, GError **error)
+{
+	GFileOutputStream *fstream = g_file_replace(snapshot->file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+	if(!fstream)
 		return FALSE;
+	GOutputStream *stream = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(fstream), SAVE_BUFFER_SIZE);
+	g_filter_output_stream_set_close_base_stream(G_FILTER_OUTPUT_STREAM(stream), FALSE);
+	GChecksum *checksum = snapshot->cache_file? g_checksum_new(CACHE_HASH_TYPE) : NULL;
+	GBytes *footer = g_bytes_new_static("</Skein>\n", strlen("</Skein>\n"));
+
+	unsigned ix;
+	gboolean success = write_bytes(stream, snapshot->header, checksum, error);
+	for(ix = 0; success && ix < snapshot->fragments->len; ix++)
+		success = write_bytes(stream, g_ptr_array_index(snapshot->fragments, ix), checksum, error);
+	if(success)
+		success = write_bytes(stream, footer, checksum, error);
+	if(success)
+		success = g_output_stream_close(stream, NULL, error);
+	g_object_unref(stream);
+	g_bytes_unref(footer);
 
-	g_object_unref(skein_stream);
+	success = close_replaced_file(fstream, success, error);
 	g_object_unref(fstream);
 
-	priv->modified = FALSE;
+	CacheKey key;
+	if(success && checksum && query_cache_key(snapshot->file, &key, NULL)) {
+		gsize hash_size = CACHE_HASH_SIZE;
+		g_checksum_get_digest(checksum, key.hash, &hash_size);
+		write_cache(snapshot->cache_file, &key, snapshot->cache_knots, snapshot->cache_active, NULL);
+	}
+	if(checksum)
+		g_checksum_free(checksum);
 
-	return TRUE;
+	return success;
 }
 
-/* Imports a list of commands into the Skein */
+/* Called on the main thread after a snapshot has been written */
+static void
+finish_save(I7Skein *self, SkeinSnapshot *snapshot)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	/* Changes that were made in the meantime have set the modified flag again */
+	if(!snapshot->success) {
+		priv->modified = TRUE;
+		g_signal_emit_by_name(self, "modified");
+	}
+	if(snapshot->callback)
+		snapshot->callback(self, snapshot->error, snapshot->data);
+	snapshot->finished = TRUE;
+}
+
+static gpointer save_thread_func(SkeinSnapshot *snapshot);
+
+static void
+start_save_thread(I7Skein *self, SkeinSnapshot *snapshot)
+{
+	I7_SKEIN_USE_PRIVATE;
+	/* Keep the skein alive until save_finished_idle() has run */
+	g_object_ref(self);
+	priv->save_running = snapshot;
+	priv->save_thread = g_thread_new("skein-save", (GThreadFunc)save_thread_func, snapshot);
+}
+
+static gboolean
+save_finished_idle(SkeinSnapshot *snapshot)
+{
+	I7Skein *self = snapshot->skein;
+	I7_SKEIN_USE_PRIVATE;
+
+	/* i7_skein_wait_for_save() may have dealt with it already */
+	if(!snapshot->finished) {
+		g_thread_join(priv->save_thread);
+		priv->save_thread = NULL;
+		priv->save_running = NULL;
+		finish_save(self, snapshot);
+
+		/* Only the most recent request that came in while saving gets written */
+		if(priv->save_pending) {
+			SkeinSnapshot *pending = priv->save_pending;
+			priv->save_pending = NULL;
+			start_save_thread(self, pending);
+		}
+	}
+
+	free_snapshot(snapshot);
+	g_object_unref(self);
+	return FALSE; /* one-shot */
+}
+
+static gpointer
+save_thread_func(SkeinSnapshot *snapshot)
+{
+	snapshot->success = write_snapshot(snapshot, &snapshot->error);
+	gdk_threads_add_idle((GSourceFunc)save_finished_idle, snapshot);
+	return NULL;
+}
+
+/* Writes the skein file synchronously. Any save still running in the
+ background is finished first, so that an older snapshot can't overwrite this
+ one. */
 gboolean
-i7_skein_import(I7Skein *self, GFile *file, GError **error)
+i7_skein_save(I7Skein *self, GFile *file, GError **error)
 {
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-	g_return_val_if_fail(file, FALSE);
-	
+
 	I7_SKEIN_USE_PRIVATE;
-	
+
+	i7_skein_wait_for_save(self);
+
+	SkeinSnapshot *snapshot = take_snapshot(self, file);
+	gboolean success = write_snapshot(snapshot, error);
+	free_snapshot(snapshot);
+
+	if(success)
+		priv->modified = FALSE;
+
+	return success;
+}
+
+/*
+ * i7_skein_save_in_background:
+ * @self: the skein
+ * @file: the file to save to
+ * @callback: (allow-none): function to call on the main thread when the file
+ * has been written, or %NULL
+ * @data: user data for @callback
+ *
+ * Takes a snapshot of the skein and writes it out on another thread, so that
+ * saving a big skein doesn't block the user interface. If a save is already
+ * running, the snapshot is written after it finishes; if another request
+ * comes in before then, it replaces this one, and @callback is called with
+ * a %G_IO_ERROR_CANCELLED error.
+ *
+ * The skein is marked as unmodified straight away. If writing fails, it is
+ * marked as modified again and @callback receives the error.
+ */
+void
+i7_skein_save_in_background(I7Skein *self, GFile *file, I7SkeinSaveFunc callback, gpointer data)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	SkeinSnapshot *snapshot = take_snapshot(self, file);
+	snapshot->callback = callback;
+	snapshot->data = data;
+	priv->modified = FALSE;
+
+	if(!priv->save_thread) {
+		start_save_thread(self, snapshot);
+		return;
+	}
+
+	if(priv->save_pending) {
+		SkeinSnapshot *superseded = priv->save_pending;
+		superseded->success = TRUE; /* the newer snapshot will be saved */
+		g_set_error_literal(&superseded->error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Superseded by a newer save");
+		finish_save(self, superseded);
+		free_snapshot(superseded);
+	}
+	priv->save_pending = snapshot;
+}
+
+/*
+ * i7_skein_wait_for_save:
+ * @self: the skein
+ *
+ * Blocks until any saves started with i7_skein_save_in_background() have
+ * been written to disk, and calls their callbacks. Call this before the
+ * program exits.
+ */
+void
+i7_skein_wait_for_save(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	if(priv->save_thread) {
+		SkeinSnapshot *running = priv->save_running;
+		g_thread_join(priv->save_thread);
+		priv->save_thread = NULL;
+		priv->save_running = NULL;
+		/* The thread's idle callback will still run, but only to free it */
+		finish_save(self, running);
+	}
+
+	if(priv->save_pending) {
+		SkeinSnapshot *pending = priv->save_pending;
+		priv->save_pending = NULL;
+		pending->success = write_snapshot(pending, &pending->error);
+		finish_save(self, pending);
+		free_snapshot(pending);
+	}
+}
+
+/*
+ * i7_skein_set_cache_file:
+ * @self: the skein
+ * @cache_file: (allow-none): where to keep a binary copy of the skein, or
+ * %NULL for none
+ *
+ * Sets a file in which to keep a copy of the skein that loads faster than the
+ * skein file. It is written whenever the skein is saved or read from the
+ * skein file, and i7_skein_load() reads it instead of the skein file if the
+ * skein file hasn't changed since then.
+ */
+void
+i7_skein_set_cache_file(I7Skein *self, GFile *cache_file)
+{
+	I7_SKEIN_USE_PRIVATE;
+
+	if(priv->cache_file)
+		g_object_unref(priv->cache_file);
+	priv->cache_file = cache_file? g_file_dup(cache_file) : NULL;
+}
+
+/* Whether @line has characters that g_strescape() would change, apart from
+ double quotes */
+static gboolean
+command_needs_escape(const char *line)
+{
+	const guchar *ptr;
+	for(ptr = (const guchar *)line; *ptr; ptr++)
+		if(*ptr < 0x20 || *ptr == '\\' || *ptr >= 0x7f)
+			return TRUE;
+	return FALSE;
+}
+
+/* Adds the commands in @contents, one per line, as a thread starting at the
+ root; @contents is modified. Returns TRUE if any knots were added. */
+static gboolean
+import_commands(I7Skein *self, char *contents, gsize length)
+{
+	I7_SKEIN_USE_PRIVATE;
+
 	I7Node *node = priv->root;
 	gboolean added = FALSE;
+	char *end = contents + length;
+	char *line = contents;
 
-	GFileInputStream *istream = g_file_read(file, NULL, error);
-	if(!istream)
-		return FALSE;
-	GDataInputStream *stream = g_data_input_stream_new(G_INPUT_STREAM(istream));
+	while(line < end) {
+		char *newline = memchr(line, '\n', end - line);
+		char *next = newline? newline + 1 : end;
+		if(newline)
+			*newline = '\0';
 
-	gchar *line;
-	while((line = g_data_input_stream_read_line(stream, NULL, NULL, error))) {
+		/* The buffer has an extra nul byte at the end, so this is safe for the
+		 last line too */
 		g_strstrip(line);
 		if(*line) {
-			gchar *node_command = g_strescape(line, "\"");
+			gchar *escaped = command_needs_escape(line)? g_strescape(line, "\"") : NULL;
+			const gchar *node_command = escaped? escaped : line;
 			I7Node *newnode = i7_node_find_child(node, node_command);
 			if(!newnode) {
 				/* Wasn't found, create new node */
 				newnode = i7_node_new(node_command, "", "", "", FALSE, FALSE, FALSE, 0, GOO_CANVAS_ITEM_MODEL(self));
 				node_listen(self, newnode);
-				g_node_append(node->gnode, newnode->gnode);
+				i7_node_append_child(node, newnode);
+				index_add_knot(self, newnode);
 				added = TRUE;
 			}
-			g_free(node_command);
-			node = newnode;	
+			g_free(escaped);
+			node = newnode;
 		}
-		g_free(line);
+		line = next;
 	}
+	return added;
+}
 
-	if(*error)
-		goto fail;
+/*
+ * i7_skein_import_files:
+ * @self: the skein
+ * @files: a list of #GFile<!---->s containing commands, one per line
+ * @error: return location for an error, or %NULL
+ *
+ * Imports each command script in @files into the skein as a thread starting
+ * at the root. Threads that begin with the same commands share their knots.
+ * The files are read completely before anything is added, so if one of them
+ * can't be read, the skein is left unchanged.
+ *
+ * Returns: %TRUE on success, %FALSE if @error was set.
+ */
+gboolean
+i7_skein_import_files(I7Skein *self, GSList *files, GError **error)
+{
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	if(added) {
-		g_signal_emit_by_name(self, "needs-layout");
-		g_signal_emit_by_name(self, "modified");
+	GPtrArray *contents = g_ptr_array_new_with_free_func(g_free);
+	GArray *lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+	GSList *iter;
+	for(iter = files; iter; iter = g_slist_next(iter)) {
+		char *buffer;
+		gsize length;
+		/* g_file_load_contents() always nul-terminates the buffer */
+		if(!g_file_load_contents(G_FILE(iter->data), NULL, &buffer, &length, NULL, error)) {
+			g_ptr_array_free(contents, TRUE);
+			g_array_free(lengths, TRUE);
+			return FALSE;
+		}
+		g_ptr_array_add(contents, buffer);
+		g_array_append_val(lengths, length);
 	}
 
-	g_object_unref(stream);
-	g_object_unref(istream);
+	i7_skein_begin_batch(self);
+	gboolean added = FALSE;
+	guint ix;
+	for(ix = 0; ix < contents->len; ix++)
+		added |= import_commands(self, contents->pdata[ix], g_array_index(lengths, gsize, ix));
+	if(added)
+		queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
+	i7_skein_end_batch(self);
+
+	g_ptr_array_free(contents, TRUE);
+	g_array_free(lengths, TRUE);
 	return TRUE;
+}
 
-fail:
-	g_object_unref(stream);
-	g_object_unref(istream);
-	return FALSE;
+/* Imports a list of commands into the Skein */
+gboolean
+i7_skein_import(I7Skein *self, GFile *file, GError **error)
+{
+	g_return_val_if_fail(file, FALSE);
+
+	GSList files = { file, NULL };
+	return i7_skein_import_files(self, &files, error);
 }
 
 /* Rewinds the skein to the beginning; if @current is TRUE, also resets the
@@ -1016,8 +2293,34 @@ rgba_from_gdk_color(GdkColor *color)
 		| 0xFF;
 }
 
+/* Bits of I7Node.tree_style */
+#define TREE_STYLE_LOCKED (1 << 0)
+#define TREE_STYLE_CURRENT (1 << 1)
+
+/* Returns the nodes of the current thread, indexed by depth. During a batch the
+ rows of the tree model may not have caught up with the tree yet, so then the
+ thread is collected from the tree instead. Free with g_ptr_array_unref(). */
+static GPtrArray *
+get_drawing_thread(I7Skein *self)
+{
+	I7_SKEIN_USE_PRIVATE;
+	if(!(priv->batch_pending & BATCH_THREAD))
+		return g_ptr_array_ref(priv->thread);
+
+	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
+	guint len = g_node_depth(last->gnode);
+	GPtrArray *thread = g_ptr_array_sized_new(len);
+	g_ptr_array_set_size(thread, len);
+	GNode *gnode;
+	for(gnode = last->gnode; gnode; gnode = gnode->parent)
+		thread->pdata[--len] = gnode->data;
+	return thread;
+}
+
+/* @depth is the depth of @node, counting the root as 0, and @thread is the
+ current thread from get_drawing_thread() */
 static void
-draw_tree(I7Skein *self, I7Node *node, GooCanvas *canvas)
+draw_tree(I7Skein *self, I7Node *node, GooCanvas *canvas, int depth, GPtrArray *thread)
 {
 	I7_SKEIN_USE_PRIVATE;
 
@@ -1026,13 +2329,20 @@ draw_tree(I7Skein *self, I7Node *node, GooCanvas *canvas)
 		/* Calculate the coordinates */
 		gdouble nodex = i7_node_get_x(node);
 		gdouble destx = i7_node_get_x(I7_NODE(node->gnode->parent->data));
-		gdouble nodey = (gdouble)(g_node_depth(node->gnode) - 1.0) * priv->vspacing;
+		gdouble nodey = (gdouble)depth * priv->vspacing;
 		gdouble desty = nodey - priv->vspacing;
 
-		if(!node->tree_item)
+		gboolean new_line = FALSE;
+		if(!node->tree_item) {
 			node->tree_item = goo_canvas_polyline_model_new(GOO_CANVAS_ITEM_MODEL(self), FALSE, 0, NULL);
+			goo_canvas_item_model_lower(node->tree_item, NULL); /* put at bottom */
+			if(!node->tree_points)
+				node->tree_points = goo_canvas_points_new(4);
+			node->tree_style = -1;
+			new_line = TRUE;
+		}
 
-		if(node->tree_points->coords[0] != destx || node->tree_points->coords[4] != nodex) {
+		if(new_line || node->tree_points->coords[0] != destx || node->tree_points->coords[4] != nodex) {
 			node->tree_points->coords[0] = node->tree_points->coords[2] = destx;
 			node->tree_points->coords[1] = desty;
 			node->tree_points->coords[3] = desty + 0.2 * priv->vspacing;
@@ -1042,30 +2352,26 @@ draw_tree(I7Skein *self, I7Node *node, GooCanvas *canvas)
 			g_object_set(node->tree_item, "points", node->tree_points, NULL);
 		}
 
-		gboolean in_current_thread = i7_skein_is_node_in_current_thread(self, node);
-		
-		if(i7_node_get_locked(node))
-			g_object_set(node->tree_item,
-				"stroke-color-rgba", rgba_from_gdk_color(&priv->locked),
-			    "line-dash", priv->locked_dash,
-				"line-width", in_current_thread? 4.0 : 1.5,
-				NULL);
-		else
+		/* Only touch the line style if it changed since the last draw, so that
+		 moving the current knot restyles only the old and new threads */
+		gboolean in_current_thread = thread_has_node_at(thread, node, depth);
+		gboolean locked = i7_node_get_locked(node);
+		int style = (locked? TREE_STYLE_LOCKED : 0) | (in_current_thread? TREE_STYLE_CURRENT : 0);
+
+		if(style != node->tree_style || priv->tree_styles_stale) {
 			g_object_set(node->tree_item,
-				"stroke-color-rgba", rgba_from_gdk_color(&priv->unlocked),
-				"line-dash", priv->unlocked_dash,
+				"stroke-color-rgba", rgba_from_gdk_color(locked? &priv->locked : &priv->unlocked),
+				"line-dash", locked? priv->locked_dash : priv->unlocked_dash,
 				"line-width", in_current_thread? 4.0 : 1.5,
 				NULL);
-
-		goo_canvas_item_model_lower(node->tree_item, NULL); /* put at bottom */
+			node->tree_style = style;
+		}
 	}
 
 	/* Draw the children's lines to this node */
-	unsigned i;
-	for(i = 0; i < g_node_n_children(node->gnode); i++) {
-		I7Node *child = g_node_nth_child(node->gnode, i)->data;
-		draw_tree(self, child, canvas);
-	}
+	GNode *iter;
+	for(iter = node->gnode->children; iter; iter = iter->next)
+		draw_tree(self, iter->data, canvas, depth + 1, thread);
 }
 
 static void
@@ -1079,7 +2385,10 @@ draw_intern(I7Skein *self, GooCanvas *canvas)
 	i7_node_layout(priv->root, GOO_CANVAS_ITEM_MODEL(self), canvas, 0.0);
 
 	gdouble treewidth = i7_node_get_tree_width(priv->root, GOO_CANVAS_ITEM_MODEL(self), canvas);
-	draw_tree(self, priv->root, canvas);
+	GPtrArray *thread = get_drawing_thread(self);
+	draw_tree(self, priv->root, canvas, 0, thread);
+	g_ptr_array_unref(thread);
+	priv->tree_styles_stale = FALSE;
 
 	goo_canvas_set_bounds(canvas,
 		-treewidth * 0.5 - priv->hspacing, -(priv->vspacing) * 0.5,
@@ -1124,41 +2433,19 @@ i7_skein_schedule_draw(I7Skein *self, GooCanvas *canvas)
 	gdk_threads_add_idle_full(G_PRIORITY_DEFAULT_IDLE, (GSourceFunc)idle_draw, draw_data, (GDestroyNotify)destroy_draw_data);
 }
 
-/* Remove all the rows from the tree model, in preparation for a complicated
- * modification */
+/* Asks the views to show a knot that was just played; during a batch, only the
+last such knot is shown */
 static void
-remove_all_from_model(I7Skein *self)
-{
-	int nrows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(self), NULL);
-	int count;
-	for(count = nrows - 1; count >= 0; count--) {
-		GtkTreePath *path = gtk_tree_path_new_from_indices(count, -1);
-		gtk_tree_model_row_deleted(GTK_TREE_MODEL(self), path);
-		gtk_tree_path_free(path);
-	}
-}
-
-/* Put all the rows of the current thread back in the tree model, after
- * finishing a complicated modification */
-static void
-reinstate_all_in_model(I7Skein *self)
+show_played_node(I7Skein *self, I7Node *node)
 {
 	I7_SKEIN_USE_PRIVATE;
-	I7Node *last = i7_skein_get_thread_bottom(self, priv->current);
-	GNode *gnode = priv->root->gnode;
-	while(gnode) {
-		int depth = g_node_depth(gnode) - 1;
-		GtkTreePath *path = gtk_tree_path_new_from_indices(depth, -1);
-		GtkTreeIter iter = { .stamp = priv->stamp, .user_data = gnode->data };
-		gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
-		gtk_tree_path_free(path);
-
-		/* Advance to the next node in the thread */
-		for(gnode = gnode->children; gnode; gnode = gnode->next) {
-			if(i7_node_in_thread(gnode->data, last))
-				break;
-		}
+	if(priv->batch_depth > 0) {
+		if(priv->batch_show_node)
+			g_object_unref(priv->batch_show_node);
+		priv->batch_show_node = g_object_ref(node);
+		return;
 	}
+	g_signal_emit_by_name(self, "show-node", I7_REASON_COMMAND, node);
 }
 
 /* Add a new node with the given command, under the played node. Unless there
@@ -1180,12 +2467,9 @@ i7_skein_new_command(I7Skein *self, const gchar *command)
 		node = i7_node_new(node_command, "", "", "", TRUE, FALSE, FALSE, 0, GOO_CANVAS_ITEM_MODEL(self));
 		node_listen(self, node);
 
-		gboolean remove = i7_skein_is_node_in_current_thread(self, priv->played);
-		if(remove)
-		   remove_all_from_model(self);
-		g_node_append(priv->played->gnode, node->gnode);
-		if(remove)
-			reinstate_all_in_model(self);
+		i7_node_append_child(priv->played, node);
+		index_add_knot(self, node);
+		queue_changes(self, BATCH_THREAD);
 		node_added = TRUE;
 	}
 	g_free(node_command);
@@ -1195,10 +2479,8 @@ i7_skein_new_command(I7Skein *self, const gchar *command)
 	i7_skein_set_played_node(self, node);
 
 	/* Send signals */
-	if(node_added)
-		g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "show-node", I7_REASON_COMMAND, node);
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, node_added? BATCH_LAYOUT | BATCH_MODIFIED : BATCH_MODIFIED);
+	show_played_node(self, node);
 
 	return node;
 }
@@ -1220,7 +2502,7 @@ i7_skein_next_command(I7Skein *self, gchar **command)
 	gchar *temp = i7_node_get_command(next);
 	*command = g_strcompress(temp);
 	g_free(temp);
-	g_signal_emit_by_name(self, "show-node", I7_REASON_COMMAND, next);
+	show_played_node(self, next);
 	return TRUE;
 }
 
@@ -1292,12 +2574,9 @@ i7_skein_add_new(I7Skein *self, I7Node *node)
 	I7Node *newnode = i7_node_new("", "", "", "", FALSE, FALSE, FALSE, 0, GOO_CANVAS_ITEM_MODEL(self));
 	node_listen(self, newnode);
 
-	remove_all_from_model(self);
-	g_node_append(node->gnode, newnode->gnode);
-	reinstate_all_in_model(self);
-
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "modified");
+	i7_node_append_child(node, newnode);
+	index_add_knot(self, newnode);
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
 
 	return newnode;
 }
@@ -1308,14 +2587,13 @@ i7_skein_add_new_parent(I7Skein *self, I7Node *node)
 	I7Node *newnode = i7_node_new("", "", "", "", FALSE, FALSE, FALSE, 0, GOO_CANVAS_ITEM_MODEL(self));
 	node_listen(self, newnode);
 
-	remove_all_from_model(self);
-	g_node_insert(node->gnode->parent, g_node_child_position(node->gnode->parent, node->gnode), newnode->gnode);
-	g_node_unlink(node->gnode);
-	g_node_append(newnode->gnode, node->gnode);
-	reinstate_all_in_model(self);
-
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "modified");
+	I7Node *parent = node->gnode->parent->data;
+	i7_node_insert_child(parent, g_node_child_position(parent->gnode, node->gnode), newnode);
+	i7_node_unlink(node);
+	i7_node_append_child(newnode, node);
+	/* The other knots stay in the same order, so only the new one is indexed */
+	index_add_knot(self, newnode);
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
 
 	return newnode;
 }
@@ -1334,13 +2612,9 @@ i7_skein_remove_all(I7Skein *self, I7Node *node)
 	if(i7_skein_is_node_in_current_thread(self, node))
 		i7_skein_set_current_node(self, priv->root);
 	
-	remove_all_from_model(self);
-	g_node_unlink(node->gnode);
+	i7_node_unlink(node);
 	g_node_traverse(node->gnode, G_POST_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)remove_node_from_canvas, self);
-	reinstate_all_in_model(self);
-	
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
 	return TRUE;
 }
 
@@ -1357,21 +2631,17 @@ i7_skein_remove_single(I7Skein *self, I7Node *node)
 	if(i7_skein_is_node_in_current_thread(self, node))
 		i7_skein_set_current_node(self, priv->root);
 
-	remove_all_from_model(self);
 	if(!G_NODE_IS_LEAF(node->gnode)) {
 		int i;
 		for(i = g_node_n_children(node->gnode) - 1; i >= 0; i--) {
-			GNode *iter = g_node_nth_child(node->gnode, i);
-			g_node_unlink(iter);
-			g_node_insert_after(node->gnode->parent, node->gnode, iter);
+			I7Node *child = g_node_nth_child(node->gnode, i)->data;
+			i7_node_unlink(child);
+			i7_node_insert_child_after(node->gnode->parent->data, node, child);
 		}
 	}
-	g_node_unlink(node->gnode);
+	i7_node_unlink(node);
 	remove_node_from_canvas(node->gnode, self);
-	reinstate_all_in_model(self);
-	
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
 	return TRUE;
 }
 
@@ -1401,75 +2671,109 @@ void
 i7_skein_unlock(I7Skein *self, I7Node *node)
 {
 	i7_skein_unlock_recurse(self, node);
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, BATCH_MODIFIED);
 }
 
+/* Collects in @doomed the children of @node, and their descendants, that are
+ to be trimmed. A knot that is trimmed takes its whole subtree with it. */
 static void
-i7_skein_trim_recurse(I7Skein *self, I7Node *node, gint min_score)
+collect_trimmed_nodes(I7Node *node, gint min_score, GPtrArray *doomed)
 {
-	I7_SKEIN_USE_PRIVATE;
-
-	unsigned i = 0;
-	while(i < g_node_n_children(node->gnode)) {
-		I7Node *child = g_node_nth_child(node->gnode, i)->data;
-		if(i7_node_get_locked(child) || i7_node_get_score(child) > min_score) {
-			i7_skein_trim_recurse(self, child, min_score);
-			i++;
-		} else {
-			if(i7_skein_is_node_in_current_thread(self, child)) {
-				i7_skein_set_current_node(self, priv->root);
-				i7_skein_set_played_node(self, priv->root);
-			}
-
-			if(i7_skein_remove_all(self, child) == FALSE)
-				i++;
-		}
+	GNode *iter;
+	for(iter = node->gnode->children; iter; iter = iter->next) {
+		I7Node *child = iter->data;
+		if(i7_node_get_locked(child) || i7_node_get_score(child) > min_score)
+			collect_trimmed_nodes(child, min_score, doomed);
+		else
+			g_ptr_array_add(doomed, child);
 	}
 }
 
+static gboolean
+collect_score(GNode *gnode, GArray *scores)
+{
+	gint score = i7_node_get_score(I7_NODE(gnode->data));
+	g_array_append_val(scores, score);
+	return FALSE; /* don't stop the traversal */
+}
+
 static gint
 int_compare_reversed(gconstpointer a, gconstpointer b)
 {
-	return GPOINTER_TO_INT(a) < GPOINTER_TO_INT(b);
+	gint first = *(const gint *)a, second = *(const gint *)b;
+	return (first < second) - (first > second);
 }
 
-static gboolean
-look_for_scores(GNode *gnode, GList **listptr)
+/* Returns the (@n + 1)th highest distinct score in the skein, or 0 if there are
+ not that many */
+static gint
+get_cutoff_score(I7Skein *self, gint n)
 {
-	gint score = i7_node_get_score(I7_NODE(gnode->data));
+	I7_SKEIN_USE_PRIVATE;
 
-	if(g_list_index(*listptr, GINT_TO_POINTER(score)) == -1)
-		*listptr = g_list_insert_sorted(*listptr, GINT_TO_POINTER(score), int_compare_reversed);
+	GArray *scores = g_array_new(FALSE, FALSE, sizeof(gint));
+	g_node_traverse(priv->root->gnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)collect_score, scores);
+	g_array_sort(scores, int_compare_reversed);
 
-	return FALSE; /* don't stop the traversal */
+	gint cutoff = 0;
+	guint i, distinct = 0;
+	for(i = 0; i < scores->len; i++) {
+		gint score = g_array_index(scores, gint, i);
+		if(i > 0 && score == g_array_index(scores, gint, i - 1))
+			continue;
+		if(distinct++ == (guint)n) {
+			cutoff = score;
+			break;
+		}
+	}
+
+	g_array_free(scores, TRUE);
+	return cutoff;
 }
 
-/*static void
-print_score(gpointer item, gpointer data)
+static gboolean
+is_attached(I7Skein *self, I7Node *node)
 {
-	g_print("%d ", GPOINTER_TO_INT(item));
-}*/
+	I7_SKEIN_USE_PRIVATE;
+	return g_node_get_root(node->gnode) == priv->root->gnode;
+}
 
 void
 i7_skein_trim(I7Skein *self, I7Node *node, gint max_temps)
 {
 	I7_SKEIN_USE_PRIVATE;
 
-	GList *scores_in_use = NULL;
-	g_node_traverse(priv->root->gnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)look_for_scores, &scores_in_use);
+	/* Keep only the highest @max_temps scores (and those that are locked, of course) */
+	gint min_score = get_cutoff_score(self, max_temps);
+
+	GPtrArray *doomed = g_ptr_array_new();
+	collect_trimmed_nodes(node, min_score, doomed);
+	if(doomed->len == 0) {
+		g_ptr_array_free(doomed, TRUE);
+		return;
+	}
 
-	/*g_print("Scores in use: ");
-	g_list_foreach(scores_in_use, print_score, NULL);
-	g_print("\n");*/
+	i7_skein_begin_batch(self);
 
-	/* Keep only the highest @max_temps scores (and those that are locked, of course) */
-	gint min_score = GPOINTER_TO_INT(g_list_nth_data(scores_in_use, max_temps));
-	/*g_print("Min score: %d\n", min_score);*/
-	g_list_free(scores_in_use);
+	guint i;
+	for(i = 0; i < doomed->len; i++)
+		i7_node_unlink(doomed->pdata[i]);
 
-	i7_skein_trim_recurse(self, node, min_score);
-	g_signal_emit_by_name(self, "needs-layout");
-	g_signal_emit_by_name(self, "modified");
+	/* Move the current and played knots out of the way before the trimmed
+	 knots are destroyed */
+	if(!is_attached(self, priv->current)) {
+		i7_skein_set_current_node(self, priv->root);
+		i7_skein_set_played_node(self, priv->root);
+	} else if(!is_attached(self, priv->played)) {
+		i7_skein_set_played_node(self, priv->root);
+	}
+
+	for(i = 0; i < doomed->len; i++)
+		g_node_traverse(I7_NODE(doomed->pdata[i])->gnode, G_POST_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)remove_node_from_canvas, self);
+	g_ptr_array_free(doomed, TRUE);
+
+	queue_changes(self, BATCH_THREAD | BATCH_LAYOUT | BATCH_MODIFIED);
+	i7_skein_end_batch(self);
 }
 
 static void
@@ -1546,7 +2850,7 @@ i7_skein_bless(I7Skein *self, I7Node *node, gboolean all)
 	for(iter = node->gnode; iter; iter = all? iter->parent : NULL)
 		i7_node_bless(I7_NODE(iter->data));
 
-	g_signal_emit_by_name(self, "modified");
+	queue_changes(self, BATCH_MODIFIED);
 }
 
 gboolean
@@ -1655,6 +2959,7 @@ i7_skein_set_font(I7Skein *self, PangoFontDescription *font)
 {
 	I7_SKEIN_USE_PRIVATE;
 	g_object_set(self, "font-desc", font, NULL);
+	i7_text_extents_clear();
 	g_node_traverse(priv->root->gnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, (GNodeTraverseFunc)invalidate, NULL);
 	g_signal_emit_by_name(self, "needs-layout");
 }
@@ -34,6 +34,13 @@ typedef enum {
 	I7_REASON_USER_ACTION
 } I7SkeinShowNodeReason;
 
+/* Kinds of knot that the Find Next/Previous Difference commands look for */
+typedef enum {
+	I7_SKEIN_DIFFERENCE_EXPECTED, /* transcript differs from the blessed text */
+	I7_SKEIN_DIFFERENCE_CHANGED, /* transcript differs from the previous run */
+	I7_SKEIN_N_DIFFERENCE_TYPES
+} I7SkeinDifferenceType;
+
 enum {
 	I7_SKEIN_COLUMN_COMMAND,
 	I7_SKEIN_COLUMN_TRANSCRIPT_TEXT,
@@ -75,6 +82,7 @@ struct _I7SkeinClass
 	void(* labels_changed) (I7Skein *self);
 	void(* show_node) (I7Skein *self, guint why, I7Node *node);
 	void(* modified) (I7Skein *self);
+	void(* differences_changed) (I7Skein *self);
 };
 
 struct _I7Skein
@@ -85,10 +93,13 @@ struct _I7Skein
 typedef enum _I7SkeinError {
 	I7_SKEIN_ERROR_XML,
 	I7_SKEIN_ERROR_BAD_FORMAT,
+	I7_SKEIN_ERROR_REPLAY,
 } I7SkeinError;
 
 #define I7_SKEIN_ERROR i7_skein_error_quark()
 
+typedef void (*I7SkeinSaveFunc)(I7Skein *skein, GError *error, gpointer data);
+
 GQuark i7_skein_error_quark(void);
 GType i7_skein_get_type(void) G_GNUC_CONST;
 I7Skein *i7_skein_new(void);
@@ -98,10 +109,16 @@ I7Node *i7_skein_get_root_node(I7Skein *self);
 I7Node *i7_skein_get_current_node(I7Skein *self);
 void i7_skein_set_current_node(I7Skein *self, I7Node *node);
 gboolean i7_skein_is_node_in_current_thread(I7Skein *self, I7Node *node);
+void i7_skein_begin_batch(I7Skein *self);
+void i7_skein_end_batch(I7Skein *self);
 I7Node *i7_skein_get_played_node(I7Skein *self);
 gboolean i7_skein_load(I7Skein *self, GFile *file, GError **error);
 gboolean i7_skein_save(I7Skein *self, GFile *file, GError **error);
+void i7_skein_save_in_background(I7Skein *self, GFile *file, I7SkeinSaveFunc callback, gpointer data);
+void i7_skein_wait_for_save(I7Skein *self);
+void i7_skein_set_cache_file(I7Skein *self, GFile *cache_file);
 gboolean i7_skein_import(I7Skein *self, GFile *file, GError **error);
+gboolean i7_skein_import_files(I7Skein *self, GSList *files, GError **error);
 void i7_skein_reset(I7Skein *self, gboolean current);
 void i7_skein_draw(I7Skein *self, GooCanvas *canvas);
 void i7_skein_schedule_draw(I7Skein *self, GooCanvas *canvas);
@@ -127,6 +144,9 @@ I7Node *i7_skein_get_thread_bottom(I7Skein *self, I7Node *node);
 GSList *i7_skein_get_blessed_thread_ends(I7Skein *self);
 gboolean i7_skein_get_modified(I7Skein *self);
 void i7_skein_set_font(I7Skein *self, PangoFontDescription *font);
+guint i7_skein_get_n_differences(I7Skein *self, I7SkeinDifferenceType type);
+I7Node *i7_skein_get_next_difference(I7Skein *self, I7Node *node, I7SkeinDifferenceType type);
+I7Node *i7_skein_get_previous_difference(I7Skein *self, I7Node *node, I7SkeinDifferenceType type);
 
 /* DEBUG */
 void i7_skein_dump(I7Skein *self);
@@ -25,74 +25,232 @@
 #include "error.h"
 #include "spawn.h"
 
-#define BUFSIZE 1024
-
+/* How much to read from the pipe at once */
+#define READ_SIZE 4096
+/* Longest line to wait for; longer ones are passed on in pieces */
+#define MAX_LINE_LENGTH 4096
+/* Write new output into the text buffer at most this often (ms) */
+#define FLUSH_INTERVAL 33
+/* Most lines to hold between writes; older ones are dropped */
+#define MAX_PENDING_LINES 1000
+/* After this much output, only the last MAX_PENDING_LINES lines are shown */
+#define MAX_OUTPUT_BYTES (1024 * 1024)
+
+/* The output of one command. The command's output is split into lines, which
+ are collected in a ring buffer and written into the text buffer at most once
+ per frame, so that a compiler that writes a lot of output doesn't keep the
+ main loop busy redrawing the text view. */
 typedef struct {
 	GtkTextBuffer *output;
 	IOHookFunc *callback;
-	gpointer *data;
-} IOHookData;
+	gpointer data;
+	gboolean chunks; /* send the callback what was read, not whole lines */
+	unsigned open_channels;
+	/* Ring buffer of lines, including newlines, waiting to be written */
+	char *ring[MAX_PENDING_LINES];
+	unsigned ring_start;
+	unsigned ring_length;
+	unsigned dropped; /* lines that fell out of the ring before being written */
+	gsize written; /* bytes written to the text buffer so far */
+	guint flush_source;
+} OutputPipe;
+
+/* One of the command's output streams */
+typedef struct {
+	OutputPipe *pipe;
+	GString *partial; /* line that hasn't been finished yet */
+	gboolean hook; /* whether to send lines to the pipe's callback */
+} ChannelReader;
+
+static OutputPipe *
+output_pipe_new(GtkTextBuffer *output, IOHookFunc *callback, gpointer data,
+	gboolean chunks)
+{
+	OutputPipe *pipe = g_slice_new0(OutputPipe);
+	pipe->output = g_object_ref(output);
+	pipe->callback = callback;
+	pipe->data = data;
+	pipe->chunks = chunks;
+	return pipe;
+}
+
+static void
+output_pipe_free(OutputPipe *pipe)
+{
+	if(pipe->flush_source)
+		g_source_remove(pipe->flush_source);
+	unsigned ix;
+	for(ix = 0; ix < pipe->ring_length; ix++)
+		g_free(pipe->ring[(pipe->ring_start + ix) % MAX_PENDING_LINES]);
+	g_object_unref(pipe->output);
+	g_slice_free(OutputPipe, pipe);
+}
+
+/* Adds @line to the end of the ring buffer, taking ownership of it */
+static void
+push_line(OutputPipe *pipe, char *line)
+{
+	if(pipe->ring_length == MAX_PENDING_LINES) {
+		g_free(pipe->ring[pipe->ring_start]);
+		pipe->ring_start = (pipe->ring_start + 1) % MAX_PENDING_LINES;
+		pipe->ring_length--;
+		pipe->dropped++;
+	}
+	pipe->ring[(pipe->ring_start + pipe->ring_length) % MAX_PENDING_LINES] = line;
+	pipe->ring_length++;
+}
+
+/* Writes the lines waiting in the ring buffer into the text buffer, in one go.
+ Once the command has written too much output, only do that when @final is
+ set, so that the end of the output (where the errors are) is kept. The GDK
+ lock must be held. */
+static void
+flush_output_pipe(OutputPipe *pipe, gboolean final)
+{
+	if(pipe->ring_length == 0 || (!final && pipe->written >= MAX_OUTPUT_BYTES))
+		return;
+
+	GString *text = g_string_new("");
+	if(pipe->dropped) {
+		g_string_append_printf(text, ngettext("[%u line of output omitted]\n",
+			"[%u lines of output omitted]\n", pipe->dropped), pipe->dropped);
+		pipe->dropped = 0;
+	}
+	for(; pipe->ring_length; pipe->ring_length--) {
+		g_string_append(text, pipe->ring[pipe->ring_start]);
+		g_free(pipe->ring[pipe->ring_start]);
+		pipe->ring_start = (pipe->ring_start + 1) % MAX_PENDING_LINES;
+	}
+	pipe->ring_start = 0;
 
-/* The callback for writing data from the IO channel to the buffer */
+	GtkTextIter iter;
+	gtk_text_buffer_get_end_iter(pipe->output, &iter);
+	gtk_text_buffer_insert(pipe->output, &iter, text->str, text->len);
+	pipe->written += text->len;
+	g_string_free(text, TRUE);
+}
+
+/* Timeout callback; the GDK lock is held */
 static gboolean
-write_channel_to_buffer(GIOChannel *ioc, GIOCondition cond,
-						GtkTextBuffer *buffer)
+flush_output_pipe_timeout(OutputPipe *pipe)
 {
-	/* data for us to read? */
-	if(cond & (G_IO_IN | G_IO_PRI)) {
-		GIOStatus result;
-		gchar scratch[BUFSIZE];
-		gsize chars_read = 0;
+	pipe->flush_source = 0;
+	flush_output_pipe(pipe, FALSE);
+	return FALSE; /* one-shot */
+}
 
-		memset(scratch, 0, BUFSIZE); /* clear the buffer */
-		result = g_io_channel_read_chars(ioc, scratch, BUFSIZE, &chars_read,
-		  NULL);
+static void
+schedule_flush(OutputPipe *pipe)
+{
+	if(pipe->flush_source == 0 && pipe->written < MAX_OUTPUT_BYTES)
+		pipe->flush_source = gdk_threads_add_timeout(FLUSH_INTERVAL,
+			(GSourceFunc)flush_output_pipe_timeout, pipe);
+}
 
-		if (chars_read <= 0 || result != G_IO_STATUS_NORMAL)
-			return FALSE;
+/* Passes the first @length bytes of the line in @reader to the callback, and
+ queues them to be written to the text buffer, followed by a newline if
+ @newline is set. This is called from an IO watch, so the callback must acquire
+ the GDK lock for any GUI calls. */
+static void
+finish_line(ChannelReader *reader, gsize length, gboolean newline)
+{
+	OutputPipe *pipe = reader->pipe;
+	char *line = g_strndup(reader->partial->str, length);
+	if(reader->hook && !pipe->chunks && pipe->callback)
+		(*pipe->callback)(pipe->data, line);
+	if(newline) {
+		char *terminated = g_strconcat(line, "\n", NULL);
+		g_free(line);
+		line = terminated;
+	}
+	push_line(pipe, line);
+	g_string_erase(reader->partial, 0, length);
+}
+
+/* Passes on as much of the unfinished line in @reader as possible without
+ splitting a UTF-8 character, for lines that are too long to wait for */
+static void
+finish_long_line(ChannelReader *reader)
+{
+	const char *str = reader->partial->str;
+	gsize length = reader->partial->len;
+	const char *last = g_utf8_find_prev_char(str, str + length);
+	/* Hold back a character that hasn't been completely read yet */
+	if(last != NULL && last != str
+		&& g_utf8_get_char_validated(last, str + length - last) == (gunichar)-2)
+		length = last - str;
+	finish_line(reader, length, FALSE);
+}
 
-		GtkTextIter iter;
-		gtk_text_buffer_get_end_iter(buffer, &iter);
-		gtk_text_buffer_insert(buffer, &iter, scratch, chars_read);
+/* Splits the @length bytes in @chunk into lines */
+static void
+read_lines(ChannelReader *reader, const char *chunk, gsize length)
+{
+	OutputPipe *pipe = reader->pipe;
+	if(reader->hook && pipe->chunks && pipe->callback) {
+		char *text = g_strndup(chunk, length);
+		(*pipe->callback)(pipe->data, text);
+		g_free(text);
 	}
 
-	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
-		return FALSE;
-	return TRUE;
+	const char *end = chunk + length;
+	const char *newline;
+	while((newline = memchr(chunk, '\n', end - chunk)) != NULL) {
+		g_string_append_len(reader->partial, chunk, newline - chunk);
+		finish_line(reader, reader->partial->len, TRUE);
+		chunk = newline + 1;
+	}
+	g_string_append_len(reader->partial, chunk, end - chunk);
+	if(reader->partial->len >= MAX_LINE_LENGTH)
+		finish_long_line(reader);
 }
 
-/* The callback for writing data from the IO channel to the buffer */
+/* The callback for reading data from the IO channel. Keep reading until the
+ end of the file, even if the other end has hung up, so that no output is
+ lost. */
 static gboolean
-write_channel_hook(GIOChannel *ioc, GIOCondition cond, IOHookData *data)
+read_channel(GIOChannel *ioc, GIOCondition cond, ChannelReader *reader)
 {
-	GtkTextBuffer *textbuffer = data->output;
-	IOHookFunc *callback = data->callback;
-	gpointer funcdata = data->data;
 	/* data for us to read? */
 	if(cond & (G_IO_IN | G_IO_PRI)) {
-		GIOStatus result;
-		gchar scratch[BUFSIZE];
+		gchar scratch[READ_SIZE];
 		gsize chars_read = 0;
+		GIOStatus result = g_io_channel_read_chars(ioc, scratch, READ_SIZE,
+			&chars_read, NULL);
 
-		memset(scratch, 0, BUFSIZE); /* clear the buffer */
-		result = g_io_channel_read_chars(ioc, scratch, BUFSIZE, &chars_read,
-		  NULL);
-
-		if (chars_read <= 0 || result != G_IO_STATUS_NORMAL)
+		if(chars_read == 0 || result != G_IO_STATUS_NORMAL)
 			return FALSE;
 
-		GtkTextIter iter;
-		gtk_text_buffer_get_end_iter(textbuffer, &iter);
-		gtk_text_buffer_insert(textbuffer, &iter, scratch, chars_read);
-
-		(*callback)(funcdata, scratch);
+		read_lines(reader, scratch, chars_read);
+		schedule_flush(reader->pipe);
+		return TRUE;
 	}
 
-	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+	if(cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
 		return FALSE;
 	return TRUE;
 }
 
+/* Called when the IO channel is closed. When the last of the command's output
+ streams is closed, write the rest of the output right away, so that it is
+ all in the text buffer by the time the command's child watch runs. */
+static void
+close_channel_reader(ChannelReader *reader)
+{
+	OutputPipe *pipe = reader->pipe;
+	if(reader->partial->len)
+		finish_line(reader, reader->partial->len, TRUE);
+	g_string_free(reader->partial, TRUE);
+	g_slice_free(ChannelReader, reader);
+
+	if(--pipe->open_channels > 0)
+		return;
+	gdk_threads_enter();
+	flush_output_pipe(pipe, TRUE);
+	gdk_threads_leave();
+	output_pipe_free(pipe);
+}
+
 /*
  * The following functions are adapted from Tim-Philipp Mueller's example
  * From http://scentric.net/tmp/spawn-async-with-pipes-gtk.c
@@ -100,17 +258,25 @@ write_channel_hook(GIOChannel *ioc, GIOCondition cond, IOHookData *data)
  * Copyright 2004 Tim-Philip Mueller and subject to GPLv2
  */
 
-/* Set up an IO channel from a file descriptor to a GtkTextBuffer */
+/* Set up an IO channel from a file descriptor to an output pipe; if @hook is
+ set, also send the output to the pipe's callback */
 static void
-set_up_io_channel(gint fd, GtkTextBuffer *output)
+set_up_io_channel(gint fd, OutputPipe *pipe, gboolean hook)
 {
 	GIOChannel *ioc = g_io_channel_unix_new(fd);
 	g_io_channel_set_encoding(ioc, NULL, NULL); /* enc. NULL = binary data? */
 	g_io_channel_set_buffered(ioc, FALSE);
 	g_io_channel_set_close_on_unref(ioc, TRUE);
+
+	ChannelReader *reader = g_slice_new0(ChannelReader);
+	reader->pipe = pipe;
+	reader->partial = g_string_sized_new(128);
+	reader->hook = hook;
+	pipe->open_channels++;
+
 	g_io_add_watch_full(ioc, G_PRIORITY_HIGH,
 	  G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-	  (GIOFunc)write_channel_to_buffer, (gpointer)output, NULL);
+	  (GIOFunc)read_channel, reader, (GDestroyNotify)close_channel_reader);
 	g_io_channel_unref(ioc);
 }
 
@@ -140,6 +306,14 @@ echo_invocation_to_output(gchar **argv, GtkTextBuffer *output)
  */
 GPid
 run_command(GFile *wd_file, char **argv, GtkTextBuffer *output)
+{
+	return run_command_hook(wd_file, argv, output, NULL, NULL, FALSE, FALSE);
+}
+
+static GPid
+spawn_command(GFile *wd_file, char **argv, GtkTextBuffer *output,
+	IOHookFunc *callback, gpointer data, gboolean chunks, gboolean get_out,
+	gboolean get_err)
 {
 	GError *err = NULL;
 	GPid child_pid;
@@ -171,46 +345,28 @@ run_command(GFile *wd_file, char **argv, GtkTextBuffer *output)
 
 	/* Now use GIOChannels to monitor stdout and stderr */
 	if(output != NULL) {
-		set_up_io_channel(stdout_fd, output);
-		set_up_io_channel(stderr_fd, output);
+		OutputPipe *pipe = output_pipe_new(output, callback, data, chunks);
+		set_up_io_channel(stdout_fd, pipe, get_out);
+		set_up_io_channel(stderr_fd, pipe, get_err);
 	}
 
 	return child_pid;
 }
 
-/* Set up an IO channel from a file descriptor to a GtkTextBuffer */
-static void
-set_up_io_channel_hook(gint fd, GtkTextBuffer *output, IOHookFunc *callback,
-					   gpointer data)
-{
-	GIOChannel *ioc = g_io_channel_unix_new(fd);
-	g_io_channel_set_encoding(ioc, NULL, NULL); /* enc. NULL = binary data? */
-	g_io_channel_set_buffered(ioc, FALSE);
-	g_io_channel_set_close_on_unref(ioc, TRUE);
-
-	IOHookData *hook_data = g_new(IOHookData, 1);
-	hook_data->output = output;
-	hook_data->callback = callback;
-	hook_data->data = data;
-
-	g_io_add_watch_full(ioc, G_PRIORITY_HIGH,
-	  G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-	  (GIOFunc)write_channel_hook, (gpointer)hook_data, g_free);
-	g_io_channel_unref(ioc);
-}
-
 /**
- * run_command:
+ * run_command_hook:
  * @wd_file: a #GFile pointing to the working directory for the command.
  * @argv: an array of strings with the command line arguments.
  * @output: a #GtkTextBuffer in which to place the command's output.
- * @callback: an #IOHookFunc to call with the command's output.
+ * @callback: an #IOHookFunc to call with each line of the command's output.
  * @data: arbitrary data to pass to @callback.
  * @get_out: whether to send the process's #stdout to @callback.
  * @get_err: whether to send the process's #stderr to @callback.
  *
  * Runs a command (in @argv[0]) asynchronously with working directory @wd_file,
  * and pipes the output to @output, and also to a hook function @callback.
+ * @callback is called with each line as soon as it is read, without the
+ * newline; @output is only updated a few times per second.
  *
  * Returns: a #GPid for the process.
  */
@@ -219,45 +375,31 @@ run_command_hook(GFile *wd_file, char **argv, GtkTextBuffer *output,
 				 IOHookFunc *callback, gpointer data, gboolean get_out,
 				 gboolean get_err)
 {
-	GError *err = NULL;
-	GPid child_pid;
-	gint stdout_fd, stderr_fd;
-	char *wd;
-
-	wd = g_file_get_path(wd_file);
-
-	echo_invocation_to_output(argv, output);
-
-	if (!g_spawn_async_with_pipes(
-	  wd,           /* working directory */
-	  argv,         /* command and arguments */
-	  NULL,         /* do not change environment */
-	  (GSpawnFlags) G_SPAWN_SEARCH_PATH   /* look for command in $PATH  */
-	  | G_SPAWN_DO_NOT_REAP_CHILD,  /* we'll check the exit status ourself */
-	  NULL,         /* child setup function */
-	  NULL,         /* child setup func data argument */
-	  &child_pid,   /* where to store the child's PID */
-	  NULL,         /* default stdin = /dev/null */
-	  output? &stdout_fd : NULL,   /* where to put stdout file descriptor */
-	  output? &stderr_fd : NULL,   /* where to put stderr file descriptor */
-	  &err)) {
-		error_dialog(NULL, err, _("Could not spawn process: "));
-		g_free(wd);
-		return (GPid)0;
-	}
-	g_free(wd);
-
-	/* Now use GIOChannels to monitor stdout and stderr */
-	if(output != NULL) {
-		if(get_out)
-			set_up_io_channel_hook(stdout_fd, output, callback, data);
-		else
-			set_up_io_channel(stdout_fd, output);
-		if(get_err)
-			set_up_io_channel_hook(stderr_fd, output, callback, data);
-		else
-			set_up_io_channel(stderr_fd, output);
-	}
+	return spawn_command(wd_file, argv, output, callback, data, FALSE, get_out,
+		get_err);
+}
 
-	return child_pid;
+/**
+ * run_command_chunk_hook:
+ * @wd_file: a #GFile pointing to the working directory for the command.
+ * @argv: an array of strings with the command line arguments.
+ * @output: a #GtkTextBuffer in which to place the command's output.
+ * @callback: an #IOHookFunc to call with each piece of the command's output.
+ * @data: arbitrary data to pass to @callback.
+ * @get_out: whether to send the process's #stdout to @callback.
+ * @get_err: whether to send the process's #stderr to @callback.
+ *
+ * Like run_command_hook(), but @callback is called with the command's output
+ * as soon as it is read, without waiting for the end of the line. This is for
+ * commands that show their progress without printing newlines. The pieces may
+ * end in the middle of a line or a UTF-8 character.
+ *
+ * Returns: a #GPid for the process.
+ */
+GPid
+run_command_chunk_hook(GFile *wd_file, char **argv, GtkTextBuffer *output,
+	IOHookFunc *callback, gpointer data, gboolean get_out, gboolean get_err)
+{
+	return spawn_command(wd_file, argv, output, callback, data, TRUE, get_out,
+		get_err);
 }
@@ -28,5 +28,8 @@ GPid run_command(GFile *wd_file, char **argv, GtkTextBuffer *output);
 GPid run_command_hook(GFile *wd_file, char **argv, GtkTextBuffer *output,
 					  IOHookFunc *callback, gpointer data, gboolean get_out,
 					  gboolean get_err);
+GPid run_command_chunk_hook(GFile *wd_file, char **argv, GtkTextBuffer *output,
+							IOHookFunc *callback, gpointer data,
+							gboolean get_out, gboolean get_err);
 
 #endif /* _SPAWN_H */
@@ -0,0 +1,406 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "app.h"
+#include "build-cache.h"
+#include "configfile.h"
+#include "file.h"
+#include "story.h"
+#include "story-private.h"
+
+/* Methods of I7Story having to do with compiling in the background: when the
+ source has been changed and the author stops typing for a while, the NI and I6
+ compilers are run on a copy of the project in a temporary folder, at low
+ priority, with their output thrown away. If the source is still the same when
+ the author presses Go, the results are copied into the project, and the build
+ cache (see build-cache.c) lets the compile skip straight to running the game.
+*/
+
+#define BACKGROUND_PROJECT_NAME "Background"
+#define BACKGROUND_NICENESS 10
+
+typedef struct {
+	I7Story *story; /* NULL once the job has been cancelled */
+	GPid pid;
+	GFile *project_file;
+	GFile *builddir_file;
+	char *key;
+} BackgroundJob;
+
+static void
+free_background_job(BackgroundJob *job)
+{
+	g_object_unref(job->project_file);
+	g_object_unref(job->builddir_file);
+	g_free(job->key);
+	g_slice_free(BackgroundJob, job);
+}
+
+/* Sums up everything that a build of @text would depend on. Other inputs are
+ read from the project folder, so this only matches after saving if nothing
+ else changed either. */
+static char *
+get_background_key(I7Story *story, const char *text)
+{
+	I7App *theapp = i7_app_get();
+	GFile *project_file = i7_document_get_file(I7_DOCUMENT(story));
+	GChecksum *key = i7_build_cache_key_new("background");
+	i7_build_cache_key_add_string(key, text);
+
+	/* The compiler settings and the compilers themselves */
+	char **commandline = i7_story_get_ni_command_line(story, project_file, TRUE);
+	i7_build_cache_key_add_strv(key, commandline + 1);
+	GFile *file = g_file_new_for_path(commandline[0]);
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+	g_strfreev(commandline);
+	GFile *builddir_file = g_file_get_child(project_file, "Build");
+	commandline = i7_story_get_i6_command_line(story, builddir_file, TRUE);
+	i7_build_cache_key_add_strv(key, commandline + 1);
+	file = g_file_new_for_path(commandline[0]);
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+	g_strfreev(commandline);
+	g_object_unref(builddir_file);
+
+	file = g_file_get_child(project_file, "Settings.plist");
+	i7_build_cache_key_add_contents(key, file);
+	g_object_unref(file);
+	file = g_file_get_child(project_file, "uuid.txt");
+	i7_build_cache_key_add_contents(key, file);
+	g_object_unref(file);
+	file = i7_app_get_extension_file(theapp, NULL, NULL);
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+	GFile *internal_dir = i7_app_get_internal_dir(theapp);
+	file = g_file_get_child(internal_dir, "Extensions");
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+	g_object_unref(internal_dir);
+	file = i7_story_get_materials_file(story);
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+
+	g_object_unref(project_file);
+	char *retval = g_strdup(g_checksum_get_string(key));
+	g_checksum_free(key);
+	return retval;
+}
+
+static char *
+get_source_text(I7Story *story)
+{
+	GtkTextBuffer *buffer = GTK_TEXT_BUFFER(i7_document_get_buffer(I7_DOCUMENT(story)));
+	GtkTextIter start, end;
+	gtk_text_buffer_get_bounds(buffer, &start, &end);
+	return gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+}
+
+/* Copies @name from the project to the background project, if it exists */
+static gboolean
+copy_project_file(GFile *project_file, GFile *background_project_file, const char *name)
+{
+	GFile *source = g_file_get_child(project_file, name);
+	GFile *dest = g_file_get_child(background_project_file, name);
+	GError *error = NULL;
+	gboolean retval = g_file_copy(source, dest, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error);
+	if(!retval && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+		g_file_delete(dest, NULL, NULL);
+		retval = TRUE;
+	}
+	g_clear_error(&error);
+	g_object_unref(source);
+	g_object_unref(dest);
+	return retval;
+}
+
+/* Writes @text and copies the settings into the background project, creating
+ it if necessary. Returns the background project folder, or NULL on error. */
+static GFile *
+prepare_background_project(I7Story *story, const char *text)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	if(priv->background_dir == NULL) {
+		char *path = g_dir_make_tmp("gnome-inform7-XXXXXX", NULL);
+		if(path == NULL)
+			return NULL;
+		priv->background_dir = g_file_new_for_path(path);
+		g_free(path);
+	}
+
+	GFile *project_file = i7_document_get_file(I7_DOCUMENT(story));
+	GFile *background_project_file = g_file_get_child(priv->background_dir, BACKGROUND_PROJECT_NAME ".inform");
+	GFile *source_dir = g_file_get_child(background_project_file, "Source");
+	GFile *source_file = g_file_get_child(source_dir, "story.ni");
+	GFile *builddir_file = g_file_get_child(background_project_file, "Build");
+	GFile *index_dir = g_file_get_child(background_project_file, "Index");
+	gboolean ok = make_directory_unless_exists(source_dir, NULL, NULL)
+		&& make_directory_unless_exists(builddir_file, NULL, NULL)
+		&& make_directory_unless_exists(index_dir, NULL, NULL)
+		&& g_file_replace_contents(source_file, text, strlen(text), NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL)
+		&& copy_project_file(project_file, background_project_file, "Settings.plist")
+		&& copy_project_file(project_file, background_project_file, "uuid.txt");
+	g_object_unref(source_dir);
+	g_object_unref(source_file);
+	g_object_unref(builddir_file);
+	g_object_unref(index_dir);
+
+	/* NI looks for the Materials folder next to the project */
+	GFile *materials_file = i7_story_get_materials_file(story);
+	GFile *background_materials_file = g_file_get_child(priv->background_dir, BACKGROUND_PROJECT_NAME ".materials");
+	if(ok && g_file_query_exists(materials_file, NULL) && !file_exists_and_is_symlink(background_materials_file)) {
+		char *materials_path = g_file_get_path(materials_file);
+		ok = g_file_make_symbolic_link(background_materials_file, materials_path, NULL, NULL);
+		g_free(materials_path);
+	}
+	g_object_unref(materials_file);
+	g_object_unref(background_materials_file);
+	g_object_unref(project_file);
+
+	if(!ok) {
+		g_object_unref(background_project_file);
+		return NULL;
+	}
+	return background_project_file;
+}
+
+/* Runs in the child process between fork() and exec(), to keep the background
+ build from slowing down the rest of the system */
+static void
+lower_priority(gpointer unused)
+{
+	setpriority(PRIO_PROCESS, 0, BACKGROUND_NICENESS);
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	/* IOPRIO_WHO_PROCESS, this process, IOPRIO_CLASS_IDLE */
+	syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+}
+
+/* Starts @commandline for @job, and calls @callback when it exits */
+static gboolean
+spawn_background_job(BackgroundJob *job, char **commandline, GChildWatchFunc callback)
+{
+	char *wd = g_file_get_path(job->builddir_file);
+	gboolean retval = g_spawn_async(wd, commandline, NULL,
+		G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+		lower_priority, NULL, &job->pid, NULL);
+	g_free(wd);
+	if(retval)
+		g_child_watch_add(job->pid, callback, job);
+	return retval;
+}
+
+/* Called from a child process watch; does not touch the GUI */
+static void
+finish_background_i6(GPid pid, gint status, BackgroundJob *job)
+{
+	g_spawn_close_pid(pid);
+	if(job->story) {
+		I7_STORY_USE_PRIVATE(job->story, priv);
+		priv->background_job = NULL;
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			priv->background_key = g_strdup(job->key);
+	}
+	free_background_job(job);
+}
+
+/* Called from a child process watch; does not touch the GUI */
+static void
+finish_background_ni(GPid pid, gint status, BackgroundJob *job)
+{
+	g_spawn_close_pid(pid);
+	if(job->story == NULL) {
+		free_background_job(job);
+		return;
+	}
+
+	I7_STORY_USE_PRIVATE(job->story, priv);
+	gboolean ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	if(ok) {
+		char **commandline = i7_story_get_i6_command_line(job->story, job->builddir_file, TRUE);
+		ok = spawn_background_job(job, commandline, (GChildWatchFunc)finish_background_i6);
+		g_strfreev(commandline);
+	}
+	if(!ok) {
+		/* If NI found problems, they'll be shown when the author presses Go */
+		priv->background_job = NULL;
+		free_background_job(job);
+	}
+}
+
+/* Timeout callback; the GDK lock is held */
+static gboolean
+start_background_compile(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	priv->background_timeout = 0;
+
+	/* Only compile unsaved changes, and not while the story is being compiled
+	 for real */
+	GtkTextBuffer *buffer = GTK_TEXT_BUFFER(i7_document_get_buffer(I7_DOCUMENT(story)));
+	if(!gtk_text_buffer_get_modified(buffer) || !gtk_action_group_get_sensitive(priv->compile_action_group))
+		return FALSE; /* one-shot */
+
+	char *text = get_source_text(story);
+	char *key = get_background_key(story, text);
+	if(priv->background_key && strcmp(key, priv->background_key) == 0) {
+		/* Already built */
+		g_free(key);
+		g_free(text);
+		return FALSE; /* one-shot */
+	}
+	/* The previous results are about to be overwritten */
+	g_free(priv->background_key);
+	priv->background_key = NULL;
+
+	GFile *project_file = prepare_background_project(story, text);
+	g_free(text);
+	if(project_file == NULL) {
+		g_free(key);
+		return FALSE; /* one-shot */
+	}
+
+	BackgroundJob *job = g_slice_new0(BackgroundJob);
+	job->story = story;
+	job->project_file = project_file;
+	job->builddir_file = g_file_get_child(project_file, "Build");
+	job->key = key;
+
+	char **commandline = i7_story_get_ni_command_line(story, project_file, TRUE);
+	if(spawn_background_job(job, commandline, (GChildWatchFunc)finish_background_ni))
+		priv->background_job = job;
+	else
+		free_background_job(job);
+	g_strfreev(commandline);
+
+	return FALSE; /* one-shot */
+}
+
+/*
+ * i7_story_cancel_background_compile:
+ * @story: the story
+ *
+ * Stops waiting to compile in the background, and stops the background build
+ * if it is running. The results of a background build that already finished
+ * are kept.
+ */
+void
+i7_story_cancel_background_compile(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	if(priv->background_timeout) {
+		g_source_remove(priv->background_timeout);
+		priv->background_timeout = 0;
+	}
+	if(priv->background_job) {
+		BackgroundJob *job = priv->background_job;
+		/* The child watch will free the job when the process exits */
+		job->story = NULL;
+		kill(job->pid, SIGTERM);
+		priv->background_job = NULL;
+	}
+}
+
+/*
+ * i7_story_schedule_background_compile:
+ * @story: the story
+ *
+ * Call when the source changes. If the author has turned on background
+ * compiling, starts a background build once the source stops changing for the
+ * number of seconds in the preferences, cancelling any build that is running.
+ */
+void
+i7_story_schedule_background_compile(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	GSettings *prefs = i7_app_get_prefs(i7_app_get());
+
+	i7_story_cancel_background_compile(story);
+	if(!g_settings_get_boolean(prefs, PREFS_BACKGROUND_COMPILE))
+		return;
+	priv->background_timeout = gdk_threads_add_timeout_seconds(
+		g_settings_get_uint(prefs, PREFS_BACKGROUND_COMPILE_DELAY),
+		(GSourceFunc)start_background_compile, story);
+}
+
+/*
+ * i7_story_get_background_build:
+ * @story: the story
+ *
+ * Checks whether a background build finished with exactly the current source
+ * and settings. Call after saving the story.
+ *
+ * Returns: (transfer full): the folder of the project that was built in the
+ * background, or %NULL if there are no usable results.
+ */
+GFile *
+i7_story_get_background_build(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	i7_story_cancel_background_compile(story);
+	if(priv->background_key == NULL)
+		return NULL;
+
+	char *text = get_source_text(story);
+	char *key = get_background_key(story, text);
+	gboolean matches = strcmp(key, priv->background_key) == 0;
+	g_free(key);
+	g_free(text);
+
+	if(!matches)
+		return NULL;
+	return g_file_get_child(priv->background_dir, BACKGROUND_PROJECT_NAME ".inform");
+}
+
+/*
+ * i7_story_remove_background_build:
+ * @story: the story
+ *
+ * Cancels compiling in the background and deletes the temporary folder.
+ */
+void
+i7_story_remove_background_build(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	i7_story_cancel_background_compile(story);
+	g_free(priv->background_key);
+	priv->background_key = NULL;
+	if(priv->background_dir) {
+		delete_directory_tree(priv->background_dir);
+		g_object_unref(priv->background_dir);
+		priv->background_dir = NULL;
+	}
+}
@@ -37,14 +37,15 @@
 #  endif
 #endif
 
-#define INFORM6_COMPILER_NAME "inform6"
-
+#include "build-cache.h"
 #include "configfile.h"
 #include "error.h"
+#include "file.h"
 #include "html.h"
 #include "spawn.h"
 #include "story.h"
 #include "story-private.h"
+#include "timeline.h"
 
 typedef struct _CompilerData {
 	I7Story *story;
@@ -55,20 +56,343 @@ typedef struct _CompilerData {
 	GFile *output_file;
 	GFile *builddir_file;
 	GFile *results_file;
+	GChecksum *cache_key; /* Inputs of the stage that is running */
+	char *cache_data; /* Extra data stored with that stage's outputs */
 } CompilerData;
 
+/* Stages of the compiler tool chain, for the build cache */
+typedef enum {
+	STAGE_NI,
+	STAGE_I6,
+	STAGE_CBLORB
+} CompilerStage;
+
+static const char * const stage_names[] = { "ni", "inform6", "cBlorb" };
+
 /* Declare these functions static so they can stay in this order */
 static void prepare_ni_compiler(CompilerData *data);
 static void start_ni_compiler(CompilerData *data);
+static gboolean finish_ni_compiler_cached(CompilerData *data);
 static void finish_ni_compiler(GPid pid, gint status, CompilerData *data);
 static void prepare_i6_compiler(CompilerData *data);
 static void start_i6_compiler(CompilerData *data);
+static gboolean finish_i6_compiler_cached(CompilerData *data);
 static void finish_i6_compiler(GPid pid, gint status, CompilerData *data);
 static void prepare_cblorb_compiler(CompilerData *data);
 static void start_cblorb_compiler(CompilerData *data);
+static gboolean finish_cblorb_compiler_cached(CompilerData *data);
 static void finish_cblorb_compiler(GPid pid, gint status, CompilerData *data);
 static void finish_compiling(gboolean success, CompilerData *data);
 
+/* Returns a NULL-terminated array of the files that @stage writes; free it
+ with free_files() */
+static GFile **
+get_stage_outputs(CompilerData *data, CompilerStage stage)
+{
+	GFile **outputs = g_new0(GFile *, 3);
+	switch(stage) {
+		case STAGE_NI:
+			outputs[0] = g_file_get_child(data->builddir_file, "auto.inf");
+			outputs[1] = g_file_get_child(data->builddir_file, "Problems.html");
+			break;
+		case STAGE_I6:
+		{
+			char *i6out = g_strconcat("output.", i7_story_get_extension(data->story), NULL);
+			outputs[0] = g_file_get_child(data->builddir_file, i6out);
+			g_free(i6out);
+		}
+			break;
+		case STAGE_CBLORB:
+			outputs[0] = g_object_ref(data->output_file);
+			outputs[1] = g_file_get_child(data->builddir_file, "StatusCblorb.html");
+			break;
+	}
+	return outputs;
+}
+
+static void
+free_files(GFile **files)
+{
+	GFile **iter;
+	for(iter = files; *iter; iter++)
+		g_object_unref(*iter);
+	g_free(files);
+}
+
+/* Adds the Materials folder to @key, except for the Release folder inside it,
+ which cBlorb writes to; otherwise releasing would change the key every time */
+static void
+add_materials_to_cache_key(GChecksum *key, I7Story *story)
+{
+	GFile *materials = i7_story_get_materials_file(story);
+	GFile *release = g_file_get_child(materials, "Release");
+	i7_build_cache_key_add_tree_except(key, materials, release);
+	g_object_unref(release);
+	g_object_unref(materials);
+}
+
+/* Sums up everything that @stage reads, if it is run with @commandline */
+static GChecksum *
+get_stage_cache_key(CompilerData *data, CompilerStage stage, char **commandline)
+{
+	GChecksum *key = i7_build_cache_key_new(stage_names[stage]);
+	i7_build_cache_key_add_strv(key, commandline);
+	GFile *file = g_file_new_for_path(commandline[0]); /* The compiler itself */
+	i7_build_cache_key_add_tree(key, file);
+	g_object_unref(file);
+
+	switch(stage) {
+		case STAGE_NI:
+		{
+			I7App *theapp = i7_app_get();
+			file = g_file_resolve_relative_path(data->input_file, "Source/story.ni");
+			i7_build_cache_key_add_contents(key, file);
+			g_object_unref(file);
+			file = g_file_get_child(data->input_file, "Settings.plist");
+			i7_build_cache_key_add_contents(key, file);
+			g_object_unref(file);
+			file = g_file_get_child(data->input_file, "uuid.txt");
+			i7_build_cache_key_add_contents(key, file);
+			g_object_unref(file);
+
+			/* Extensions and Materials are compared by their size and date */
+			file = i7_app_get_extension_file(theapp, NULL, NULL);
+			i7_build_cache_key_add_tree(key, file);
+			g_object_unref(file);
+			GFile *internal_dir = i7_app_get_internal_dir(theapp);
+			file = g_file_get_child(internal_dir, "Extensions");
+			i7_build_cache_key_add_tree(key, file);
+			g_object_unref(file);
+			g_object_unref(internal_dir);
+			add_materials_to_cache_key(key, data->story);
+		}
+			break;
+		case STAGE_I6:
+			file = g_file_get_child(data->builddir_file, "auto.inf");
+			i7_build_cache_key_add_contents(key, file);
+			g_object_unref(file);
+			break;
+		case STAGE_CBLORB:
+		{
+			file = g_file_get_child(data->input_file, "Release.blurb");
+			i7_build_cache_key_add_contents(key, file);
+			g_object_unref(file);
+			/* The story file that goes into the Blorb */
+			GFile **i6_outputs = get_stage_outputs(data, STAGE_I6);
+			i7_build_cache_key_add_contents(key, i6_outputs[0]);
+			free_files(i6_outputs);
+			add_materials_to_cache_key(key, data->story);
+		}
+			break;
+	}
+	return key;
+}
+
+/* Returns TRUE if @stage can be skipped because it already ran successfully
+ with the same inputs */
+static gboolean
+check_build_cache(CompilerData *data, CompilerStage stage, char **commandline)
+{
+	data->cache_key = get_stage_cache_key(data, stage, commandline);
+	GFile **outputs = get_stage_outputs(data, stage);
+	g_free(data->cache_data);
+	data->cache_data = NULL;
+	gboolean retval = i7_build_cache_lookup(data->builddir_file, stage_names[stage], data->cache_key, outputs, &data->cache_data);
+	free_files(outputs);
+	return retval;
+}
+
+/* Records that @stage finished successfully with the inputs that
+ check_build_cache() found */
+static void
+update_build_cache(CompilerData *data, CompilerStage stage, const char *extra)
+{
+	if(data->cache_key == NULL)
+		return;
+	GFile **outputs = get_stage_outputs(data, stage);
+	i7_build_cache_store(data->builddir_file, stage_names[stage], data->cache_key, outputs, extra);
+	free_files(outputs);
+	g_checksum_free(data->cache_key);
+	data->cache_key = NULL;
+}
+
+/* Tell the user that a stage was skipped. This function is called from an idle
+ handler, so the GDK lock is not held and must be acquired for any GUI calls. */
+static void
+display_cache_hit(CompilerData *data, const char *message)
+{
+	I7_STORY_USE_PRIVATE(data->story, priv);
+	GtkTextIter iter;
+	gdk_threads_enter();
+	gtk_text_buffer_get_end_iter(priv->progress, &iter);
+	gtk_text_buffer_insert(priv->progress, &iter, message, -1);
+	gdk_threads_leave();
+}
+
+/* Copies @name from @source_dir to @dest_dir if it exists there */
+static gboolean
+copy_build_file(GFile *source_dir, GFile *dest_dir, const char *name)
+{
+	GFile *source = g_file_get_child(source_dir, name);
+	GFile *dest = g_file_get_child(dest_dir, name);
+	GError *error = NULL;
+	gboolean retval = g_file_copy(source, dest, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error);
+	if(!retval && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		retval = TRUE;
+	g_clear_error(&error);
+	g_object_unref(source);
+	g_object_unref(dest);
+	return retval;
+}
+
+/* Moves the results of the background build in @background_project_file into
+ the project, and records them in the build cache so that the NI and I6 stages
+ are skipped. Called from the main thread. */
+static void
+use_background_build(CompilerData *data, GFile *background_project_file)
+{
+	GFile *background_builddir_file = g_file_get_child(background_project_file, "Build");
+	char *i6out = g_strconcat("output.", i7_story_get_extension(data->story), NULL);
+	const char * const build_files[] = { "auto.inf", "Problems.html", "Debug log.txt", "gameinfo.dbg", i6out, NULL };
+	const char * const project_files[] = { "manifest.plist", "Release.blurb", "Metadata.iFiction", NULL };
+	gboolean ok = TRUE;
+	const char * const *iter;
+
+	for(iter = build_files; *iter && ok; iter++)
+		ok = copy_build_file(background_builddir_file, data->builddir_file, *iter);
+	for(iter = project_files; *iter && ok; iter++)
+		ok = copy_build_file(background_project_file, data->input_file, *iter);
+	if(ok) {
+		GFile *background_index_file = g_file_get_child(background_project_file, "Index");
+		GFile *index_file = g_file_get_child(data->input_file, "Index");
+		ok = copy_directory_tree(background_index_file, index_file, NULL);
+		g_object_unref(background_index_file);
+		g_object_unref(index_file);
+	}
+	g_free(i6out);
+	g_object_unref(background_builddir_file);
+
+	/* If anything went wrong, just compile normally */
+	if(!ok)
+		return;
+
+	char **commandline = i7_story_get_ni_command_line(data->story, data->input_file, data->use_debug_flags);
+	data->cache_key = get_stage_cache_key(data, STAGE_NI, commandline);
+	update_build_cache(data, STAGE_NI, NULL);
+	g_strfreev(commandline);
+	commandline = i7_story_get_i6_command_line(data->story, data->builddir_file, data->use_debug_flags);
+	data->cache_key = get_stage_cache_key(data, STAGE_I6, commandline);
+	update_build_cache(data, STAGE_I6, NULL);
+	g_strfreev(commandline);
+}
+
+/* Idle callback; the GDK lock is held */
+static gboolean
+update_timeline_idle(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	priv->timeline_update_source = 0;
+	i7_story_update_timeline_view(story);
+
+	/* Write the timings once compiling is done, and again when any stages that
+	 run afterwards, like reloading the index, finish */
+	if(priv->timeline_finished) {
+		GFile *project_file = i7_document_get_file(I7_DOCUMENT(story));
+		GFile *timings_file = g_file_resolve_relative_path(project_file, "Build/timings.json");
+		/* Ignore errors, the timings are just for information */
+		i7_timeline_save(priv->timeline, timings_file, NULL);
+		g_object_unref(timings_file);
+		g_object_unref(project_file);
+	}
+	return FALSE; /* one-shot */
+}
+
+/* Update the timeline view and file from the main loop, since the stages end in
+ callbacks that may or may not hold the GDK lock */
+static void
+update_timeline(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline_update_source == 0)
+		priv->timeline_update_source = gdk_threads_add_idle((GSourceFunc)update_timeline_idle, story);
+}
+
+/*
+ * i7_story_begin_timeline_stage:
+ * @story: the story
+ * @stage: a static string naming the stage
+ *
+ * Records in the timeline of the last compile that @stage starts now. Does
+ * nothing if the story hasn't been compiled yet.
+ */
+void
+i7_story_begin_timeline_stage(I7Story *story, const char *stage)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline == NULL)
+		return;
+	i7_timeline_begin_stage(priv->timeline, stage);
+	update_timeline(story);
+}
+
+static void
+end_timeline_stage(I7Story *story, const char *stage, gboolean cached)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline && i7_timeline_end_stage(priv->timeline, stage, cached))
+		update_timeline(story);
+}
+
+/*
+ * i7_story_end_timeline_stage:
+ * @story: the story
+ * @stage: the name of a stage passed to i7_story_begin_timeline_stage()
+ *
+ * Records in the timeline of the last compile that @stage ends now. Does
+ * nothing if @stage isn't running.
+ */
+void
+i7_story_end_timeline_stage(I7Story *story, const char *stage)
+{
+	end_timeline_stage(story, stage, FALSE);
+}
+
+/*
+ * i7_story_cancel_timeline_stage:
+ * @story: the story
+ * @stage: the name of a stage passed to i7_story_begin_timeline_stage()
+ *
+ * Removes @stage from the timeline of the last compile, if it is still running,
+ * for work that was stopped before it finished.
+ */
+void
+i7_story_cancel_timeline_stage(I7Story *story, const char *stage)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline && i7_timeline_cancel_stage(priv->timeline, stage))
+		update_timeline(story);
+}
+
+/*
+ * i7_story_clear_timeline:
+ * @story: the story
+ *
+ * Frees the timeline of the last compile. Called when the story is destroyed.
+ */
+void
+i7_story_clear_timeline(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline_update_source) {
+		g_source_remove(priv->timeline_update_source);
+		priv->timeline_update_source = 0;
+	}
+	if(priv->timeline) {
+		i7_timeline_free(priv->timeline);
+		priv->timeline = NULL;
+	}
+}
+
 /* Set the function that will be called when compiling has finished. */
 void
 i7_story_set_compile_finished_action(I7Story *story, CompileActionFunc callback, gpointer data)
@@ -84,8 +408,16 @@ i7_story_compile(I7Story *story, gboolean release, gboolean refresh)
 {
 	I7_STORY_USE_PRIVATE(story, priv);
 
+	/* Start timing the compile */
+	i7_story_clear_timeline(story);
+	priv->timeline = i7_timeline_new();
+	priv->timeline_finished = FALSE;
+
+	i7_story_begin_timeline_stage(story, "save");
 	i7_document_save(I7_DOCUMENT(story));
+	i7_story_end_timeline_stage(story, "save");
 	i7_story_stop_running_game(story);
+	i7_story_cancel_background_compile(story);
 	if(priv->copy_blorb_dest_file) {
 		g_object_unref(priv->copy_blorb_dest_file);
 		priv->copy_blorb_dest_file = NULL;
@@ -117,6 +449,16 @@ i7_story_compile(I7Story *story, gboolean release, gboolean refresh)
 	data->output_file = g_file_get_child(data->builddir_file, filename);
 	g_free(filename);
 
+	/* Pick up the results of compiling in the background, if they are still
+	 current; the background build always uses the debug flags */
+	if(data->use_debug_flags) {
+		GFile *background_project_file = i7_story_get_background_build(story);
+		if(background_project_file) {
+			use_background_build(data, background_project_file);
+			g_object_unref(background_project_file);
+		}
+	}
+
 	prepare_ni_compiler(data);
 	start_ni_compiler(data);
 }
@@ -135,6 +477,7 @@ prepare_ni_compiler(CompilerData *data)
 	html_load_blank(WEBKIT_WEB_VIEW(data->story->panel[RIGHT]->results_tabs[I7_RESULTS_TAB_REPORT]));
 
 	/* Create the UUID file if needed */
+	i7_story_begin_timeline_stage(data->story, "uuid");
 	GFile *uuid_file = g_file_get_child(data->input_file, "uuid.txt");
 	if(!g_file_query_exists(uuid_file, NULL)) {
 #ifdef E2FS_UUID /* code for e2fsprogs uuid */
@@ -166,14 +509,15 @@ prepare_ni_compiler(CompilerData *data)
 #endif /* !OSSP_UUID */
 	}
 	g_object_unref(uuid_file);
+	i7_story_end_timeline_stage(data->story, "uuid");
 
 	/* Display status message */
 	i7_document_display_status_message(I7_DOCUMENT(data->story), _("Compiling Inform 7 to Inform 6"), COMPILE_OPERATIONS);
 }
 
 /* Display the NI compiler's status in the app status bar. This function is
- called from a child process watch, so the GDK lock is not held and must be
- acquired for any GUI calls. */
+ called with each line of the compiler's output from an IO watch, so the GDK
+ lock is not held and must be acquired for any GUI calls. */
 static void
 display_ni_status(I7Document *document, gchar *text)
 {
@@ -188,14 +532,11 @@ display_ni_status(I7Document *document, gchar *text)
 	}
 }
 
-/* Start the NI compiler and set up the callback for when it is finished. Called
- from the main thread.*/
-static void
-start_ni_compiler(CompilerData *data)
+/* Build the command line for running the NI compiler on the project in
+ @project_file. Also used for compiling in the background. */
+char **
+i7_story_get_ni_command_line(I7Story *story, GFile *project_file, gboolean use_debug_flags)
 {
-	I7_STORY_USE_PRIVATE(data->story, priv);
-
-	/* Build the command line */
 	GPtrArray *args = g_ptr_array_new_full(7, g_free); /* usual number of args */
 	I7App *theapp = i7_app_get();
 	GFile *ni_compiler = i7_app_get_binary_file(theapp, "ni");
@@ -203,19 +544,37 @@ start_ni_compiler(CompilerData *data)
 	g_ptr_array_add(args, g_file_get_path(ni_compiler));
 	g_ptr_array_add(args, g_strdup("-internal"));
 	g_ptr_array_add(args, g_file_get_path(internal_dir));
-	g_ptr_array_add(args, g_strconcat("-format=", i7_story_get_extension(data->story), NULL));
+	g_ptr_array_add(args, g_strconcat("-format=", i7_story_get_extension(story), NULL));
 	g_ptr_array_add(args, g_strdup("-project"));
-	g_ptr_array_add(args, g_file_get_path(data->input_file));
-	if(!data->use_debug_flags)
+	g_ptr_array_add(args, g_file_get_path(project_file));
+	if(!use_debug_flags)
 		g_ptr_array_add(args, g_strdup("-release")); /* Omit "not for relase" material */
-	if(i7_story_get_nobble_rng(data->story))
+	if(i7_story_get_nobble_rng(story))
 		g_ptr_array_add(args, g_strdup("-rng"));
 	g_ptr_array_add(args, NULL);
 
 	g_object_unref(ni_compiler);
 	g_object_unref(internal_dir);
 
-	char **commandline = (char **)g_ptr_array_free(args, FALSE);
+	return (char **)g_ptr_array_free(args, FALSE);
+}
+
+/* Start the NI compiler and set up the callback for when it is finished. Called
+ from the main thread.*/
+static void
+start_ni_compiler(CompilerData *data)
+{
+	I7_STORY_USE_PRIVATE(data->story, priv);
+
+	char **commandline = i7_story_get_ni_command_line(data->story, data->input_file, data->use_debug_flags);
+	i7_story_begin_timeline_stage(data->story, "ni");
+
+	/* Skip running the compiler if nothing has changed */
+	if(check_build_cache(data, STAGE_NI, commandline)) {
+		g_idle_add((GSourceFunc)finish_ni_compiler_cached, data);
+		g_strfreev(commandline);
+		return;
+	}
 
 	/* Run the command and pipe its output to the text buffer. Also pipe stderr
 	through a function that analyzes the progress messages and puts them in the
@@ -229,6 +588,19 @@ start_ni_compiler(CompilerData *data)
 	g_strfreev(commandline);
 }
 
+/* Continue on from the NI compiler's previous results, without running it.
+ This function is called from an idle handler, so the GDK lock is not held. */
+static gboolean
+finish_ni_compiler_cached(CompilerData *data)
+{
+	display_cache_hit(data, _("The source has not changed since the last time "
+		"it was compiled. Using the previous results.\n"));
+	end_timeline_stage(data->story, "ni", TRUE);
+	/* Carry on as if the compiler had exited successfully */
+	finish_ni_compiler(0, 0, data);
+	return FALSE; /* one-shot */
+}
+
 /* Display any errors from the NI compiler and continue on. This function is
  called from a child process watch, so the GDK lock is not held and must be
  acquired for any GUI calls. */
@@ -239,6 +611,8 @@ finish_ni_compiler(GPid pid, gint status, CompilerData *data)
 	I7App *theapp = i7_app_get();
 	GSettings *prefs = i7_app_get_prefs(theapp);
 
+	i7_story_end_timeline_stage(data->story, "ni");
+
 	/* Clear the progress indicator */
 	gdk_threads_enter();
 	i7_document_remove_status_message(I7_DOCUMENT(data->story), COMPILE_OPERATIONS);
@@ -266,33 +640,11 @@ finish_ni_compiler(GPid pid, gint status, CompilerData *data)
 	data->results_file = problems_file; /* assumes reference */
 
 	if(g_settings_get_boolean(prefs, PREFS_SHOW_DEBUG_LOG)) {
-		/* Update */
+		/* Refresh the debug log and the I6 code; this only starts loading them
+		 if their tabs are showing */
 		gdk_threads_enter();
-		while(gtk_events_pending())
-			gtk_main_iteration();
+		i7_story_reload_build_views(data->story);
 		gdk_threads_leave();
-
-		/* Refresh the debug log */
-		gchar *text;
-		GFile *debug_file = g_file_get_child(data->builddir_file, "Debug log.txt");
-		/* Ignore errors, just don't show it if it's not there */
-		if(g_file_load_contents(debug_file, NULL, &text, NULL, NULL, NULL)) {
-			gdk_threads_enter();
-			gtk_text_buffer_set_text(priv->debug_log, text, -1);
-			gdk_threads_leave();
-			g_free(text);
-		}
-		g_object_unref(debug_file);
-
-		/* Refresh the I6 code */
-		GFile *i6_file = g_file_get_child(data->builddir_file, "auto.inf");
-		if(g_file_load_contents(i6_file, NULL, &text, NULL, NULL, NULL)) {
-			gdk_threads_enter();
-			gtk_text_buffer_set_text(GTK_TEXT_BUFFER(priv->i6_source), text, -1);
-			gdk_threads_leave();
-			g_free(text);
-		}
-		g_object_unref(i6_file);
 	}
 
 	/* Stop here and show the Results/Report tab if there was an error */
@@ -300,8 +652,10 @@ finish_ni_compiler(GPid pid, gint status, CompilerData *data)
 		finish_compiling(FALSE, data);
 		return;
 	}
+	update_build_cache(data, STAGE_NI, NULL);
 
 	/* Reload the Index in the background */
+	i7_story_begin_timeline_stage(data->story, "index");
 	i7_story_reload_index_tabs(data->story, FALSE);
 
 	/* Read in the Blorb manifest */
@@ -344,9 +698,9 @@ prepare_i6_compiler(CompilerData *data)
 }
 
 /* Determine i6 compiler switches, given the compiler action and the virtual
-machine format. Return string must be freed. */
-static gchar *
-get_i6_compiler_switches(gboolean use_debug_flags, int format)
+machine format. Return string must be freed. Also used by i7-skein-check. */
+gchar *
+i7_story_get_i6_compiler_switches(gboolean use_debug_flags, int format)
 {
 	gchar *debug_switches, *version_switches, *retval;
 
@@ -371,10 +725,11 @@ get_i6_compiler_switches(gboolean use_debug_flags, int format)
 	return retval;
 }
 
-/* Pulse the progress bar every time the I6 compiler outputs a '#' (which
- happens whenever it has processed 100 source lines.) This function is
- called from a child process watch, so the GDK lock is not held and must be
- acquired for any GUI calls. */
+/* Pulse the progress bar every time the I6 compiler outputs a '#' (it prints
+ one whenever it has processed 100 source lines, without a newline.) This
+ function is called with each piece of the compiler's output as it is read,
+ from an IO watch, so the GDK lock is not held and must be acquired for any GUI
+ calls. */
 static void
 display_i6_status(I7Document *document, gchar *text)
 {
@@ -385,22 +740,19 @@ display_i6_status(I7Document *document, gchar *text)
 	}
 }
 
-/* Run the I6 compiler. This function is called from a child process watch, so
- the GDK lock is not held and must be acquired for any GUI calls. */
-static void
-start_i6_compiler(CompilerData *data)
+/* Build the command line for running the I6 compiler on the auto.inf file in
+ @builddir_file. Also used for compiling in the background. */
+char **
+i7_story_get_i6_command_line(I7Story *story, GFile *builddir_file, gboolean use_debug_flags)
 {
-	I7_STORY_USE_PRIVATE(data->story, priv);
-
 	GFile *i6_compiler = i7_app_get_binary_file(i7_app_get(), INFORM6_COMPILER_NAME);
-	char *i6out = g_strconcat("output.", i7_story_get_extension(data->story), NULL);
-	GFile *i6_output = g_file_get_child(data->builddir_file, i6out);
+	char *i6out = g_strconcat("output.", i7_story_get_extension(story), NULL);
+	GFile *i6_output = g_file_get_child(builddir_file, i6out);
 	g_free(i6out);
 
-	/* Build the command line */
 	gchar **commandline = g_new(gchar *, 6);
 	commandline[0] = g_file_get_path(i6_compiler);
-	commandline[1] = get_i6_compiler_switches(data->use_debug_flags, i7_story_get_story_format(data->story));
+	commandline[1] = i7_story_get_i6_compiler_switches(use_debug_flags, i7_story_get_story_format(story));
 	commandline[2] = g_strdup("$huge");
 	commandline[3] = g_strdup("auto.inf");
 	commandline[4] = g_file_get_path(i6_output);
@@ -409,7 +761,27 @@ start_i6_compiler(CompilerData *data)
 	g_object_unref(i6_compiler);
 	g_object_unref(i6_output);
 
-	GPid child_pid = run_command_hook(data->builddir_file, commandline,
+	return commandline;
+}
+
+/* Run the I6 compiler. This function is called from a child process watch, so
+ the GDK lock is not held and must be acquired for any GUI calls. */
+static void
+start_i6_compiler(CompilerData *data)
+{
+	I7_STORY_USE_PRIVATE(data->story, priv);
+
+	char **commandline = i7_story_get_i6_command_line(data->story, data->builddir_file, data->use_debug_flags);
+	i7_story_begin_timeline_stage(data->story, "inform6");
+
+	/* Skip running the compiler if the I6 code hasn't changed */
+	if(check_build_cache(data, STAGE_I6, commandline)) {
+		g_idle_add((GSourceFunc)finish_i6_compiler_cached, data);
+		g_strfreev(commandline);
+		return;
+	}
+
+	GPid child_pid = run_command_chunk_hook(data->builddir_file, commandline,
 		priv->progress, (IOHookFunc *)display_i6_status, data->story, TRUE, TRUE);
 	/* set up a watch for the exit status */
 	g_child_watch_add(child_pid, (GChildWatchFunc)finish_i6_compiler, data);
@@ -417,6 +789,19 @@ start_i6_compiler(CompilerData *data)
 	g_strfreev(commandline);
 }
 
+/* Continue on with the story file from the previous time Inform 6 was run.
+ This function is called from an idle handler, so the GDK lock is not held. */
+static gboolean
+finish_i6_compiler_cached(CompilerData *data)
+{
+	display_cache_hit(data, _("The Inform 6 code has not changed since the "
+		"last time it was compiled. Using the previous story file.\n"));
+	end_timeline_stage(data->story, "inform6", TRUE);
+	/* Carry on as if the compiler had exited successfully */
+	finish_i6_compiler(0, 0, data);
+	return FALSE; /* one-shot */
+}
+
 /* Display any errors from Inform 6 and decide what to do next. This function is
  called from a child process watch, so the GDK lock is not held and must be
  acquired for any GUI calls. */
@@ -425,6 +810,8 @@ finish_i6_compiler(GPid pid, gint status, CompilerData *data)
 {
 	I7_STORY_USE_PRIVATE(data->story, priv);
 
+	i7_story_end_timeline_stage(data->story, "inform6");
+
 	/* Clear the progress indicator */
 	gdk_threads_enter();
 	i7_document_remove_status_message(I7_DOCUMENT(data->story), COMPILE_OPERATIONS);
@@ -483,6 +870,7 @@ finish_i6_compiler(GPid pid, gint status, CompilerData *data)
 		finish_compiling(FALSE, data);
 		return;
 	}
+	update_build_cache(data, STAGE_I6, NULL);
 
 	/* Decide what to do next */
 	if(!data->create_blorb) {
@@ -515,9 +903,9 @@ parse_cblorb_output(I7Story *story, gchar *text)
 {
 	I7_STORY_USE_PRIVATE(story, priv);
 	gchar *ptr = strstr(text, "Copy blorb to: [[");
-	if(ptr) {
-		char *copy_blorb_path = g_strdup(ptr + 17);
-		*(strstr(copy_blorb_path, "]]")) = '\0';
+	gchar *endptr = ptr? strstr(ptr, "]]") : NULL;
+	if(endptr) {
+		char *copy_blorb_path = g_strndup(ptr + 17, endptr - ptr - 17);
 
 		if(priv->copy_blorb_dest_file)
 			g_object_unref(priv->copy_blorb_dest_file);
@@ -545,6 +933,15 @@ start_cblorb_compiler(CompilerData *data)
 
 	g_object_unref(cblorb);
 
+	i7_story_begin_timeline_stage(data->story, "cblorb");
+
+	/* Skip running cBlorb if none of the release materials have changed */
+	if(check_build_cache(data, STAGE_CBLORB, commandline)) {
+		g_idle_add((GSourceFunc)finish_cblorb_compiler_cached, data);
+		g_strfreev(commandline);
+		return;
+	}
+
 	GPid child_pid = run_command_hook(data->input_file, commandline,
 		priv->progress, (IOHookFunc *)parse_cblorb_output, data->story, TRUE, FALSE);
 	/* set up a watch for the exit status */
@@ -553,6 +950,29 @@ start_cblorb_compiler(CompilerData *data)
 	g_strfreev(commandline);
 }
 
+/* Continue on with the Blorb file from the previous time cBlorb was run. This
+ function is called from an idle handler, so the GDK lock is not held. */
+static gboolean
+finish_cblorb_compiler_cached(CompilerData *data)
+{
+	I7_STORY_USE_PRIVATE(data->story, priv);
+
+	display_cache_hit(data, _("The release materials have not changed since "
+		"the last time they were packaged. Using the previous Blorb file.\n"));
+
+	/* Restore the destination that cBlorb asked for the last time */
+	if(data->cache_data && *data->cache_data) {
+		if(priv->copy_blorb_dest_file)
+			g_object_unref(priv->copy_blorb_dest_file);
+		priv->copy_blorb_dest_file = g_file_new_for_path(data->cache_data);
+	}
+	end_timeline_stage(data->story, "cblorb", TRUE);
+
+	/* Carry on as if the compiler had exited successfully */
+	finish_cblorb_compiler(0, 0, data);
+	return FALSE; /* one-shot */
+}
+
 /* Display any errors from cBlorb. This function is called from a child process
  watch, so the GDK lock is not held and must be acquired for any GUI calls. */
 static void
@@ -560,6 +980,8 @@ finish_cblorb_compiler(GPid pid, gint status, CompilerData *data)
 {
 	I7_STORY_USE_PRIVATE(data->story, priv);
 
+	i7_story_end_timeline_stage(data->story, "cblorb");
+
 	/* Clear the progress indicator */
 	gdk_threads_enter();
 	i7_document_remove_status_message(I7_DOCUMENT(data->story), COMPILE_OPERATIONS);
@@ -577,6 +999,9 @@ finish_cblorb_compiler(GPid pid, gint status, CompilerData *data)
 		finish_compiling(FALSE, data);
 		return;
 	}
+	char *copy_blorb_path = priv->copy_blorb_dest_file? g_file_get_path(priv->copy_blorb_dest_file) : NULL;
+	update_build_cache(data, STAGE_CBLORB, copy_blorb_path);
+	g_free(copy_blorb_path);
 
 	/* Decide what to do next */
 	I7Story *story = data->story;
@@ -628,6 +1053,10 @@ finish_compiling(gboolean success, CompilerData *data)
 	gtk_action_group_set_sensitive(priv->compile_action_group, TRUE);
 	gdk_threads_leave();
 
+	/* Write the timings of the stages so far */
+	priv->timeline_finished = TRUE;
+	update_timeline(data->story);
+
 	/* Store the compiler output filename (the I7Story now owns the reference) */
 	priv->compiler_output_file = data->output_file;
 
@@ -635,6 +1064,9 @@ finish_compiling(gboolean success, CompilerData *data)
 	g_object_unref(data->input_file);
 	g_object_unref(data->builddir_file);
 	g_clear_object(&data->results_file);
+	if(data->cache_key)
+		g_checksum_free(data->cache_key);
+	g_free(data->cache_data);
 	g_slice_free(CompilerData, data);
 
 	/* Update */
@@ -22,9 +22,11 @@
 #include <libchimara/chimara-glk.h>
 #include <libchimara/chimara-if.h>
 
+#include "app.h"
 #include "error.h"
 #include "node.h"
 #include "skein.h"
+#include "skein-replay.h"
 #include "story.h"
 #include "story-private.h"
 
@@ -48,6 +50,7 @@ i7_story_run_compiler_output(I7Story *story)
 	ChimaraIF *glk = CHIMARA_IF(story->panel[side]->tabs[I7_PANE_STORY]);
 
 	/* Load and start the interpreter */
+	i7_story_begin_timeline_stage(story, "interpreter");
 	if(!chimara_if_run_game_file(glk, priv->compiler_output_file, &err)) {
 		error_dialog(GTK_WINDOW(story), err, _("Could not load interpreter: "));
 	}
@@ -68,6 +71,7 @@ i7_story_test_compiler_output(I7Story *story)
 	ChimaraIF *glk = CHIMARA_IF(story->panel[side]->tabs[I7_PANE_STORY]);
 
 	/* Load and start the interpreter */
+	i7_story_begin_timeline_stage(story, "interpreter");
 	if(!chimara_if_run_game_file(glk, priv->compiler_output_file, &err)) {
 		error_dialog(GTK_WINDOW(story), err, _("Could not load interpreter: "));
 	}
@@ -81,6 +85,14 @@ i7_story_test_compiler_output(I7Story *story)
 	gtk_widget_grab_focus(GTK_WIDGET(glk));
 }
 
+/* Shows the interpreter again after fast-forwarding; see play_commands() */
+static void
+end_fast_forward(ChimaraGlk *glk)
+{
+	if(!gtk_widget_get_child_visible(GTK_WIDGET(glk)))
+		gtk_widget_set_child_visible(GTK_WIDGET(glk), TRUE);
+}
+
 /* Finish setting up the interpreter when forced input is done processing;
  * this signal is set up in play_commands() because the interpreter processes
  * the commands you feed it asynchronously. */
@@ -88,6 +100,7 @@ static void
 on_waiting(ChimaraGlk *glk)
 {
 	if(!chimara_glk_is_line_input_pending(glk)) {
+		end_fast_forward(glk);
 		chimara_glk_set_interactive(glk, TRUE);
 
 		/* Set focus to the interpreter */
@@ -120,12 +133,20 @@ play_commands(I7Story *story, GSList *commands, gboolean start_interpreter)
 
 	/* Load and start the interpreter */
 	if(start_interpreter) {
+		i7_story_begin_timeline_stage(story, "interpreter");
 		if(!chimara_if_run_game_file(glk, priv->compiler_output_file, &err)) {
 			error_dialog(GTK_WINDOW(story), err, _("Could not load interpreter: "));
 		}
 		i7_skein_reset(priv->skein, TRUE);
 	}
 
+	/* Fast-forward: hide the interpreter while the commands are processed, so
+	 that only the screen after the last one gets drawn. The interpreter keeps
+	 its allocation, so the game doesn't see its windows change size. There's
+	 no point for only one command, since that is the last turn anyway. */
+	if(commands && commands->next && chimara_glk_get_running(CHIMARA_GLK(glk)))
+		gtk_widget_set_child_visible(GTK_WIDGET(glk), FALSE);
+
 	/* Display the interpreter */
 	i7_story_show_pane(story, I7_PANE_STORY);
 
@@ -174,6 +195,7 @@ i7_story_run_commands_from_node(I7Story *story, I7Node *node)
 {
 	I7_STORY_USE_PRIVATE(story, priv);
 
+	i7_story_flush_transcript(story);
 	I7Node *played = i7_skein_get_played_node(priv->skein);
 	g_assert(g_node_is_ancestor(played->gnode, node->gnode));
 
@@ -184,95 +206,14 @@ i7_story_run_commands_from_node(I7Story *story, I7Node *node)
 	g_slist_free(commands);
 }
 
-/* One-off data structure for passing variables to the handlers below */
-struct RunSkeinData {
-	I7Story *story;
-	I7Skein *skein;
-	ChimaraGlk *glk;
-	GFile *file_to_run;
-
-	GSList *commands;
-	unsigned long started_handler, waiting_handler;
-	gboolean finished; /* don't have to use a GCond because this communication
-	is within the same thread and only one way? */
-};
-
-/* Helper function: stop the interpreter when forced input is done processing;
-this signal is set up in run_entire_skein_loop() because the interpreter
-processes the commands you feed it asynchronously. */
-static void
-on_waiting_stop_interpreter(ChimaraGlk *glk, struct RunSkeinData *data)
-{
-	if(!chimara_glk_is_line_input_pending(glk)) {
-		/* Stop the interpreter */
-		chimara_glk_stop(glk);
-		data->finished = TRUE;
-
-		/* Disconnect this handler */
-		g_signal_handler_disconnect(data->glk, data->waiting_handler);
-	}
-}
-
-/* Helper function: feed the commands to the interpreter after the game has
-started; this signal is set up in run_entire_skein_loop() because it's not clear
-how soon the game is ready to accept input after the call to
-chimara_if_run_game_file(). */
+/* Callback for when all the blessed threads have been replayed */
 static void
-on_started_feed_commands(ChimaraGlk *glk, struct RunSkeinData *data)
+finish_replaying_skein(I7Skein *skein, GError *error, I7Story *story)
 {
-	/* Display the interpreter */
-	i7_story_show_pane(data->story, I7_PANE_STORY);
-
-	/* Feed the commands into the interpreter */
-	GSList *iter;
-	for(iter = data->commands; iter; iter = g_slist_next(iter)) {
-		chimara_glk_feed_line_input(glk, (char *)iter->data);
-	}
-
-	/* Disconnect this handler */
-	g_signal_handler_disconnect(data->glk, data->started_handler);
-}
-
-/* Helper function: Run the compiler output and feed the commands from the
-Skein up to a certain knot @node. Wait until the interpreter is done and stop
-it in preparation for the next knot. */
-static void
-run_entire_skein_loop(I7Node *node, struct RunSkeinData *data)
-{
-	GError *err = NULL;
-
-	data->commands = i7_skein_get_commands_to_node(data->skein, i7_skein_get_root_node(data->skein), node);
-
-	i7_skein_reset(data->skein, TRUE);
-
-	/* Set up signals to finish the actions when the input is done being
-	processed */
-	data->started_handler = g_signal_connect_after(data->glk, "started",
-	    G_CALLBACK(on_started_feed_commands), data);
-	data->waiting_handler = g_signal_connect_after(data->glk, "waiting",
-	    G_CALLBACK(on_waiting_stop_interpreter), data);
-	data->finished = FALSE;
-
-	/* Start the interpreter */
-	if(!chimara_if_run_game_file(CHIMARA_IF(data->glk), data->file_to_run, &err)) {
-		error_dialog(GTK_WINDOW(data->story), err, _("Could not load interpreter: "));
-		g_signal_handler_disconnect(data->glk, data->waiting_handler);
-		g_signal_handler_disconnect(data->glk, data->started_handler);
-		goto finally;
-	}
-
-	/* This will run until all the line input forced in
-	on_started_feed_commands() is finished processing */
-	while(!data->finished)
-		gtk_main_iteration_do(FALSE); /* don't block */
-
-	/* This should block on the chimara_glk_stop() call in
-	on_waiting_stop_interpreter() */
-	chimara_glk_wait(data->glk);
-
-finally:
-	g_slist_foreach(data->commands, (GFunc)g_free, NULL);
-	g_slist_free(data->commands);
+	if(error)
+		error_dialog(GTK_WINDOW(story), g_error_copy(error),
+			_("Could not replay the skein: "));
+	g_object_unref(story);
 }
 
 /*
@@ -280,31 +221,32 @@ finally:
  * @story: the story
  *
  * Callback for when compiling is finished. Plays through as many threads as
- * necessary to visit each blessed knot in the skein at least once.
+ * necessary to visit each blessed knot in the skein at least once. The threads
+ * are played in the background, several at a time, by the i7-replay helper
+ * program, instead of in the Story pane.
  */
 void
 i7_story_run_compiler_output_and_entire_skein(I7Story *story)
 {
 	I7_STORY_USE_PRIVATE(story, priv);
 
-	struct RunSkeinData *data = g_slice_new0(struct RunSkeinData);
-	data->story = story;
-	data->skein = priv->skein;
-	data->file_to_run = g_object_ref(priv->compiler_output_file);
+	GFile *helper = i7_app_get_binary_file(i7_app_get(), "i7-replay");
+	if(helper == NULL)
+		return;
 
-	/* Make sure the interpreter is non-interactive */
+	/* Use the same interpreter as the Story pane would */
 	I7StoryPanel side = i7_story_choose_panel(story, I7_PANE_STORY);
-	data->glk = CHIMARA_GLK(story->panel[side]->tabs[I7_PANE_STORY]);
-	chimara_glk_set_interactive(data->glk, FALSE);
-	
-	GSList *blessed_nodes = i7_skein_get_blessed_thread_ends(data->skein);
-	g_slist_foreach(blessed_nodes, (GFunc)run_entire_skein_loop, data);
-	g_slist_free(blessed_nodes);
+	ChimaraIF *glk = CHIMARA_IF(story->panel[side]->tabs[I7_PANE_STORY]);
+	gboolean use_git = chimara_if_get_preferred_interpreter(glk, CHIMARA_IF_FORMAT_GLULX) == CHIMARA_IF_INTERPRETER_GIT;
 
-	chimara_glk_set_interactive(data->glk, TRUE);
+	i7_skein_reset(priv->skein, TRUE);
+	i7_skein_replay_blessed_threads(priv->skein, helper,
+		priv->compiler_output_file, use_git, 0, NULL,
+		(I7SkeinReplayFunc)finish_replaying_skein, g_object_ref(story));
+	g_object_unref(helper);
 
-	g_object_unref(data->file_to_run);
-	g_slice_free(struct RunSkeinData, data);
+	/* Show the results as they come in */
+	i7_story_show_pane(story, I7_PANE_TRANSCRIPT);
 }
 
 /* Helper function: stop the game in @panel if it is running */
@@ -322,6 +264,7 @@ void
 i7_story_stop_running_game(I7Story *story)
 {
 	i7_story_foreach_panel(story, (I7PanelForeachFunc)panel_stop_running_game, NULL);
+	i7_story_flush_transcript(story);
 }
 
 /* Returns whether a game is running in either panel */
@@ -397,29 +340,125 @@ on_game_started(ChimaraGlk *game, I7Story *story)
 	gtk_action_set_sensitive(stop, TRUE);
 }
 
+/* Stop timing the interpreter once the story is ready for the player's input,
+ after any commands that were fed in */
+void
+on_game_waiting(ChimaraGlk *game, I7Story *story)
+{
+	if(!chimara_glk_is_line_input_pending(game))
+		i7_story_end_timeline_stage(story, "interpreter");
+}
+
 /* Set the "stop" action to be insensitive when the game finishes */
 void
 on_game_stopped(ChimaraGlk *game, I7Story *story)
 {
 	I7_STORY_USE_PRIVATE(story, priv);
+	i7_story_end_timeline_stage(story, "interpreter");
 	GtkAction *stop = gtk_action_group_get_action(priv->story_action_group, "stop");
 	gtk_action_set_sensitive(stop, FALSE);
+	i7_story_flush_transcript(story);
+	/* Show the final screen if the game ended in the middle of a replay */
+	end_fast_forward(game);
 }
 
-/* Grab commands entered by the user and store them in the skein */
-void
-on_game_command(ChimaraIF *game, gchar *input, gchar *response, I7Story *story)
+/* Commands that are fed to the interpreter faster than anyone could type them
+ are not added to the skein one at a time, because every new knot means
+ working out the differences, laying out the skein and updating the views.
+ Instead, they are kept in a journal which is applied to the skein in one batch
+ at most every JOURNAL_FLUSH_INTERVAL milliseconds, or whenever it contains
+ JOURNAL_MAX_ENTRIES entries. */
+#define JOURNAL_FLUSH_INTERVAL 100
+#define JOURNAL_MAX_ENTRIES 64
+
+typedef struct {
+	char *command; /* NULL for text not in response to a command */
+	char *response;
+} JournalEntry;
+
+static void
+free_journal_entry(JournalEntry *entry)
+{
+	g_free(entry->command);
+	g_free(entry->response);
+	g_slice_free(JournalEntry, entry);
+}
+
+/* Store one command and its response in the skein */
+static void
+capture_command(I7Skein *skein, const char *input, const char *response)
 {
-	I7_STORY_USE_PRIVATE(story, priv);
 	if(!input) {
 		/* If no input, then this was either the text printed before the first 
 		 prompt, or a keypress of Enter in response to character input. */
-		I7Node *root = i7_skein_get_root_node(priv->skein);
-		if(i7_skein_get_current_node(priv->skein) == root) {
+		I7Node *root = i7_skein_get_root_node(skein);
+		if(i7_skein_get_current_node(skein) == root) {
 			i7_node_set_transcript_text(root, response);
 		}
 		return;
 	} 
-	I7Node *node = i7_skein_new_command(priv->skein, input);
+	I7Node *node = i7_skein_new_command(skein, input);
 	i7_node_set_transcript_text(node, response);
 }
+
+/*
+ * i7_story_flush_transcript:
+ * @story: the story
+ *
+ * Adds any commands from the Story pane that are still waiting in the journal
+ * to the skein. Call this before doing anything that depends on the played
+ * knot being up to date.
+ */
+void
+i7_story_flush_transcript(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	if(priv->transcript_flush_source) {
+		g_source_remove(priv->transcript_flush_source);
+		priv->transcript_flush_source = 0;
+	}
+	if(g_queue_is_empty(&priv->transcript_journal))
+		return;
+
+	i7_skein_begin_batch(priv->skein);
+	JournalEntry *entry;
+	while((entry = g_queue_pop_head(&priv->transcript_journal)) != NULL) {
+		capture_command(priv->skein, entry->command, entry->response);
+		free_journal_entry(entry);
+	}
+	i7_skein_end_batch(priv->skein);
+}
+
+static gboolean
+flush_transcript_timeout(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	priv->transcript_flush_source = 0;
+	i7_story_flush_transcript(story);
+	return FALSE; /* one-shot */
+}
+
+/* Grab commands entered by the user and store them in the skein */
+void
+on_game_command(ChimaraIF *game, gchar *input, gchar *response, I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	JournalEntry *entry = g_slice_new(JournalEntry);
+	entry->command = g_strdup(input);
+	entry->response = g_strdup(response);
+	g_queue_push_tail(&priv->transcript_journal, entry);
+
+	/* Commands typed by the user go into the skein straight away; only forced
+	 input is held back */
+	if(!chimara_glk_is_line_input_pending(CHIMARA_GLK(game))
+		|| g_queue_get_length(&priv->transcript_journal) >= JOURNAL_MAX_ENTRIES) {
+		i7_story_flush_transcript(story);
+		return;
+	}
+
+	if(!priv->transcript_flush_source)
+		priv->transcript_flush_source = gdk_threads_add_timeout(JOURNAL_FLUSH_INTERVAL,
+			(GSourceFunc)flush_transcript_timeout, story);
+}
@@ -17,65 +17,218 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <webkit/webkit.h>
 
-#include "html.h"
 #include "panel.h"
 #include "story.h"
 #include "story-private.h"
 
+/* The Index tabs are only reloaded when the compiler changes the page, or the
+ tab has navigated away from it. Changed pages are loaded straight away into
+ the tabs that are showing, and into the other tabs when they are shown. */
+
+static GFile *
+get_index_file(I7Story *story, I7PaneIndexTab tab)
+{
+	GFile *project_file = i7_document_get_file(I7_DOCUMENT(story));
+	GFile *index_file = g_file_get_child(project_file, "Index");
+	GFile *retval = g_file_get_child(index_file, i7_panel_index_names[tab]);
+	g_object_unref(project_file);
+	g_object_unref(index_file);
+	return retval;
+}
+
+/* Returns a checksum of the contents of @file, or an empty string if it
+ doesn't exist */
+static char *
+get_index_file_checksum(GFile *file)
+{
+	char *contents;
+	gsize length;
+	if(!g_file_load_contents(file, NULL, &contents, &length, NULL, NULL))
+		return g_strdup("");
+	char *retval = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar *)contents, length);
+	g_free(contents);
+	return retval;
+}
+
+/* Returns the URI that the index tab should show */
+static char *
+get_index_uri(I7Story *story, I7PaneIndexTab tab)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->index_checksums[tab] && *priv->index_checksums[tab] == '\0')
+		return g_strdup("about:blank");
+	GFile *file = get_index_file(story, tab);
+	char *retval = g_file_get_uri(file);
+	g_object_unref(file);
+	return retval;
+}
+
+/* Whether @view is showing @uri, perhaps with a query or an anchor added by
+ the page's own scripts or links */
+static gboolean
+view_shows_uri(GtkWidget *view, const char *uri)
+{
+	const char *current = webkit_web_view_get_uri(WEBKIT_WEB_VIEW(view));
+	if(current == NULL || !g_str_has_prefix(current, uri))
+		return FALSE;
+	char next = current[strlen(uri)];
+	return next == '\0' || next == '?' || next == '#';
+}
+
+/* Load the index page into one of the tabs, with the query @param if it is not
+ NULL */
 static void
-load_index_file(I7Story *story, int counter)
+load_index_view(I7Story *story, I7StoryPanel side, I7PaneIndexTab tab, const char *param)
 {
-	GFile *parent = i7_document_get_file(I7_DOCUMENT(story));
-	GFile *child1 = g_file_get_child(parent, "Index");
-	GFile *file = g_file_get_child(child1, i7_panel_index_names[counter]);
-	g_object_unref(parent);
-	g_object_unref(child1);
-
-	if(g_file_query_exists(file, NULL)) {
-		html_load_file(WEBKIT_WEB_VIEW(story->panel[LEFT]->index_tabs[counter]), file);
-		html_load_file(WEBKIT_WEB_VIEW(story->panel[RIGHT]->index_tabs[counter]), file);
-	} else {
-		html_load_blank(WEBKIT_WEB_VIEW(story->panel[LEFT]->index_tabs[counter]));
-		html_load_blank(WEBKIT_WEB_VIEW(story->panel[RIGHT]->index_tabs[counter]));
+	I7_STORY_USE_PRIVATE(story, priv);
+	char *uri = get_index_uri(story, tab);
+	if(param != NULL && strcmp(uri, "about:blank") != 0) {
+		char *uri_with_param = g_strconcat(uri, "?", param, NULL);
+		g_free(uri);
+		uri = uri_with_param;
 	}
+	webkit_web_view_load_uri(WEBKIT_WEB_VIEW(story->panel[side]->index_tabs[tab]), uri);
+	g_free(uri);
+	priv->index_stale[side][tab] = FALSE;
+}
+
+/* Check whether the index page for @tab has changed since it was last loaded,
+ and load it into the tabs that are showing if so */
+static void
+check_index_tab(I7Story *story, I7PaneIndexTab tab)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	GFile *file = get_index_file(story, tab);
+	char *checksum = get_index_file_checksum(file);
 	g_object_unref(file);
+	gboolean changed = g_strcmp0(checksum, priv->index_checksums[tab]) != 0;
+	g_free(priv->index_checksums[tab]);
+	priv->index_checksums[tab] = checksum;
+
+	char *uri = get_index_uri(story, tab);
+	I7StoryPanel side;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++) {
+		GtkWidget *view = story->panel[side]->index_tabs[tab];
+		if(changed || !view_shows_uri(view, uri))
+			priv->index_stale[side][tab] = TRUE;
+		if(priv->index_stale[side][tab] && gtk_widget_get_mapped(view))
+			load_index_view(story, side, tab, NULL);
+	}
+	g_free(uri);
 }
 
-/* Idle function to check whether an index file exists and to load it, or a
-blank page if it doesn't exist. */
+/* Idle function to check whether an index file has changed, one tab each
+time. */
 static gboolean
 check_and_load_idle(I7Story *story)
 {
-	static I7PaneIndexTab counter = 0;
+	I7_STORY_USE_PRIVATE(story, priv);
 
-	load_index_file(story, counter);
-	counter++; /* next time, load the next tab */
-	if(counter == I7_INDEX_NUM_TABS) {
-		counter = 0; /* next time, load the first tab */
+	check_index_tab(story, priv->index_reload_tab);
+	priv->index_reload_tab++; /* next time, check the next tab */
+	if(priv->index_reload_tab == I7_INDEX_NUM_TABS) {
+		priv->index_reload_tab = 0; /* next time, check the first tab */
+		priv->index_reload_source = 0;
 		i7_document_display_progress_percentage(I7_DOCUMENT(story), 0.0);
 		i7_document_remove_status_message(I7_DOCUMENT(story), INDEX_TABS);
+		i7_story_end_timeline_stage(story, "index");
 		return FALSE; /* quit the cycle */
 	}
 
 	/* Update the status bar */
-	i7_document_display_progress_percentage(I7_DOCUMENT(story), (gdouble)counter / (gdouble)I7_INDEX_NUM_TABS);
+	i7_document_display_progress_percentage(I7_DOCUMENT(story), (gdouble)priv->index_reload_tab / (gdouble)I7_INDEX_NUM_TABS);
 	i7_document_display_status_message(I7_DOCUMENT(story), _("Reloading index..."), INDEX_TABS);
 
 	return TRUE; /* make sure there is a next time */
 }
 
-/* Load all the correct files in the index tabs, if they exist */
+/* Load a stale index page when its tab is shown */
+static void
+on_index_view_map(GtkWidget *view, I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	I7StoryPanel side;
+	I7PaneIndexTab tab;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++)
+		for(tab = 0; tab < I7_INDEX_NUM_TABS; tab++)
+			if(story->panel[side]->index_tabs[tab] == view && priv->index_stale[side][tab])
+				load_index_view(story, side, tab, NULL);
+}
+
+/* Set up the index tabs to load their pages when they are shown. Call after
+ the panels are set up. */
+void
+i7_story_init_index_tabs(I7Story *story)
+{
+	I7StoryPanel side;
+	I7PaneIndexTab tab;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++)
+		for(tab = 0; tab < I7_INDEX_NUM_TABS; tab++)
+			g_signal_connect(story->panel[side]->index_tabs[tab], "map", G_CALLBACK(on_index_view_map), story);
+}
+
+/* Stop reloading the index tabs and forget which pages were loaded */
+void
+i7_story_clear_index_tabs(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->index_reload_source) {
+		g_source_remove(priv->index_reload_source);
+		priv->index_reload_source = 0;
+	}
+	I7PaneIndexTab tab;
+	for(tab = 0; tab < I7_INDEX_NUM_TABS; tab++) {
+		g_free(priv->index_checksums[tab]);
+		priv->index_checksums[tab] = NULL;
+	}
+}
+
+/*
+ * i7_story_load_index_page:
+ * @story: the story
+ * @side: the panel
+ * @tab: the index tab
+ * @param: (allow-none): a query to add to the page's URI, or %NULL
+ *
+ * Loads the page for @tab into the panel on @side, if it has changed since
+ * that panel last showed it.
+ *
+ * Returns: %TRUE if the page was loaded, %FALSE if it was already there.
+ */
+gboolean
+i7_story_load_index_page(I7Story *story, I7StoryPanel side, I7PaneIndexTab tab, const char *param)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(!priv->index_stale[side][tab])
+		return FALSE;
+	load_index_view(story, side, tab, param);
+	return TRUE;
+}
+
+/* Check all the index pages for changes, and load the ones that changed */
 void
 i7_story_reload_index_tabs(I7Story *story, gboolean wait)
 {
-	if(wait)
+	I7_STORY_USE_PRIVATE(story, priv);
+
+	/* If the tabs are already being checked, start again from the first one */
+	priv->index_reload_tab = 0;
+	if(wait) {
+		if(priv->index_reload_source) {
+			g_source_remove(priv->index_reload_source);
+			priv->index_reload_source = 0;
+		}
 		while(check_and_load_idle(story))
 			;
-	else
-		g_idle_add((GSourceFunc)check_and_load_idle, story);
+	} else if(priv->index_reload_source == 0) {
+		priv->index_reload_source = g_idle_add((GSourceFunc)check_and_load_idle, story);
+	}
 }
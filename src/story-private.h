@@ -22,6 +22,7 @@
 #include <gtk/gtk.h>
 #include "story.h"
 #include "skein.h"
+#include "timeline.h"
 #include "osxcart/plist.h"
 
 typedef struct {
@@ -37,6 +38,14 @@ typedef struct {
 	GtkTextBuffer *progress;
 	GtkTextBuffer *debug_log;
 	GtkSourceBuffer *i6_source;
+	/* Index pages; see story-index.c */
+	char *index_checksums[I7_INDEX_NUM_TABS];
+	gboolean index_stale[I7_STORY_NUM_PANELS][I7_INDEX_NUM_TABS];
+	I7PaneIndexTab index_reload_tab;
+	guint index_reload_source;
+	/* Loading the debug log and I6 source; see story-results.c */
+	gpointer debug_log_view;
+	gpointer i6_source_view;
 	/* The Settings.plist object */
 	PlistObject *settings;
 	/* The manifest.plist object */
@@ -46,10 +55,23 @@ typedef struct {
 	gpointer compile_finished_callback_data;
 	GFile *copy_blorb_dest_file;
 	GFile *compiler_output_file;
+	/* How long each stage of the last compile took; see story-compile.c */
+	I7Timeline *timeline;
+	gboolean timeline_finished;
+	guint timeline_update_source;
+	/* Compiling in the background; see story-background.c */
+	guint background_timeout;
+	gpointer background_job;
+	GFile *background_dir;
+	char *background_key;
 	/* Skein / running */
 	I7Skein *skein;
 	GSettings *skein_settings;
 	gboolean test_me;
+	/* Commands and responses from the Story pane that haven't been added to
+	 the skein yet; see story-game.c */
+	GQueue transcript_journal;
+	guint transcript_flush_source;
 } I7StoryPrivate;
 
 #define I7_STORY_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), I7_TYPE_STORY, I7StoryPrivate))
@@ -17,6 +17,9 @@
 
 #include "config.h"
 
+#include <string.h>
+
+#include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <gtksourceview/gtksourcebuffer.h>
 #include <gtksourceview/gtksourcelanguage.h>
@@ -25,6 +28,30 @@
 #include "document.h"
 #include "lang.h"
 #include "story.h"
+#include "story-private.h"
+#include "timeline.h"
+
+#define TIMELINE_PADDING 3
+/* How much of a generated file to put into its text view per idle callback */
+#define BUILD_VIEW_CHUNK_SIZE 65536
+
+/* A text view on the Debugging or Inform 6 tab, showing a file that the
+ compiler generated in the Build folder. These files can be many megabytes, so
+ they are only loaded when their tab is shown, and then a piece at a time from a
+ memory-mapped file, in idle time. */
+typedef struct {
+	I7Story *story;
+	GtkTextBuffer *buffer;
+	const char *filename;
+	const char *stage; /* name in the compile timeline */
+	gboolean timed; /* the load in progress was started by a compile */
+	GtkWidget *views[I7_STORY_NUM_PANELS];
+	char *signature; /* Size and date of the file that is fully loaded */
+	char *loading_signature;
+	GMappedFile *map;
+	gsize offset;
+	guint source;
+} BuildView;
 
 /* Add the debugging tabs to this main window */
 void
@@ -61,3 +88,389 @@ create_inform6_source_buffer()
 	gtk_source_buffer_set_highlight_syntax(i6buffer, TRUE);
 	return i6buffer;
 }
+
+/* Translate the names of the stages in the compile timeline */
+static const char *
+get_stage_label(const char *name)
+{
+	static const struct {
+		const char *name;
+		const char *label;
+	} labels[] = {
+		{ "save", N_("Saving") },
+		{ "uuid", N_("Checking UUID") },
+		{ "ni", N_("Inform 7") },
+		{ "debug-log", N_("Loading debug log") },
+		{ "i6-source", N_("Loading Inform 6 code") },
+		{ "index", N_("Reloading index") },
+		{ "inform6", N_("Inform 6") },
+		{ "cblorb", N_("cBlorb") },
+		{ "interpreter", N_("Starting story") }
+	};
+	unsigned ix;
+	for(ix = 0; ix < G_N_ELEMENTS(labels); ix++)
+		if(strcmp(name, labels[ix].name) == 0)
+			return _(labels[ix].label);
+	return name;
+}
+
+/* Count the stages that are finished, and so can be drawn */
+static unsigned
+count_finished_stages(I7Timeline *timeline)
+{
+	unsigned ix, count = 0;
+	for(ix = 0; ix < i7_timeline_get_n_stages(timeline); ix++)
+		if(i7_timeline_get_stage(timeline, ix)->end != -1)
+			count++;
+	return count;
+}
+
+static int
+get_timeline_row_height(GtkWidget *widget)
+{
+	PangoLayout *layout = gtk_widget_create_pango_layout(widget, "Xg");
+	int height;
+	pango_layout_get_pixel_size(layout, NULL, &height);
+	g_object_unref(layout);
+	return height + TIMELINE_PADDING;
+}
+
+/* Make room for one row per stage in the timeline views, and redraw them. The
+ GDK lock must be held. */
+void
+i7_story_update_timeline_view(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline == NULL)
+		return;
+
+	unsigned rows = count_finished_stages(priv->timeline);
+	I7StoryPanel side;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++) {
+		GtkWidget *timeline = story->panel[side]->timeline;
+		int height = rows * get_timeline_row_height(timeline) + TIMELINE_PADDING;
+		gtk_widget_set_size_request(timeline, -1, height);
+		gtk_widget_show(timeline);
+		gtk_widget_queue_draw(timeline);
+	}
+}
+
+/* Draw the timeline of the last compile: one row per stage, with the stage's
+ name and duration on the left and a bar showing when it ran on the right. */
+gboolean
+on_timeline_expose_event(GtkWidget *widget, GdkEventExpose *event, I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->timeline == NULL)
+		return FALSE;
+
+	GtkAllocation allocation;
+	gtk_widget_get_allocation(widget, &allocation);
+	GtkStyle *style = gtk_widget_get_style(widget);
+	int row_height = get_timeline_row_height(widget);
+	gint64 total = MAX(i7_timeline_get_duration(priv->timeline), 1);
+	unsigned n_stages = i7_timeline_get_n_stages(priv->timeline);
+	unsigned ix;
+
+	/* Lay out the labels first, to find out how much room they need */
+	PangoLayout **layouts = g_new0(PangoLayout *, n_stages);
+	int label_width = 0;
+	for(ix = 0; ix < n_stages; ix++) {
+		const I7TimelineStage *stage = i7_timeline_get_stage(priv->timeline, ix);
+		if(stage->end == -1)
+			continue;
+		double seconds = (stage->end - stage->start) / (double)G_USEC_PER_SEC;
+		char *text = stage->cached?
+			g_strdup_printf(_("%s: %.2f s (unchanged)"), get_stage_label(stage->name), seconds)
+			: g_strdup_printf(_("%s: %.2f s"), get_stage_label(stage->name), seconds);
+		layouts[ix] = gtk_widget_create_pango_layout(widget, text);
+		g_free(text);
+		int width;
+		pango_layout_get_pixel_size(layouts[ix], &width, NULL);
+		label_width = MAX(label_width, width);
+	}
+	label_width += 2 * TIMELINE_PADDING;
+	double bar_area = MAX(allocation.width - label_width - TIMELINE_PADDING, 1);
+
+	cairo_t *cr = gdk_cairo_create(gtk_widget_get_window(widget));
+	gdk_cairo_region(cr, event->region);
+	cairo_clip(cr);
+
+	int y = TIMELINE_PADDING;
+	for(ix = 0; ix < n_stages; ix++) {
+		if(layouts[ix] == NULL)
+			continue;
+		const I7TimelineStage *stage = i7_timeline_get_stage(priv->timeline, ix);
+
+		gdk_cairo_set_source_color(cr, &style->text[GTK_STATE_NORMAL]);
+		cairo_move_to(cr, TIMELINE_PADDING, y);
+		pango_cairo_show_layout(cr, layouts[ix]);
+		g_object_unref(layouts[ix]);
+
+		double x = label_width + bar_area * stage->start / total;
+		double width = MAX(bar_area * (stage->end - stage->start) / total, 1.0);
+		gdk_cairo_set_source_color(cr, stage->cached? &style->mid[GTK_STATE_NORMAL] : &style->base[GTK_STATE_SELECTED]);
+		cairo_rectangle(cr, x, y, width, row_height - TIMELINE_PADDING);
+		cairo_fill(cr);
+
+		y += row_height;
+	}
+
+	cairo_destroy(cr);
+	g_free(layouts);
+	return TRUE;
+}
+
+/* Describes the size and date of @file, or returns NULL if it doesn't exist */
+static char *
+get_file_signature(GFile *file)
+{
+	GFileInfo *info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+		G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if(info == NULL)
+		return NULL;
+	char *retval = g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ".%06u",
+		g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_STANDARD_SIZE),
+		g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+	g_object_unref(info);
+	return retval;
+}
+
+static void
+stop_loading_build_view(BuildView *view)
+{
+	if(view->source) {
+		g_source_remove(view->source);
+		view->source = 0;
+	}
+	if(view->map) {
+		g_mapped_file_unref(view->map);
+		view->map = NULL;
+	}
+	g_free(view->loading_signature);
+	view->loading_signature = NULL;
+	if(view->timed) {
+		i7_story_cancel_timeline_stage(view->story, view->stage);
+		view->timed = FALSE;
+	}
+}
+
+/* Inserts @length bytes of @text at the end of the view's buffer, replacing
+ any bytes that aren't valid UTF-8 */
+static void
+append_to_build_view(BuildView *view, const char *text, gsize length)
+{
+	GtkTextIter end;
+	const char *valid_end;
+	while(length > 0) {
+		g_utf8_validate(text, length, &valid_end);
+		gtk_text_buffer_get_end_iter(view->buffer, &end);
+		gtk_text_buffer_insert(view->buffer, &end, text, valid_end - text);
+		length -= valid_end - text;
+		text = valid_end;
+		if(length > 0) {
+			gtk_text_buffer_get_end_iter(view->buffer, &end);
+			gtk_text_buffer_insert(view->buffer, &end, "\xEF\xBF\xBD", -1); /* U+FFFD */
+			text++;
+			length--;
+		}
+	}
+}
+
+/* Idle callback that puts the next piece of the file into the buffer; the GDK
+ lock is held */
+static gboolean
+load_build_view_chunk(BuildView *view)
+{
+	const char *contents = g_mapped_file_get_contents(view->map);
+	gsize length = g_mapped_file_get_length(view->map);
+	gsize end = MIN(view->offset + BUILD_VIEW_CHUNK_SIZE, length);
+
+	/* Stop at the end of a line, or at least not in the middle of a
+	 character */
+	if(end < length) {
+		gsize line_end = end;
+		while(line_end > view->offset && contents[line_end - 1] != '\n')
+			line_end--;
+		if(line_end > view->offset)
+			end = line_end;
+		else
+			while(end > view->offset + 1 && (contents[end] & 0xC0) == 0x80)
+				end--;
+	}
+
+	gboolean source_buffer = GTK_IS_SOURCE_BUFFER(view->buffer);
+	if(source_buffer)
+		gtk_source_buffer_begin_not_undoable_action(GTK_SOURCE_BUFFER(view->buffer));
+	append_to_build_view(view, contents + view->offset, end - view->offset);
+	if(source_buffer)
+		gtk_source_buffer_end_not_undoable_action(GTK_SOURCE_BUFFER(view->buffer));
+	view->offset = end;
+
+	if(view->offset < length)
+		return TRUE; /* call again */
+
+	/* Done; remember which version of the file is shown */
+	if(view->timed) {
+		i7_story_end_timeline_stage(view->story, view->stage);
+		view->timed = FALSE;
+	}
+	view->source = 0;
+	g_free(view->signature);
+	view->signature = view->loading_signature;
+	view->loading_signature = NULL;
+	g_mapped_file_unref(view->map);
+	view->map = NULL;
+	return FALSE;
+}
+
+/* Starts loading the file into the view's buffer, unless the version that is
+ already there or being loaded is still current. If @timed, the load is a stage
+ in the timeline of the compile that wrote the file; loads that happen later,
+ when a tab is shown, have nothing to do with the compile and are not timed.
+ The GDK lock must be held. */
+static void
+load_build_view(BuildView *view, gboolean timed)
+{
+	GFile *project_file = i7_document_get_file(I7_DOCUMENT(view->story));
+	if(project_file == NULL)
+		return;
+	GFile *builddir_file = g_file_get_child(project_file, "Build");
+	GFile *file = g_file_get_child(builddir_file, view->filename);
+	g_object_unref(project_file);
+	g_object_unref(builddir_file);
+
+	/* Ignore errors, just don't show it if it's not there */
+	char *signature = get_file_signature(file);
+	if(signature == NULL
+		|| (view->signature && strcmp(signature, view->signature) == 0)
+		|| (view->loading_signature && strcmp(signature, view->loading_signature) == 0)) {
+		g_free(signature);
+		g_object_unref(file);
+		return;
+	}
+
+	stop_loading_build_view(view);
+	char *path = g_file_get_path(file);
+	g_object_unref(file);
+	view->map = g_mapped_file_new(path, FALSE, NULL);
+	g_free(path);
+	if(view->map == NULL) {
+		g_free(signature);
+		return;
+	}
+	view->loading_signature = signature;
+	g_free(view->signature);
+	view->signature = NULL;
+	view->offset = 0;
+
+	gboolean source_buffer = GTK_IS_SOURCE_BUFFER(view->buffer);
+	if(source_buffer)
+		gtk_source_buffer_begin_not_undoable_action(GTK_SOURCE_BUFFER(view->buffer));
+	gtk_text_buffer_set_text(view->buffer, "", 0);
+	if(source_buffer)
+		gtk_source_buffer_end_not_undoable_action(GTK_SOURCE_BUFFER(view->buffer));
+
+	if(timed) {
+		i7_story_begin_timeline_stage(view->story, view->stage);
+		view->timed = TRUE;
+	}
+	view->source = gdk_threads_add_idle_full(G_PRIORITY_LOW,
+		(GSourceFunc)load_build_view_chunk, view, NULL);
+}
+
+/* Load the file when its tab is shown; the GDK lock is held */
+static void
+on_build_view_map(GtkWidget *widget, BuildView *view)
+{
+	load_build_view(view, FALSE);
+}
+
+static BuildView *
+build_view_new(I7Story *story, GtkTextBuffer *buffer, const char *filename, const char *stage, I7PaneResultsTab tab)
+{
+	BuildView *view = g_slice_new0(BuildView);
+	view->story = story;
+	view->buffer = g_object_ref(buffer);
+	view->filename = filename;
+	view->stage = stage;
+	I7StoryPanel side;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++) {
+		view->views[side] = story->panel[side]->results_tabs[tab];
+		g_signal_connect(view->views[side], "map", G_CALLBACK(on_build_view_map), view);
+	}
+	return view;
+}
+
+static void
+build_view_free(BuildView *view)
+{
+	stop_loading_build_view(view);
+	I7StoryPanel side;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++)
+		g_signal_handlers_disconnect_by_func(view->views[side], on_build_view_map, view);
+	g_object_unref(view->buffer);
+	g_free(view->signature);
+	g_slice_free(BuildView, view);
+}
+
+/*
+ * i7_story_init_build_views:
+ * @story: the story
+ *
+ * Sets up the Debugging and Inform 6 tabs to load the debug log and the
+ * generated Inform 6 code when they are shown. Call after the panels are set
+ * up.
+ */
+void
+i7_story_init_build_views(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	priv->debug_log_view = build_view_new(story, priv->debug_log, "Debug log.txt", "debug-log", I7_RESULTS_TAB_DEBUGGING);
+	priv->i6_source_view = build_view_new(story, GTK_TEXT_BUFFER(priv->i6_source), "auto.inf", "i6-source", I7_RESULTS_TAB_INFORM6);
+}
+
+/* Stops loading and frees the data for the Debugging and Inform 6 tabs */
+void
+i7_story_free_build_views(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	if(priv->debug_log_view) {
+		build_view_free(priv->debug_log_view);
+		priv->debug_log_view = NULL;
+	}
+	if(priv->i6_source_view) {
+		build_view_free(priv->i6_source_view);
+		priv->i6_source_view = NULL;
+	}
+}
+
+static void
+reload_build_view_if_shown(BuildView *view)
+{
+	I7StoryPanel side;
+	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++) {
+		if(gtk_widget_get_mapped(view->views[side])) {
+			load_build_view(view, TRUE);
+			return;
+		}
+	}
+}
+
+/*
+ * i7_story_reload_build_views:
+ * @story: the story
+ *
+ * Call after the compiler has written a new debug log and Inform 6 code. Tabs
+ * that are showing are reloaded in the background; the others are reloaded
+ * when they are next shown. The GDK lock must be held.
+ */
+void
+i7_story_reload_build_views(I7Story *story)
+{
+	I7_STORY_USE_PRIVATE(story, priv);
+	reload_build_view_if_shown(priv->debug_log_view);
+	reload_build_view_if_shown(priv->i6_source_view);
+}
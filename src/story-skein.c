@@ -37,6 +37,7 @@ on_skein_modified(I7Skein *skein, I7Story *story)
 void
 on_node_activate(I7Skein *skein, I7Node *newnode, I7Story *story)
 {
+	i7_story_flush_transcript(story);
 	I7Node *oldnode = i7_skein_get_played_node(skein);
 
 	/* If user requests to play to the node that was already just played in the
@@ -139,6 +140,7 @@ on_popup_menu_insert_knot(GtkMenuItem *menuitem, I7PopupMenuCallbackData *data)
 static gboolean
 can_remove(I7Skein *skein, I7Node *node, I7Story *story)
 {
+	i7_story_flush_transcript(story);
 	I7Node *played = i7_skein_get_played_node(skein);
 	if(i7_story_get_game_running(story) && i7_node_in_thread(node, played)) {
 		GtkWidget *dialog = gtk_message_dialog_new_with_markup(NULL, 0, GTK_MESSAGE_INFO, GTK_BUTTONS_OK,
@@ -346,16 +346,16 @@ i7_story_next_difference_skein(I7Story *story)
 
 	gtk_tree_model_get(skein, &iter, I7_SKEIN_COLUMN_NODE_PTR, &current_node, -1);
 
-	/* Find the next item */
-	I7Node *next_node = i7_node_get_next_difference(current_node);
+	/* Find the next item, starting again from the top if there is none */
+	I7Node *next_node = i7_skein_get_next_difference(I7_SKEIN(skein), current_node, I7_SKEIN_DIFFERENCE_EXPECTED);
 	if(!next_node)
-		next_node = i7_node_get_next_difference(i7_skein_get_root_node(I7_SKEIN(skein)));
+		next_node = i7_skein_get_next_difference(I7_SKEIN(skein), NULL, I7_SKEIN_DIFFERENCE_EXPECTED);
+	g_object_unref(current_node);
 	if(!next_node) {
 		/* No next item */
 		gdk_window_beep(gtk_widget_get_window(GTK_WIDGET(story)));
 		return;
 	}
-	g_object_unref(current_node);
 
 	/* display item in skein and transcript */
 	i7_story_show_node_in_transcript(story, next_node);
@@ -380,18 +380,9 @@ i7_story_show_node_in_transcript(I7Story *story, I7Node *node)
 	/* display transcript to item, invalidates iters */
 	i7_skein_set_current_node(I7_SKEIN(skein), node);
 
-	/* Get an iterator to the item */
-	gboolean found = FALSE;
-	g_assert(gtk_tree_model_get_iter_first(skein, &iter));
-	do {
-		I7Node *iter_node = NULL;
-		gtk_tree_model_get(skein, &iter, I7_SKEIN_COLUMN_NODE_PTR, &iter_node, -1);
-		if(iter_node == node)
-			found = TRUE;
-		g_object_unref(iter_node);
-	} while(!found && gtk_tree_model_iter_next(skein, &iter));
-	/* Get a path to the iterator */
-	GtkTreePath *path = gtk_tree_model_get_path(skein, &iter);
+	/* The knot's row in the Transcript is its depth in the skein */
+	GtkTreePath *path = gtk_tree_path_new_from_indices(g_node_depth(node->gnode) - 1, -1);
+	g_assert(gtk_tree_model_get_iter(skein, &iter, path));
 
 	I7StoryPanel side;
 	for(side = LEFT; side < I7_STORY_NUM_PANELS; side++) {
@@ -67,6 +67,7 @@ void on_labels_changed(I7Skein *, I7Panel *);
 void on_show_node(I7Skein *, I7SkeinShowNodeReason, I7Node *, I7Panel *);
 /* Defined in story-game.c */
 void on_game_started(ChimaraGlk *, I7Story *);
+void on_game_waiting(ChimaraGlk *, I7Story *);
 void on_game_stopped(ChimaraGlk *, I7Story *);
 void on_game_command(ChimaraIF *, gchar *, gchar *, I7Story *);
 gchar *load_blorb_resource(guint32, guint32, I7Story *);
@@ -150,8 +151,9 @@ on_panel_display_index_page(I7Panel *panel, I7PaneIndexTab tabnum, char *param,
 
 	/* If a ?param was requested in the URI, then navigate there before showing
 	the page - this doesn't completely eliminate the flash of the page changing,
-	but it helps */
-	if(param != NULL) {
+	but it helps. If the page has changed since the tab last showed it, load it
+	with the ?param straight away. */
+	if(!i7_story_load_index_page(story, side, tabnum, param) && param != NULL) {
 		char *script = g_strconcat("window.location.search = '", param, "'", NULL);
 		webkit_web_view_execute_script(WEBKIT_WEB_VIEW(story->panel[side]->index_tabs[tabnum]), script);
 		g_free(script);
@@ -381,6 +383,28 @@ remove_recent_story_file(GFile *file)
 	g_free(uri);
 }
 
+static void
+on_skein_saved(I7Skein *skein, GError *error, I7Story *story)
+{
+	if(!error || g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
+	GtkWindow *parent = gtk_widget_in_destruction(GTK_WIDGET(story))? NULL : GTK_WINDOW(story);
+	error_dialog(parent, g_error_copy(error), _("There was an error saving the Skein. Your story will still be saved. Problem: "));
+}
+
+/* Keep a binary copy of the skein in the Build folder of @project_file, so
+ that the project opens faster next time */
+static void
+set_skein_cache_file(I7Story *story, GFile *project_file)
+{
+	I7StoryPrivate *priv = I7_STORY_PRIVATE(story);
+	GFile *build_file = g_file_get_child(project_file, "Build");
+	GFile *cache_file = g_file_get_child(build_file, "Skein.cache");
+	i7_skein_set_cache_file(priv->skein, cache_file);
+	g_object_unref(cache_file);
+	g_object_unref(build_file);
+}
+
 /* Save story in the given directory  */
 static void
 i7_story_save_as(I7Document *document, GFile *file)
@@ -432,12 +456,10 @@ i7_story_save_as(I7Document *document, GFile *file)
 	i7_document_monitor_file(document, story_file);
 	g_object_unref(story_file);
 
-	/* Save the skein */
+	/* Save the skein; this is finished on another thread */
 	GFile *skein_file = g_file_get_child(file, "Skein.skein");
-	if(!i7_skein_save(priv->skein, skein_file, &err)) {
-		error_dialog(GTK_WINDOW(document), err, _("There was an error saving the Skein. Your story will still be saved. Problem: "));
-		err = NULL;
-	}
+	set_skein_cache_file(I7_STORY(document), file);
+	i7_skein_save_in_background(priv->skein, skein_file, (I7SkeinSaveFunc)on_skein_saved, document);
 	g_object_unref(skein_file);
 
 	/* Save the notes */
@@ -790,10 +812,13 @@ story_init_panel(I7Story *self, I7Panel *panel, PangoFontDescription *font)
 	g_signal_connect(panel, "display-docpage", G_CALLBACK(on_panel_display_docpage), self);
 	g_signal_connect(panel, "display-extensions-docpage", G_CALLBACK(on_panel_display_extensions_docpage), self);
 	g_signal_connect(panel, "display-index-page", G_CALLBACK(on_panel_display_index_page), self);
+	g_signal_connect(panel->timeline, "expose-event", G_CALLBACK(on_timeline_expose_event), self);
 	g_signal_connect(priv->skein, "labels-changed", G_CALLBACK(on_labels_changed), panel);
 	g_signal_connect(priv->skein, "show-node", G_CALLBACK(on_show_node), panel);
+	g_signal_connect_swapped(priv->skein, "differences-changed", G_CALLBACK(i7_panel_update_differences), panel);
 	g_signal_connect(panel->tabs[I7_PANE_SKEIN], "node-menu-popup", G_CALLBACK(on_node_popup), NULL);
 	g_signal_connect(panel->tabs[I7_PANE_STORY], "started", G_CALLBACK(on_game_started), self);
+	g_signal_connect(panel->tabs[I7_PANE_STORY], "waiting", G_CALLBACK(on_game_waiting), self);
 	g_signal_connect(panel->tabs[I7_PANE_STORY], "stopped", G_CALLBACK(on_game_stopped), self);
 	g_signal_connect(panel->tabs[I7_PANE_STORY], "command", G_CALLBACK(on_game_command), self);
 
@@ -949,6 +974,7 @@ i7_story_init(I7Story *self)
 	GtkSourceBuffer *buffer = i7_document_get_buffer(I7_DOCUMENT(self));
 	set_buffer_language(buffer, "inform7");
 	gtk_source_buffer_set_style_scheme(buffer, i7_app_get_current_color_scheme(theapp));
+	g_signal_connect_swapped(buffer, "changed", G_CALLBACK(i7_story_schedule_background_compile), self);
 
 	/* Create a text buffer for the Progress, Debugging and I6 text views */
 	priv->progress = gtk_text_buffer_new(NULL);
@@ -965,6 +991,8 @@ i7_story_init(I7Story *self)
 	/* Do panel-specific stuff to the left and then the right panel */
 	i7_story_foreach_panel(self, (I7PanelForeachFunc)story_init_panel, font);
 	pango_font_description_free(font);
+	i7_story_init_build_views(self);
+	i7_story_init_index_tabs(self);
 
 	/* Now the buffers and models are owned by the views, so dereference them */
 	g_object_unref(buffer);
@@ -1007,6 +1035,22 @@ i7_story_init(I7Story *self)
 	g_signal_connect(self, "delete-event", G_CALLBACK(on_storywindow_delete_event), NULL);
 }
 
+static void
+i7_story_dispose(GObject *self)
+{
+	I7_STORY_USE_PRIVATE(self, priv);
+	/* Don't let the window go away before the skein is written to disk */
+	if(priv->skein) {
+		i7_story_flush_transcript(I7_STORY(self));
+		i7_skein_wait_for_save(priv->skein);
+	}
+	i7_story_remove_background_build(I7_STORY(self));
+	i7_story_clear_timeline(I7_STORY(self));
+	i7_story_free_build_views(I7_STORY(self));
+	i7_story_clear_index_tabs(I7_STORY(self));
+	G_OBJECT_CLASS(i7_story_parent_class)->dispose(self);
+}
+
 static void
 i7_story_finalize(GObject *self)
 {
@@ -1048,6 +1092,7 @@ i7_story_class_init(I7StoryClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 	object_class->set_property = i7_story_set_property;
 	object_class->get_property = i7_story_get_property;
+	object_class->dispose = i7_story_dispose;
 	object_class->finalize = i7_story_finalize;
 
 	/* Properties */
@@ -1252,6 +1297,7 @@ i7_story_open(I7Story *story, GFile *file)
 
 	/* Read the skein */
 	GFile *skein_file = g_file_get_child(file, "Skein.skein");
+	set_skein_cache_file(story, file);
 	if(!i7_skein_load(priv->skein, skein_file, &err)) {
 		error_dialog(GTK_WINDOW(story), err, _("This project's Skein was not found, or it was unreadable."));
 		err = NULL;
@@ -34,6 +34,8 @@
 #include "skein.h"
 #include "story.h"
 
+#define INFORM6_COMPILER_NAME "inform6"
+
 typedef enum {
 	I7_STORY_FORMAT_Z5 = 5,  /* deprecated, only used in old projects */
 	I7_STORY_FORMAT_Z6 = 6,  /* ditto */
@@ -104,8 +106,16 @@ gboolean reindex_headings(GtkTextBuffer *buffer, I7Document *document);
 void i7_story_add_debug_tabs(I7Document *document);
 void i7_story_remove_debug_tabs(I7Document *document);
 GtkSourceBuffer *create_inform6_source_buffer(void);
+void i7_story_update_timeline_view(I7Story *story);
+void i7_story_init_build_views(I7Story *story);
+void i7_story_free_build_views(I7Story *story);
+void i7_story_reload_build_views(I7Story *story);
+gboolean on_timeline_expose_event(GtkWidget *widget, GdkEventExpose *event, I7Story *story);
 
 /* Index pane, story-index.c */
+void i7_story_init_index_tabs(I7Story *story);
+void i7_story_clear_index_tabs(I7Story *story);
+gboolean i7_story_load_index_page(I7Story *story, I7StoryPanel side, I7PaneIndexTab tab, const char *param);
 void i7_story_reload_index_tabs(I7Story *story, gboolean wait);
 
 /* Settings pane, story-settings.c */
@@ -128,6 +138,19 @@ void i7_story_set_compile_finished_action(I7Story *story, CompileActionFunc call
 void i7_story_compile(I7Story *story, gboolean release, gboolean refresh);
 void i7_story_save_compiler_output(I7Story *story, const gchar *dialog_title);
 void i7_story_save_ifiction(I7Story *story);
+gchar *i7_story_get_i6_compiler_switches(gboolean use_debug_flags, int format);
+char **i7_story_get_ni_command_line(I7Story *story, GFile *project_file, gboolean use_debug_flags);
+char **i7_story_get_i6_command_line(I7Story *story, GFile *builddir_file, gboolean use_debug_flags);
+void i7_story_begin_timeline_stage(I7Story *story, const char *stage);
+void i7_story_end_timeline_stage(I7Story *story, const char *stage);
+void i7_story_cancel_timeline_stage(I7Story *story, const char *stage);
+void i7_story_clear_timeline(I7Story *story);
+
+/* Background compiling, story-background.c */
+void i7_story_schedule_background_compile(I7Story *story);
+void i7_story_cancel_background_compile(I7Story *story);
+GFile *i7_story_get_background_build(I7Story *story);
+void i7_story_remove_background_build(I7Story *story);
 
 /* Story pane, story-game.c */
 void i7_story_run_compiler_output(I7Story *story);
@@ -138,6 +161,7 @@ void i7_story_run_commands_from_node(I7Story *story, I7Node *node);
 void i7_story_run_compiler_output_and_entire_skein(I7Story *story);
 void i7_story_stop_running_game(I7Story *story);
 gboolean i7_story_get_game_running(I7Story *story);
+void i7_story_flush_transcript(I7Story *story);
 void i7_story_set_use_git(I7Story *story, gboolean use_git);
 
 /* Skein pane, story-skein.c */
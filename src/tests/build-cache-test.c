@@ -0,0 +1,135 @@
+/*  Copyright (C) 2015 P. F. Chimento
+ *  This file is part of GNOME Inform 7.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "build-cache.h"
+
+static GChecksum *
+make_build_cache_key(GFile *input)
+{
+	GChecksum *key = i7_build_cache_key_new("test");
+	i7_build_cache_key_add_string(key, "-switch");
+	i7_build_cache_key_add_contents(key, input);
+	return key;
+}
+
+void
+test_build_cache_lookup(void)
+{
+	char *dir = g_dir_make_tmp("build-cache-XXXXXX", NULL);
+	g_assert(dir);
+	GFile *builddir_file = g_file_new_for_path(dir);
+	GFile *input = g_file_get_child(builddir_file, "input.txt");
+	GFile *output = g_file_get_child(builddir_file, "output.txt");
+	GFile *outputs[] = { output, NULL };
+	char *data = NULL;
+
+	g_assert(g_file_replace_contents(input, "abc", 3, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	g_assert(g_file_replace_contents(output, "xyz", 3, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+
+	/* Nothing stored yet */
+	GChecksum *key = make_build_cache_key(input);
+	g_assert(!i7_build_cache_lookup(builddir_file, "test", key, outputs, NULL));
+	i7_build_cache_store(builddir_file, "test", key, outputs, "extra");
+	g_checksum_free(key);
+
+	/* Same inputs, outputs untouched */
+	key = make_build_cache_key(input);
+	g_assert(i7_build_cache_lookup(builddir_file, "test", key, outputs, &data));
+	g_assert_cmpstr(data, ==, "extra");
+	g_free(data);
+	g_assert(!i7_build_cache_lookup(builddir_file, "other", key, outputs, NULL));
+	g_checksum_free(key);
+
+	/* Changed inputs */
+	g_assert(g_file_replace_contents(input, "abd", 3, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	key = make_build_cache_key(input);
+	g_assert(!i7_build_cache_lookup(builddir_file, "test", key, outputs, NULL));
+	i7_build_cache_store(builddir_file, "test", key, outputs, NULL);
+	g_checksum_free(key);
+
+	/* Output changed since it was stored */
+	g_assert(g_file_replace_contents(output, "xyzw", 4, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	key = make_build_cache_key(input);
+	g_assert(!i7_build_cache_lookup(builddir_file, "test", key, outputs, NULL));
+	g_checksum_free(key);
+
+	GFile *cache_file = g_file_get_child(builddir_file, "build-cache.ini");
+	g_file_delete(cache_file, NULL, NULL);
+	g_file_delete(input, NULL, NULL);
+	g_file_delete(output, NULL, NULL);
+	g_file_delete(builddir_file, NULL, NULL);
+	g_object_unref(cache_file);
+	g_object_unref(input);
+	g_object_unref(output);
+	g_object_unref(builddir_file);
+	g_free(dir);
+}
+
+static char *
+get_tree_key(GFile *file, GFile *except)
+{
+	GChecksum *key = i7_build_cache_key_new("test");
+	i7_build_cache_key_add_tree_except(key, file, except);
+	char *retval = g_strdup(g_checksum_get_string(key));
+	g_checksum_free(key);
+	return retval;
+}
+
+void
+test_build_cache_tree_except(void)
+{
+	char *dir = g_dir_make_tmp("build-cache-XXXXXX", NULL);
+	g_assert(dir);
+	GFile *materials = g_file_new_for_path(dir);
+	GFile *figure = g_file_get_child(materials, "figure.png");
+	GFile *release = g_file_get_child(materials, "Release");
+	GFile *blorb = g_file_get_child(release, "story.gblorb");
+
+	g_assert(g_file_replace_contents(figure, "abc", 3, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	char *before = get_tree_key(materials, release);
+	char *whole_before = get_tree_key(materials, NULL);
+
+	/* Writing into the excluded folder doesn't change the key */
+	g_assert(g_file_make_directory(release, NULL, NULL));
+	g_assert(g_file_replace_contents(blorb, "xyz", 3, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	char *after = get_tree_key(materials, release);
+	g_assert_cmpstr(before, ==, after);
+	g_free(after);
+	after = get_tree_key(materials, NULL);
+	g_assert_cmpstr(whole_before, !=, after);
+	g_free(after);
+
+	/* Changing anything else does */
+	g_assert(g_file_replace_contents(figure, "abcd", 4, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, NULL));
+	after = get_tree_key(materials, release);
+	g_assert_cmpstr(before, !=, after);
+	g_free(after);
+
+	g_free(before);
+	g_free(whole_before);
+	g_file_delete(blorb, NULL, NULL);
+	g_file_delete(release, NULL, NULL);
+	g_file_delete(figure, NULL, NULL);
+	g_file_delete(materials, NULL, NULL);
+	g_object_unref(blorb);
+	g_object_unref(release);
+	g_object_unref(figure);
+	g_object_unref(materials);
+	g_free(dir);
+}
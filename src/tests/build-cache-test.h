@@ -0,0 +1,30 @@
+/*  Copyright (C) 2015 P. F. Chimento
+ *  This file is part of GNOME Inform 7.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUILD_CACHE_TEST_H
+#define BUILD_CACHE_TEST_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void test_build_cache_lookup(void);
+void test_build_cache_tree_except(void);
+
+G_END_DECLS
+
+#endif /* BUILD_CACHE_TEST_H */
@@ -0,0 +1,78 @@
+/*  Copyright (C) 2015 P. F. Chimento
+ *  This file is part of GNOME Inform 7.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "transcript-diff.h"
+
+void
+test_diff_same(void)
+{
+	GArray *expected_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+	GArray *actual_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	g_assert(word_diff_indices("This text is exactly the same.\n\nCowabunga!\n",
+		"This text is exactly the same.\n\nCowabunga!\n", expected_diffs, actual_diffs));
+	g_assert_cmpuint(expected_diffs->len, ==, 0);
+	g_assert_cmpuint(actual_diffs->len, ==, 0);
+
+	g_array_free(expected_diffs, TRUE);
+	g_array_free(actual_diffs, TRUE);
+}
+
+void
+test_diff_whitespace(void)
+{
+	GArray *expected_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+	GArray *actual_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	g_assert(!word_diff_indices("This text is the same but for whitespace.\n\nCowabunga!\n",
+		"This text is the same but for  whitespace.\n\nCowabunga!\n\n", expected_diffs, actual_diffs));
+	g_assert_cmpuint(expected_diffs->len, ==, 0);
+	g_assert_cmpuint(actual_diffs->len, ==, 0);
+
+	g_array_free(expected_diffs, TRUE);
+	g_array_free(actual_diffs, TRUE);
+}
+
+void
+test_diff_different(void)
+{
+	GArray *expected_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+	GArray *actual_diffs = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	g_assert(!word_diff_indices("This text is not the same at all.\n\nCowabunga!\n",
+		"This text isn't the same at all.\nGeronimo!\n\n", expected_diffs, actual_diffs));
+	g_assert_cmpuint(expected_diffs->len, ==, 3);
+	g_assert_cmpuint(g_array_index(expected_diffs, guint, 0), ==, 2);
+	g_assert_cmpuint(g_array_index(expected_diffs, guint, 1), ==, 3);
+	g_assert_cmpuint(g_array_index(expected_diffs, guint, 2), ==, 8);
+	g_assert_cmpuint(actual_diffs->len, ==, 2);
+	g_assert_cmpuint(g_array_index(actual_diffs, guint, 0), ==, 2);
+	g_assert_cmpuint(g_array_index(actual_diffs, guint, 1), ==, 7);
+
+	g_array_free(expected_diffs, TRUE);
+	g_array_free(actual_diffs, TRUE);
+}
+
+void
+test_diff_markup(void)
+{
+	const guint diffs[] = { 1, 3 };
+	char *markup = make_pango_markup_string_indices("  Fish & chips\n<and> peas ", diffs, 2);
+	g_assert_cmpstr(markup, ==, "  Fish <u>&amp;</u> chips\n<u>&lt;and&gt;</u> peas ");
+	g_free(markup);
+}
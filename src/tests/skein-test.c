@@ -15,8 +15,12 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "skein.h"
+#include "skein-replay.h"
 #include "node.h"
 
 void
@@ -54,4 +58,566 @@ test_skein_import(void)
 
 	g_object_unref(commands_file);
 	g_object_unref(skein);
-}
\ No newline at end of file
+}
+
+void
+test_skein_import_multiple(void)
+{
+	GError *err = NULL;
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	char *script_path = g_build_filename(g_get_tmp_dir(), "skein-import-test.rec", NULL);
+	g_assert(g_file_set_contents(script_path, "  look at wallpaper\n\njump\n", -1, &err));
+	g_assert(err == NULL);
+
+	GFile *commands_file = g_file_new_for_path(TEST_DATA_DIR "commands.rec");
+	GFile *script_file = g_file_new_for_path(script_path);
+	GSList *files = g_slist_prepend(NULL, script_file);
+	files = g_slist_prepend(files, commands_file);
+
+	g_assert(i7_skein_import_files(skein, files, &err));
+	g_assert(err == NULL);
+
+	/* Both scripts start with the same command, so they share that knot */
+	g_assert_cmpuint(g_node_n_children(root->gnode), ==, 1);
+	I7Node *node = root->gnode->children->data;
+	char *command = i7_node_get_command(node);
+	g_assert_cmpstr(command, ==, "look at wallpaper");
+	g_free(command);
+
+	g_assert_cmpuint(g_node_n_children(node->gnode), ==, 2);
+	command = i7_node_get_command(g_node_nth_child(node->gnode, 0)->data);
+	g_assert_cmpstr(command, ==, "stand on couch");
+	g_free(command);
+	command = i7_node_get_command(g_node_nth_child(node->gnode, 1)->data);
+	g_assert_cmpstr(command, ==, "jump");
+	g_free(command);
+
+	/* A file that can't be read leaves the skein untouched */
+	GFile *missing_file = g_file_new_for_path(TEST_DATA_DIR "nonexistent.rec");
+	GSList *bad_files = g_slist_prepend(NULL, missing_file);
+	bad_files = g_slist_prepend(bad_files, commands_file);
+	g_assert(!i7_skein_import_files(skein, bad_files, &err));
+	g_assert(err != NULL);
+	g_clear_error(&err);
+	g_assert_cmpuint(g_node_n_children(node->gnode), ==, 2);
+
+	g_unlink(script_path);
+	g_free(script_path);
+	g_slist_free(bad_files);
+	g_slist_free(files);
+	g_object_unref(missing_file);
+	g_object_unref(script_file);
+	g_object_unref(commands_file);
+	g_object_unref(skein);
+}
+
+void
+test_skein_save_load(void)
+{
+	GError *err = NULL;
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	GString *long_text = g_string_new("");
+	int count;
+
+	for(count = 0; count < 200; count++)
+		g_string_append_printf(long_text, "You can't go that way. (%d)\r\n", count);
+
+	I7Node *first = i7_skein_add_new(skein, root);
+	i7_node_set_command(first, "look");
+	i7_node_set_transcript_text(first, long_text->str);
+	i7_node_bless(first);
+	I7Node *second = i7_skein_add_new(skein, first);
+	i7_node_set_command(second, "x me & you");
+	i7_node_set_transcript_text(second, "As good-looking as ever.");
+
+	char *filename = g_build_filename(g_get_tmp_dir(), "i7-skein-test.skein", NULL);
+	GFile *file = g_file_new_for_path(filename);
+	g_assert(i7_skein_save(skein, file, &err));
+	g_assert(err == NULL);
+
+	I7Skein *loaded = i7_skein_new();
+	g_assert(i7_skein_load(loaded, file, &err));
+	g_assert(err == NULL);
+
+	I7Node *node = i7_skein_get_root_node(loaded);
+	g_assert_cmpuint(g_node_n_children(node->gnode), ==, 1);
+	node = node->gnode->children->data;
+	char *command = i7_node_get_command(node);
+	g_assert_cmpstr(command, ==, "look");
+	g_free(command);
+	g_assert_cmpint(i7_node_get_match_type(node), ==, I7_NODE_EXACT_MATCH);
+	char *text = i7_node_get_transcript_text(node);
+	char *orig_text = i7_node_get_transcript_text(first);
+	g_assert_cmpstr(text, ==, orig_text);
+	g_free(text);
+	g_free(orig_text);
+
+	node = node->gnode->children->data;
+	command = i7_node_get_command(node);
+	g_assert_cmpstr(command, ==, "x me & you");
+	g_free(command);
+	text = i7_node_get_transcript_text(node);
+	g_assert_cmpstr(text, ==, "As good-looking as ever.");
+	g_free(text);
+	g_assert(!i7_node_get_blessed(node));
+
+	g_file_delete(file, NULL, NULL);
+	g_object_unref(file);
+	g_free(filename);
+	g_string_free(long_text, TRUE);
+	g_object_unref(loaded);
+	g_object_unref(skein);
+}
+
+void
+test_skein_cache(void)
+{
+	GError *err = NULL;
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	GString *long_text = g_string_new("");
+	int count;
+
+	for(count = 0; count < 200; count++)
+		g_string_append_printf(long_text, "It is pitch dark. (%d)\n", count);
+
+	I7Node *first = i7_skein_add_new(skein, root);
+	i7_node_set_command(first, "light lamp");
+	i7_node_set_transcript_text(first, long_text->str);
+	i7_node_bless(first);
+	i7_node_set_label(first, "Darkness");
+	i7_node_set_score(first, 5);
+
+	char *filename = g_build_filename(g_get_tmp_dir(), "i7-skein-cache-test.skein", NULL);
+	char *cache_filename = g_build_filename(g_get_tmp_dir(), "i7-skein-cache-test.cache", NULL);
+	GFile *file = g_file_new_for_path(filename);
+	GFile *cache_file = g_file_new_for_path(cache_filename);
+	i7_skein_set_cache_file(skein, cache_file);
+	g_assert(i7_skein_save(skein, file, &err));
+	g_assert(err == NULL);
+	g_assert(g_file_query_exists(cache_file, NULL));
+
+	/* Should be read from the cache */
+	I7Skein *loaded = i7_skein_new();
+	i7_skein_set_cache_file(loaded, cache_file);
+	g_assert(i7_skein_load(loaded, file, &err));
+	g_assert(err == NULL);
+
+	I7Node *node = i7_skein_get_root_node(loaded);
+	g_assert_cmpuint(g_node_n_children(node->gnode), ==, 1);
+	node = node->gnode->children->data;
+	char *command = i7_node_get_command(node);
+	g_assert_cmpstr(command, ==, "light lamp");
+	g_free(command);
+	char *label = i7_node_get_label(node);
+	g_assert_cmpstr(label, ==, "Darkness");
+	g_free(label);
+	g_assert(i7_node_get_locked(node));
+	g_assert_cmpint(i7_node_get_score(node), ==, 5);
+	g_assert(i7_node_get_blessed(node));
+	g_assert_cmpint(i7_node_get_match_type(node), ==, I7_NODE_EXACT_MATCH);
+	char *text = i7_node_get_expected_text(node);
+	g_assert_cmpstr(text, ==, long_text->str);
+	g_free(text);
+	g_object_unref(loaded);
+
+	/* Change the skein file behind the cache's back; the cache should be
+	 ignored */
+	i7_skein_set_cache_file(skein, NULL);
+	i7_node_set_command(first, "rub lamp");
+	g_assert(i7_skein_save(skein, file, &err));
+	g_assert(err == NULL);
+
+	loaded = i7_skein_new();
+	i7_skein_set_cache_file(loaded, cache_file);
+	g_assert(i7_skein_load(loaded, file, &err));
+	g_assert(err == NULL);
+	node = i7_skein_get_root_node(loaded)->gnode->children->data;
+	command = i7_node_get_command(node);
+	g_assert_cmpstr(command, ==, "rub lamp");
+	g_free(command);
+
+	g_file_delete(file, NULL, NULL);
+	g_file_delete(cache_file, NULL, NULL);
+	g_object_unref(file);
+	g_object_unref(cache_file);
+	g_free(filename);
+	g_free(cache_filename);
+	g_string_free(long_text, TRUE);
+	g_object_unref(loaded);
+	g_object_unref(skein);
+}
+
+void
+test_skein_find_child(void)
+{
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	I7Node *nodes[20];
+	int count;
+
+	/* Enough children that the root looks them up in its index */
+	for(count = 0; count < 20; count++) {
+		char *command = g_strdup_printf("go %d", count);
+		nodes[count] = i7_skein_add_new(skein, root);
+		i7_node_set_command(nodes[count], command);
+		g_free(command);
+	}
+	g_assert(i7_node_find_child(root, "go 7") == nodes[7]);
+	g_assert(i7_node_find_child(root, "go 20") == NULL);
+
+	/* Renaming */
+	i7_node_set_command(nodes[7], "wait");
+	g_assert(i7_node_find_child(root, "go 7") == NULL);
+	g_assert(i7_node_find_child(root, "wait") == nodes[7]);
+
+	/* Two children with the same command; the first one wins */
+	i7_node_set_command(nodes[3], "wait");
+	g_assert(i7_node_find_child(root, "wait") == nodes[3]);
+
+	/* Removing */
+	g_assert(i7_skein_remove_all(skein, nodes[3]));
+	g_assert(i7_node_find_child(root, "wait") == nodes[7]);
+	g_assert(i7_skein_remove_single(skein, nodes[7]));
+	g_assert(i7_node_find_child(root, "wait") == NULL);
+
+	g_object_unref(skein);
+}
+
+void
+test_skein_background_diff(void)
+{
+	I7Skein *skein = i7_skein_new();
+	I7Node *node = i7_skein_add_new(skein, i7_skein_get_root_node(skein));
+	GString *transcript = g_string_new("");
+	GString *expected = g_string_new("");
+	int count;
+
+	for(count = 0; count < 200; count++) {
+		g_string_append_printf(transcript, "You see %d bottles of beer.\n", count);
+		g_string_append_printf(expected, "You see %d bottles of %s.\n", count, count == 100? "wine" : "beer");
+	}
+
+	/* Long texts get compared in the background */
+	i7_node_set_transcript_text(node, expected->str);
+	i7_node_bless(node);
+	i7_node_set_transcript_text(node, transcript->str);
+	g_assert_cmpint(i7_node_get_match_type(node), ==, I7_NODE_DIFF_PENDING);
+	g_assert(!i7_node_get_different(node));
+	while(i7_node_get_match_type(node) == I7_NODE_DIFF_PENDING)
+		g_main_context_iteration(NULL, TRUE);
+	g_assert_cmpint(i7_node_get_match_type(node), ==, I7_NODE_NO_MATCH);
+	g_assert(i7_node_get_different(node));
+	g_assert(strstr(i7_node_get_expected_pango_string(node), "<u>wine</u>") != NULL);
+
+	/* Comparing the same texts again comes out the same */
+	i7_node_set_transcript_text(node, expected->str);
+	i7_node_set_transcript_text(node, transcript->str);
+	while(i7_node_get_match_type(node) == I7_NODE_DIFF_PENDING)
+		g_main_context_iteration(NULL, TRUE);
+	g_assert_cmpint(i7_node_get_match_type(node), ==, I7_NODE_NO_MATCH);
+
+	g_string_free(transcript, TRUE);
+	g_string_free(expected, TRUE);
+	g_object_unref(skein);
+}
+
+typedef struct {
+	int knots;
+	gboolean finished;
+} ReplayTestData;
+
+static void
+on_replay_knot(I7Skein *skein, I7Node *node, gdouble seconds, ReplayTestData *data)
+{
+	g_assert_cmpfloat(seconds, >=, 0.0);
+	data->knots++;
+}
+
+static void
+on_replay_finished(I7Skein *skein, GError *error, ReplayTestData *data)
+{
+	g_assert_no_error(error);
+	data->finished = TRUE;
+}
+
+void
+test_skein_replay(void)
+{
+	GError *err = NULL;
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	I7Node *look = i7_skein_add_new(skein, root);
+	I7Node *wait = i7_skein_add_new(skein, look);
+	I7Node *jump = i7_skein_add_new(skein, root);
+	I7Node *unblessed = i7_skein_add_new(skein, jump);
+	ReplayTestData data = { 0, FALSE };
+
+	/* Commands are stored escaped, the way i7_skein_new_command() does it */
+	char *escaped = g_strescape("say \"café\"", "\"");
+	i7_node_set_command(look, escaped);
+	g_free(escaped);
+	i7_node_set_command(wait, "wait");
+	i7_node_set_command(jump, "-jump");
+	i7_node_set_command(unblessed, "sing");
+	i7_node_bless(wait);
+	i7_node_bless(jump);
+
+	/* Stand-in for i7-replay that answers each command by echoing it */
+	char *filename = g_build_filename(g_get_tmp_dir(), "i7-replay-test.sh", NULL);
+	g_file_set_contents(filename, "#!/bin/sh\n"
+		"shift 2\n"
+		"printf 'T\\tWelcome\\\\n\\n'\n"
+		"for cmd in \"$@\"; do printf 'C\\t%s\\tYou %s.\\n' \"$cmd\" \"$cmd\"; done\n",
+		-1, &err);
+	g_assert_no_error(err);
+	g_assert_cmpint(g_chmod(filename, 0755), ==, 0);
+	GFile *helper = g_file_new_for_path(filename);
+
+	i7_skein_replay_blessed_threads(skein, helper, helper, FALSE, 1,
+		(I7SkeinReplayKnotFunc)on_replay_knot,
+		(I7SkeinReplayFunc)on_replay_finished, &data);
+	while(!data.finished)
+		g_main_context_iteration(NULL, TRUE);
+	/* The root knot is shared, but only reported once */
+	g_assert_cmpint(data.knots, ==, 4);
+
+	char *text = i7_node_get_transcript_text(root);
+	g_assert_cmpstr(text, ==, "Welcome\n");
+	g_free(text);
+	/* The interpreter gets the command as it was typed */
+	text = i7_node_get_transcript_text(look);
+	g_assert_cmpstr(text, ==, "You say \"café\".");
+	g_free(text);
+	text = i7_node_get_transcript_text(wait);
+	g_assert_cmpstr(text, ==, "You wait.");
+	g_free(text);
+	text = i7_node_get_transcript_text(jump);
+	g_assert_cmpstr(text, ==, "You -jump.");
+	g_free(text);
+	text = i7_node_get_transcript_text(unblessed);
+	g_assert_cmpstr(text, ==, "");
+	g_free(text);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_object_unref(helper);
+	g_object_unref(skein);
+}
+
+static void
+on_row_inserted(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, int *count)
+{
+	(*count)++;
+}
+
+static void
+on_row_deleted(GtkTreeModel *model, GtkTreePath *path, int *count)
+{
+	(*count)++;
+}
+
+void
+test_skein_thread_model(void)
+{
+	I7Skein *skein = i7_skein_new();
+	GtkTreeModel *model = GTK_TREE_MODEL(skein);
+	I7Node *root = i7_skein_get_root_node(skein);
+	I7Node *a = i7_skein_add_new(skein, root);
+	I7Node *b = i7_skein_add_new(skein, a);
+	I7Node *c = i7_skein_add_new(skein, root);
+	int inserted = 0, deleted = 0;
+	GtkTreeIter iter;
+
+	i7_skein_set_current_node(skein, b);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(model, NULL), ==, 3);
+	g_assert(i7_skein_is_node_in_current_thread(skein, a));
+	g_assert(!i7_skein_is_node_in_current_thread(skein, c));
+
+	/* Only the rows below the common part of the two threads change */
+	g_signal_connect(skein, "row-inserted", G_CALLBACK(on_row_inserted), &inserted);
+	g_signal_connect(skein, "row-deleted", G_CALLBACK(on_row_deleted), &deleted);
+	i7_skein_set_current_node(skein, c);
+	g_assert_cmpint(deleted, ==, 2);
+	g_assert_cmpint(inserted, ==, 1);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(model, NULL), ==, 2);
+
+	g_assert(gtk_tree_model_iter_nth_child(model, &iter, NULL, 1));
+	I7Node *node;
+	gtk_tree_model_get(model, &iter, I7_SKEIN_COLUMN_NODE_PTR, &node, -1);
+	g_assert(node == c);
+	g_object_unref(node);
+	GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+	g_assert_cmpint(gtk_tree_path_get_indices(path)[0], ==, 1);
+	gtk_tree_path_free(path);
+	g_assert(!gtk_tree_model_iter_next(model, &iter));
+
+	/* Adding a knot at the bottom of the thread adds one row */
+	inserted = deleted = 0;
+	i7_skein_add_new(skein, c);
+	g_assert_cmpint(deleted, ==, 0);
+	g_assert_cmpint(inserted, ==, 1);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(model, NULL), ==, 3);
+
+	g_object_unref(skein);
+}
+
+static void
+count_signal(I7Skein *skein, int *count)
+{
+	(*count)++;
+}
+
+void
+test_skein_batch(void)
+{
+	I7Skein *skein = i7_skein_new();
+	GtkTreeModel *model = GTK_TREE_MODEL(skein);
+	I7Node *root = i7_skein_get_root_node(skein);
+	int layouts = 0, modifications = 0, inserted = 0;
+
+	g_signal_connect(skein, "needs-layout", G_CALLBACK(count_signal), &layouts);
+	g_signal_connect(skein, "modified", G_CALLBACK(count_signal), &modifications);
+	g_signal_connect(skein, "row-inserted", G_CALLBACK(on_row_inserted), &inserted);
+
+	i7_skein_begin_batch(skein);
+	I7Node *a = i7_skein_add_new(skein, root);
+	i7_node_set_command(a, "north");
+	I7Node *b = i7_skein_add_new(skein, a);
+	i7_node_set_command(b, "south");
+	i7_skein_set_current_node(skein, b);
+	i7_skein_begin_batch(skein);
+	i7_skein_add_new(skein, root);
+	i7_skein_end_batch(skein);
+	g_assert(i7_skein_is_node_in_current_thread(skein, a));
+	g_assert_cmpint(layouts, ==, 0);
+	g_assert_cmpint(modifications, ==, 0);
+	g_assert_cmpint(inserted, ==, 0);
+	i7_skein_end_batch(skein);
+
+	g_assert_cmpint(layouts, ==, 1);
+	g_assert_cmpint(modifications, ==, 1);
+	g_assert_cmpint(inserted, ==, 2);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(model, NULL), ==, 3);
+
+	g_object_unref(skein);
+}
+
+static void
+on_show_node(I7Skein *skein, I7SkeinShowNodeReason why, I7Node *node, I7Node **shown)
+{
+	g_assert(*shown == NULL);
+	*shown = node;
+}
+
+void
+test_skein_batch_commands(void)
+{
+	I7Skein *skein = i7_skein_new();
+	I7Node *shown = NULL;
+	int layouts = 0;
+
+	g_signal_connect(skein, "needs-layout", G_CALLBACK(count_signal), &layouts);
+	g_signal_connect(skein, "show-node", G_CALLBACK(on_show_node), &shown);
+
+	i7_skein_begin_batch(skein);
+	i7_skein_new_command(skein, "north");
+	I7Node *last = i7_skein_new_command(skein, "south");
+	g_assert(shown == NULL);
+	i7_skein_end_batch(skein);
+
+	/* Only the last knot played is shown, once */
+	g_assert(shown == last);
+	g_assert_cmpint(layouts, ==, 1);
+	g_assert(i7_skein_get_played_node(skein) == last);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(GTK_TREE_MODEL(skein), NULL), ==, 3);
+
+	g_object_unref(skein);
+}
+
+void
+test_skein_trim(void)
+{
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	I7Node *a = i7_skein_add_new(skein, root);
+	I7Node *b = i7_skein_add_new(skein, root);
+	I7Node *c = i7_skein_add_new(skein, b);
+	I7Node *d = i7_skein_add_new(skein, root);
+	i7_node_set_score(a, 3);
+	i7_node_set_score(b, 2);
+	i7_node_set_score(c, 1);
+	i7_node_set_locked(d, TRUE);
+	i7_skein_set_current_node(skein, c);
+
+	/* Keeping the one highest score trims everything scoring 2 or less */
+	i7_skein_trim(skein, root, 1);
+
+	g_assert_cmpuint(g_node_n_children(root->gnode), ==, 2);
+	g_assert(g_node_child_index(root->gnode, a) != -1);
+	g_assert(g_node_child_index(root->gnode, d) != -1);
+	g_assert(i7_skein_get_current_node(skein) == root);
+	g_assert(i7_skein_get_played_node(skein) == root);
+	g_assert_cmpint(gtk_tree_model_iter_n_children(GTK_TREE_MODEL(skein), NULL), ==, 1);
+
+	g_object_unref(skein);
+}
+
+static I7Node *
+add_blessed_knot(I7Skein *skein, I7Node *parent, const char *transcript)
+{
+	I7Node *node = i7_skein_add_new(skein, parent);
+	i7_node_set_transcript_text(node, transcript);
+	i7_skein_bless(skein, node, FALSE);
+	return node;
+}
+
+void
+test_skein_differences(void)
+{
+	I7Skein *skein = i7_skein_new();
+	I7Node *root = i7_skein_get_root_node(skein);
+	I7Node *a = add_blessed_knot(skein, root, "You go north.");
+	I7Node *c = add_blessed_knot(skein, a, "You go south.");
+	I7Node *b = add_blessed_knot(skein, root, "You go west.");
+	int changes = 0;
+
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_EXPECTED), ==, 0);
+	g_signal_connect(skein, "differences-changed", G_CALLBACK(count_signal), &changes);
+
+	i7_node_set_transcript_text(b, "You can't go that way.");
+	i7_node_set_transcript_text(c, "You can't go that way.");
+	g_assert_cmpint(changes, >, 0);
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_EXPECTED), ==, 2);
+
+	/* The differences are visited in pre-order: root, a, c, b */
+	g_assert(i7_skein_get_next_difference(skein, NULL, I7_SKEIN_DIFFERENCE_EXPECTED) == c);
+	g_assert(i7_skein_get_next_difference(skein, a, I7_SKEIN_DIFFERENCE_EXPECTED) == c);
+	g_assert(i7_skein_get_next_difference(skein, c, I7_SKEIN_DIFFERENCE_EXPECTED) == b);
+	g_assert(i7_skein_get_next_difference(skein, b, I7_SKEIN_DIFFERENCE_EXPECTED) == NULL);
+	g_assert(i7_skein_get_previous_difference(skein, b, I7_SKEIN_DIFFERENCE_EXPECTED) == c);
+	g_assert(i7_skein_get_previous_difference(skein, c, I7_SKEIN_DIFFERENCE_EXPECTED) == NULL);
+	g_assert(i7_skein_get_previous_difference(skein, NULL, I7_SKEIN_DIFFERENCE_EXPECTED) == b);
+
+	i7_node_set_transcript_text(c, "You go south.");
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_EXPECTED), ==, 1);
+	g_assert(i7_skein_get_next_difference(skein, NULL, I7_SKEIN_DIFFERENCE_EXPECTED) == b);
+
+	/* Knots added after the index was built go into it in the right place */
+	I7Node *d = add_blessed_knot(skein, c, "You go up.");
+	i7_node_set_transcript_text(d, "You can't go that way.");
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_EXPECTED), ==, 2);
+	g_assert(i7_skein_get_next_difference(skein, c, I7_SKEIN_DIFFERENCE_EXPECTED) == d);
+	g_assert(i7_skein_get_next_difference(skein, d, I7_SKEIN_DIFFERENCE_EXPECTED) == b);
+	g_assert(i7_skein_get_previous_difference(skein, b, I7_SKEIN_DIFFERENCE_EXPECTED) == d);
+
+	/* Removing a knot takes it out of the index */
+	i7_skein_remove_all(skein, b);
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_EXPECTED), ==, 1);
+	g_assert(i7_skein_get_next_difference(skein, d, I7_SKEIN_DIFFERENCE_EXPECTED) == NULL);
+	g_assert_cmpuint(i7_skein_get_n_differences(skein, I7_SKEIN_DIFFERENCE_CHANGED), ==, 3);
+
+	g_object_unref(skein);
+}
@@ -24,6 +24,17 @@
 G_BEGIN_DECLS
 
 void test_skein_import(void);
+void test_skein_import_multiple(void);
+void test_skein_save_load(void);
+void test_skein_cache(void);
+void test_skein_find_child(void);
+void test_skein_background_diff(void);
+void test_skein_replay(void);
+void test_skein_thread_model(void);
+void test_skein_batch(void);
+void test_skein_batch_commands(void);
+void test_skein_trim(void);
+void test_skein_differences(void);
 
 G_END_DECLS
 
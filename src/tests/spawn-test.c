@@ -0,0 +1,145 @@
+/*  Copyright (C) 2015 P. F. Chimento
+ *  This file is part of GNOME Inform 7.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include "spawn.h"
+
+static void
+collect_line(GPtrArray *lines, char *line)
+{
+	g_ptr_array_add(lines, g_strdup(line));
+}
+
+static void
+on_child_exit(GPid pid, int status, gboolean *done)
+{
+	g_spawn_close_pid(pid);
+	*done = TRUE;
+}
+
+static void
+wait_for_child(GPid pid)
+{
+	gboolean done = FALSE;
+	g_assert(pid != 0);
+	g_child_watch_add(pid, (GChildWatchFunc)on_child_exit, &done);
+	while(!done)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+static char *
+get_buffer_text(GtkTextBuffer *buffer)
+{
+	GtkTextIter start, end;
+	gtk_text_buffer_get_bounds(buffer, &start, &end);
+	return gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+}
+
+void
+test_spawn_lines(void)
+{
+	GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+	GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+	GFile *wd = g_file_new_for_path(g_get_tmp_dir());
+	/* A progress message that arrives in two pieces, and a last line without
+	 a newline */
+	char *argv[] = { "sh", "-c",
+		"printf ' ++ 5' >&2; sleep 0.2; printf '0%% (Binding)\\nDone' >&2",
+		NULL };
+
+	wait_for_child(run_command_hook(wd, argv, buffer,
+		(IOHookFunc *)collect_line, lines, FALSE, TRUE));
+
+	g_assert_cmpuint(lines->len, ==, 2);
+	g_assert_cmpstr(lines->pdata[0], ==, " ++ 50% (Binding)");
+	g_assert_cmpstr(lines->pdata[1], ==, "Done");
+
+	/* All the output is in the buffer by the time the command has exited */
+	char *text = get_buffer_text(buffer);
+	g_assert(g_str_has_suffix(text, " ++ 50% (Binding)\nDone\n"));
+	g_free(text);
+
+	g_object_unref(wd);
+	g_ptr_array_free(lines, TRUE);
+	g_object_unref(buffer);
+}
+
+void
+test_spawn_chunks(void)
+{
+	GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+	GPtrArray *chunks = g_ptr_array_new_with_free_func(g_free);
+	GFile *wd = g_file_new_for_path(g_get_tmp_dir());
+	/* Progress marks like the ones the I6 compiler prints, without newlines */
+	char *argv[] = { "sh", "-c", "printf '#'; sleep 0.2; printf '#\\n'", NULL };
+
+	wait_for_child(run_command_chunk_hook(wd, argv, buffer,
+		(IOHookFunc *)collect_line, chunks, TRUE, FALSE));
+
+	/* The first mark arrives before the line is finished */
+	g_assert_cmpuint(chunks->len, ==, 2);
+	g_assert_cmpstr(chunks->pdata[0], ==, "#");
+	g_assert_cmpstr(chunks->pdata[1], ==, "#\n");
+
+	char *text = get_buffer_text(buffer);
+	g_assert(g_str_has_suffix(text, "\n##\n"));
+	g_free(text);
+
+	g_object_unref(wd);
+	g_ptr_array_free(chunks, TRUE);
+	g_object_unref(buffer);
+}
+
+void
+test_spawn_long_lines(void)
+{
+	GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+	GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+	GFile *wd = g_file_new_for_path(g_get_tmp_dir());
+	/* A line longer than the longest line spawn.c waits for, whose last
+	 character straddles the length limit */
+	char *argv[] = { "sh", "-c", "printf '%04095d\\303\\251\\n' 0", NULL };
+
+	wait_for_child(run_command_hook(wd, argv, buffer,
+		(IOHookFunc *)collect_line, lines, TRUE, FALSE));
+
+	char *zeroes = g_strnfill(4095, '0');
+	char *expected = g_strconcat(zeroes, "\303\251", NULL);
+	g_free(zeroes);
+	GString *joined = g_string_new("");
+	unsigned ix;
+	for(ix = 0; ix < lines->len; ix++) {
+		g_assert(g_utf8_validate(lines->pdata[ix], -1, NULL));
+		g_string_append(joined, lines->pdata[ix]);
+	}
+	g_assert_cmpstr(joined->str, ==, expected);
+	g_string_free(joined, TRUE);
+
+	/* No newline is added where the line was split */
+	char *text = get_buffer_text(buffer);
+	char *expected_end = g_strconcat("\n", expected, "\n", NULL);
+	g_assert(g_str_has_suffix(text, expected_end));
+	g_free(expected_end);
+	g_free(text);
+	g_free(expected);
+
+	g_object_unref(wd);
+	g_ptr_array_free(lines, TRUE);
+	g_object_unref(buffer);
+}
@@ -19,8 +19,12 @@
 #include <gtk/gtk.h>
 #include "app.h"
 #include "app-test.h"
+#include "build-cache-test.h"
+#include "diff-test.h"
 #include "skein-test.h"
+#include "spawn-test.h"
 #include "story-test.h"
+#include "timeline-test.h"
 
 int
 main(int argc, char **argv)
@@ -36,7 +40,30 @@ main(int argc, char **argv)
 	g_test_add_func("/app/colorscheme/install-remove", test_app_colorscheme_install_remove);
 	g_test_add_func("/app/colorscheme/get-current", test_app_colorscheme_get_current);
 
+	g_test_add_func("/build-cache/lookup", test_build_cache_lookup);
+	g_test_add_func("/build-cache/tree-except", test_build_cache_tree_except);
+
+	g_test_add_func("/diff/same", test_diff_same);
+	g_test_add_func("/diff/whitespace", test_diff_whitespace);
+	g_test_add_func("/diff/different", test_diff_different);
+	g_test_add_func("/diff/markup", test_diff_markup);
+
 	g_test_add_func("/skein/import", test_skein_import);
+	g_test_add_func("/skein/import-multiple", test_skein_import_multiple);
+	g_test_add_func("/skein/save-load", test_skein_save_load);
+	g_test_add_func("/skein/cache", test_skein_cache);
+	g_test_add_func("/skein/find-child", test_skein_find_child);
+	g_test_add_func("/skein/background-diff", test_skein_background_diff);
+	g_test_add_func("/skein/replay", test_skein_replay);
+	g_test_add_func("/skein/thread-model", test_skein_thread_model);
+	g_test_add_func("/skein/batch", test_skein_batch);
+	g_test_add_func("/skein/batch-commands", test_skein_batch_commands);
+	g_test_add_func("/skein/trim", test_skein_trim);
+	g_test_add_func("/skein/differences", test_skein_differences);
+
+	g_test_add_func("/spawn/lines", test_spawn_lines);
+	g_test_add_func("/spawn/chunks", test_spawn_chunks);
+	g_test_add_func("/spawn/long-lines", test_spawn_long_lines);
 
 	g_test_add_func("/story/util/files-are-siblings", test_files_are_siblings);
 	g_test_add_func("/story/util/files-are-not-siblings", test_files_are_not_siblings);
@@ -44,6 +71,9 @@ main(int argc, char **argv)
 	g_test_add_func("/story/old-materials-file", test_story_old_materials_file);
 	g_test_add_func("/story/renames-materials-file", test_story_renames_materials_file);
 
+	g_test_add_func("/timeline/stages", test_timeline_stages);
+	g_test_add_func("/timeline/save", test_timeline_save);
+
 	int retval = g_test_run();
 
 	return retval;
@@ -0,0 +1,104 @@
+/*  Copyright (C) 2015 P. F. Chimento
+ *  This file is part of GNOME Inform 7.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "timeline.h"
+
+static unsigned
+count_timings(GFile *file)
+{
+	char *contents;
+	g_assert(g_file_load_contents(file, NULL, &contents, NULL, NULL, NULL));
+	unsigned count = 0;
+	char *ptr;
+	for(ptr = strstr(contents, "{\"id\""); ptr; ptr = strstr(ptr + 1, "{\"id\""))
+		count++;
+	g_free(contents);
+	return count;
+}
+
+void
+test_timeline_stages(void)
+{
+	I7Timeline *timeline = i7_timeline_new();
+	i7_timeline_begin_stage(timeline, "ni");
+	i7_timeline_begin_stage(timeline, "index");
+	g_assert(i7_timeline_end_stage(timeline, "ni", TRUE));
+	g_assert(!i7_timeline_end_stage(timeline, "ni", FALSE));
+	g_assert_cmpuint(i7_timeline_get_n_stages(timeline), ==, 2);
+	g_assert(i7_timeline_get_stage(timeline, 0)->cached);
+	g_assert_cmpint(i7_timeline_get_stage(timeline, 1)->end, ==, -1);
+
+	/* A stage that was stopped can be taken out again */
+	i7_timeline_begin_stage(timeline, "debug-log");
+	g_assert(i7_timeline_cancel_stage(timeline, "debug-log"));
+	g_assert(!i7_timeline_cancel_stage(timeline, "ni"));
+	g_assert_cmpuint(i7_timeline_get_n_stages(timeline), ==, 2);
+
+	/* Stages that haven't finished are left out */
+	char *json = i7_timeline_to_json(timeline);
+	g_assert(strstr(json, "\"name\": \"ni\""));
+	g_assert(strstr(json, "\"cached\": true"));
+	g_assert(!strstr(json, "index"));
+	g_free(json);
+
+	i7_timeline_free(timeline);
+}
+
+void
+test_timeline_save(void)
+{
+	char *dir = g_dir_make_tmp("timings-XXXXXX", NULL);
+	g_assert(dir);
+	GFile *dir_file = g_file_new_for_path(dir);
+	GFile *file = g_file_get_child(dir_file, "timings.json");
+
+	I7Timeline *timeline = i7_timeline_new();
+	i7_timeline_begin_stage(timeline, "ni");
+	i7_timeline_begin_stage(timeline, "index");
+	g_assert(i7_timeline_end_stage(timeline, "ni", TRUE));
+	I7Timeline *other = i7_timeline_new();
+	g_assert_cmpstr(i7_timeline_get_id(timeline), !=, i7_timeline_get_id(other));
+	i7_timeline_free(other);
+
+	/* Saving the same timeline again replaces it */
+	g_assert(i7_timeline_save(timeline, file, NULL));
+	g_assert(i7_timeline_end_stage(timeline, "index", FALSE));
+	g_assert(i7_timeline_save(timeline, file, NULL));
+	g_assert_cmpuint(count_timings(file), ==, 1);
+	i7_timeline_free(timeline);
+
+	/* Only the most recent timelines are kept; timelines started at the same
+	 moment are still told apart */
+	int count;
+	for(count = 0; count < 25; count++) {
+		timeline = i7_timeline_new();
+		g_assert(i7_timeline_save(timeline, file, NULL));
+		i7_timeline_free(timeline);
+	}
+	g_assert_cmpuint(count_timings(file), ==, 20);
+
+	g_file_delete(file, NULL, NULL);
+	g_file_delete(dir_file, NULL, NULL);
+	g_object_unref(file);
+	g_object_unref(dir_file);
+	g_free(dir);
+}
+
@@ -0,0 +1,141 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <pango/pango.h>
+
+#include "text-extents.h"
+
+/* A cache of the pixel sizes of laid out text, so that GTK asking again and
+ again for the size of the same rows while scrolling doesn't lay out the same
+ transcripts again and again. The least recently used sizes are forgotten once
+ there are more than MAX_ENTRIES. The cache is only used from the main thread. */
+
+#define MAX_ENTRIES 512
+
+typedef struct {
+	guint hash;
+	char *text;
+	gboolean markup;
+	PangoFontDescription *font;
+	int width; /* wrap width in Pango units, or -1 */
+	PangoRectangle rect;
+	GList *link; /* this entry's place in the LRU queue */
+} Extents;
+
+static GHashTable *cache = NULL;
+static GQueue lru = G_QUEUE_INIT; /* most recently used first */
+
+static guint
+extents_hash(const Extents *extents)
+{
+	return extents->hash;
+}
+
+static gboolean
+extents_equal(const Extents *a, const Extents *b)
+{
+	return a->width == b->width
+		&& a->markup == b->markup
+		&& strcmp(a->text, b->text) == 0
+		&& pango_font_description_equal(a->font, b->font);
+}
+
+static void
+extents_free(Extents *extents)
+{
+	g_free(extents->text);
+	pango_font_description_free(extents->font);
+	g_slice_free(Extents, extents);
+}
+
+/*
+ * i7_text_extents_get:
+ * @context: the Pango context the text would be laid out in
+ * @text: the text to measure
+ * @markup: whether @text is Pango markup
+ * @width: the width to wrap the text at, in Pango units, or -1 not to wrap
+ * @rect: return location for the logical extents of the text, in pixels
+ *
+ * Measures @text as it would be laid out in @context's font, wrapped at word
+ * or character boundaries. Sizes of text that has been measured recently are
+ * remembered.
+ */
+void
+i7_text_extents_get(PangoContext *context, const char *text, gboolean markup, int width, PangoRectangle *rect)
+{
+	if(text == NULL)
+		text = "";
+
+	if(cache == NULL)
+		cache = g_hash_table_new_full((GHashFunc)extents_hash, (GEqualFunc)extents_equal, (GDestroyNotify)extents_free, NULL);
+
+	Extents key;
+	key.text = (char *)text;
+	key.markup = markup;
+	key.font = pango_context_get_font_description(context);
+	key.width = width;
+	key.hash = g_str_hash(text) ^ pango_font_description_hash(key.font) ^ (guint)width ^ (markup? 1 : 0);
+
+	Extents *extents = g_hash_table_lookup(cache, &key);
+	if(extents) {
+		g_queue_unlink(&lru, extents->link);
+		g_queue_push_head_link(&lru, extents->link);
+		*rect = extents->rect;
+		return;
+	}
+
+	PangoLayout *layout = pango_layout_new(context);
+	if(markup)
+		pango_layout_set_markup(layout, text, -1);
+	else
+		pango_layout_set_text(layout, text, -1);
+	pango_layout_set_width(layout, width);
+	pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
+	pango_layout_get_pixel_extents(layout, NULL, rect);
+	g_object_unref(layout);
+
+	extents = g_slice_new(Extents);
+	*extents = key;
+	extents->text = g_strdup(text);
+	extents->font = pango_font_description_copy(key.font);
+	extents->rect = *rect;
+	g_queue_push_head(&lru, extents);
+	extents->link = lru.head;
+	g_hash_table_add(cache, extents);
+
+	if(lru.length > MAX_ENTRIES)
+		g_hash_table_remove(cache, g_queue_pop_tail(&lru));
+}
+
+/*
+ * i7_text_extents_clear:
+ *
+ * Forgets all the remembered sizes; call this when the fonts change.
+ */
+void
+i7_text_extents_clear(void)
+{
+	if(cache == NULL)
+		return;
+	g_queue_clear(&lru);
+	g_hash_table_remove_all(cache);
+}
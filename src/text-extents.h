@@ -0,0 +1,29 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEXT_EXTENTS_H_
+#define _TEXT_EXTENTS_H_
+
+#include "config.h"
+
+#include <glib.h>
+#include <pango/pango.h>
+
+void i7_text_extents_get(PangoContext *context, const char *text, gboolean markup, int width, PangoRectangle *rect);
+void i7_text_extents_clear(void);
+
+#endif /* _TEXT_EXTENTS_H_ */
@@ -0,0 +1,246 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "timeline.h"
+
+/* A record of when each stage of compiling and running the story started and
+ how long it took. The records of the last few compiles are kept in a JSON
+ file in the project's Build folder. */
+
+/* Number of compiles to keep in the file */
+#define MAX_HISTORY 20
+/* Each compile is written on one line starting with this, followed by the
+ timeline's ID, so that the history can be read back without a JSON parser */
+#define RECORD_START "{\"id\": \""
+/* Records written before timelines had IDs start with this instead */
+#define OLD_RECORD_START "{\"started\": "
+
+struct _I7Timeline {
+	char *id;
+	GDateTime *started;
+	gint64 origin; /* monotonic time when the timeline started */
+	GArray *stages;
+};
+
+/*
+ * i7_timeline_new:
+ *
+ * Starts a new timeline, with the clock running from now.
+ *
+ * Returns: (transfer full): a new #I7Timeline.
+ */
+I7Timeline *
+i7_timeline_new(void)
+{
+	I7Timeline *timeline = g_slice_new0(I7Timeline);
+	/* The start time doesn't tell two compiles apart if they are quick enough */
+	timeline->id = g_strdup_printf("%08x%08x", g_random_int(), g_random_int());
+	timeline->started = g_date_time_new_now_utc();
+	timeline->origin = g_get_monotonic_time();
+	timeline->stages = g_array_new(FALSE, FALSE, sizeof(I7TimelineStage));
+	return timeline;
+}
+
+void
+i7_timeline_free(I7Timeline *timeline)
+{
+	g_free(timeline->id);
+	g_date_time_unref(timeline->started);
+	g_array_free(timeline->stages, TRUE);
+	g_slice_free(I7Timeline, timeline);
+}
+
+/* Records that the stage @name starts now; @name must be a static string */
+void
+i7_timeline_begin_stage(I7Timeline *timeline, const char *name)
+{
+	I7TimelineStage stage = { name, g_get_monotonic_time() - timeline->origin, -1, FALSE };
+	g_array_append_val(timeline->stages, stage);
+}
+
+/*
+ * i7_timeline_end_stage:
+ * @timeline: the timeline
+ * @name: the stage
+ * @cached: whether the stage's work was skipped
+ *
+ * Records that the most recent stage called @name ends now.
+ *
+ * Returns: %TRUE if there was a stage called @name still running.
+ */
+gboolean
+i7_timeline_end_stage(I7Timeline *timeline, const char *name, gboolean cached)
+{
+	guint ix;
+	for(ix = timeline->stages->len; ix > 0; ix--) {
+		I7TimelineStage *stage = &g_array_index(timeline->stages, I7TimelineStage, ix - 1);
+		if(stage->end == -1 && strcmp(stage->name, name) == 0) {
+			stage->end = g_get_monotonic_time() - timeline->origin;
+			stage->cached = cached;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Removes the most recent stage called @name if it is still running, and
+ returns whether there was one */
+gboolean
+i7_timeline_cancel_stage(I7Timeline *timeline, const char *name)
+{
+	guint ix;
+	for(ix = timeline->stages->len; ix > 0; ix--) {
+		I7TimelineStage *stage = &g_array_index(timeline->stages, I7TimelineStage, ix - 1);
+		if(stage->end == -1 && strcmp(stage->name, name) == 0) {
+			g_array_remove_index(timeline->stages, ix - 1);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Returns the string that identifies @timeline in the saved history */
+const char *
+i7_timeline_get_id(I7Timeline *timeline)
+{
+	return timeline->id;
+}
+
+guint
+i7_timeline_get_n_stages(I7Timeline *timeline)
+{
+	return timeline->stages->len;
+}
+
+const I7TimelineStage *
+i7_timeline_get_stage(I7Timeline *timeline, guint index)
+{
+	g_return_val_if_fail(index < timeline->stages->len, NULL);
+	return &g_array_index(timeline->stages, I7TimelineStage, index);
+}
+
+/* Returns the time from the start of the timeline to the end of the last
+ stage that finished, in microseconds */
+gint64
+i7_timeline_get_duration(I7Timeline *timeline)
+{
+	gint64 retval = 0;
+	guint ix;
+	for(ix = 0; ix < timeline->stages->len; ix++)
+		retval = MAX(retval, g_array_index(timeline->stages, I7TimelineStage, ix).end);
+	return retval;
+}
+
+/*
+ * i7_timeline_to_json:
+ * @timeline: the timeline
+ *
+ * Describes the finished stages of @timeline as a JSON object on one line.
+ * Times are given in whole milliseconds.
+ *
+ * Returns: (transfer full): a string.
+ */
+char *
+i7_timeline_to_json(I7Timeline *timeline)
+{
+	char *date = g_date_time_format(timeline->started, "%Y-%m-%dT%H:%M:%S");
+	GString *json = g_string_new(RECORD_START);
+	g_string_append_printf(json, "%s\", \"started\": \"%s.%03dZ\", \"total_ms\": %" G_GINT64_FORMAT ", \"stages\": [",
+		timeline->id, date, g_date_time_get_microsecond(timeline->started) / 1000,
+		i7_timeline_get_duration(timeline) / 1000);
+	g_free(date);
+
+	guint ix;
+	gboolean first = TRUE;
+	for(ix = 0; ix < timeline->stages->len; ix++) {
+		I7TimelineStage *stage = &g_array_index(timeline->stages, I7TimelineStage, ix);
+		if(stage->end == -1)
+			continue;
+		/* Stage names are identifiers and don't need escaping */
+		g_string_append_printf(json, "%s{\"name\": \"%s\", \"start_ms\": %" G_GINT64_FORMAT
+			", \"duration_ms\": %" G_GINT64_FORMAT ", \"cached\": %s}",
+			first? "" : ", ", stage->name, stage->start / 1000,
+			(stage->end - stage->start) / 1000, stage->cached? "true" : "false");
+		first = FALSE;
+	}
+	g_string_append(json, "]}");
+	return g_string_free(json, FALSE);
+}
+
+/*
+ * i7_timeline_save:
+ * @timeline: the timeline
+ * @file: the JSON file to write
+ * @error: return location for an error, or %NULL
+ *
+ * Adds @timeline to the history in @file, replacing an earlier version of
+ * the same timeline if it was already saved, and dropping the oldest entries
+ * so that no more than MAX_HISTORY remain.
+ *
+ * Returns: %TRUE if the file was written.
+ */
+gboolean
+i7_timeline_save(I7Timeline *timeline, GFile *file, GError **error)
+{
+	char *record = i7_timeline_to_json(timeline);
+	/* Everything up to the end of the ID identifies the timeline */
+	gsize id_length = strlen(RECORD_START) + strlen(timeline->id) + 1;
+	GPtrArray *history = g_ptr_array_new();
+
+	char *contents;
+	char **lines = NULL;
+	if(g_file_load_contents(file, NULL, &contents, NULL, NULL, NULL)) {
+		lines = g_strsplit(contents, "\n", -1);
+		g_free(contents);
+		char **iter;
+		for(iter = lines; *iter; iter++) {
+			char *line = g_strstrip(*iter);
+			if(!(g_str_has_prefix(line, RECORD_START) || g_str_has_prefix(line, OLD_RECORD_START))
+				|| strncmp(line, record, id_length) == 0)
+				continue;
+			gsize length = strlen(line);
+			if(line[length - 1] == ',')
+				line[length - 1] = '\0';
+			g_ptr_array_add(history, line);
+		}
+	}
+
+	guint first = history->len >= MAX_HISTORY? history->len - MAX_HISTORY + 1 : 0;
+	g_ptr_array_add(history, record);
+	GString *json = g_string_new("{\"history\": [\n");
+	guint ix;
+	for(ix = first; ix < history->len; ix++)
+		g_string_append_printf(json, "%s%s\n", (char *)history->pdata[ix],
+			ix + 1 < history->len? "," : "");
+	g_string_append(json, "]}\n");
+
+	gboolean retval = g_file_replace_contents(file, json->str, json->len, NULL,
+		FALSE, G_FILE_CREATE_NONE, NULL, NULL, error);
+
+	g_string_free(json, TRUE);
+	g_strfreev(lines);
+	g_ptr_array_free(history, TRUE);
+	g_free(record);
+	return retval;
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2015 P. F. Chimento
+ * This file is part of GNOME Inform 7.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+typedef struct _I7Timeline I7Timeline;
+
+typedef struct {
+	const char *name; /* must be a static string */
+	gint64 start; /* microseconds since the timeline started */
+	gint64 end; /* -1 while the stage is running */
+	gboolean cached; /* the stage was skipped, see build-cache.c */
+} I7TimelineStage;
+
+I7Timeline *i7_timeline_new(void);
+void i7_timeline_free(I7Timeline *timeline);
+const char *i7_timeline_get_id(I7Timeline *timeline);
+void i7_timeline_begin_stage(I7Timeline *timeline, const char *name);
+gboolean i7_timeline_end_stage(I7Timeline *timeline, const char *name, gboolean cached);
+gboolean i7_timeline_cancel_stage(I7Timeline *timeline, const char *name);
+guint i7_timeline_get_n_stages(I7Timeline *timeline);
+const I7TimelineStage *i7_timeline_get_stage(I7Timeline *timeline, guint index);
+gint64 i7_timeline_get_duration(I7Timeline *timeline);
+char *i7_timeline_to_json(I7Timeline *timeline);
+gboolean i7_timeline_save(I7Timeline *timeline, GFile *file, GError **error);
+
+#endif /* _TIMELINE_H_ */
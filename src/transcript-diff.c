@@ -17,129 +17,315 @@
 
 #include "config.h"
 
-#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include <glib.h>
 
+/* A word in a text, found without copying it: where it is, and a hash of its
+contents so that most comparisons don't need to look at the text */
+typedef struct {
+	gsize offset;
+	gsize length;
+	guint64 hash;
+} WordSpan;
+
+/* Buffers kept between comparisons, one set per thread, so that comparing
+texts doesn't need to allocate any memory once they are big enough */
+typedef struct {
+	GArray *expected_spans;
+	GArray *actual_spans;
+	ssize_t *work_buffer;
+	gsize work_buffer_size;
+} DiffScratch;
+
+#define IS_WORD_SEPARATOR(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+/* 64-bit FNV-1a */
+#define HASH_INIT G_GUINT64_CONSTANT(14695981039346656037)
+#define HASH_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+static inline gboolean
+spans_equal(const char *x_text, const WordSpan *x, const char *y_text, const WordSpan *y)
+{
+	return x->hash == y->hash
+		&& x->length == y->length
+		&& memcmp(x_text + x->offset, y_text + y->offset, x->length) == 0;
+}
+
 /* Prerequisites for including Gnulib's diffseq algorithm */
 #include <limits.h>
 #include <stdbool.h>
-#define ELEMENT char *
-#define EQUAL(a,b) (strcmp((a), (b)) == 0)
+#define XVECREF_YVECREF_EQUAL(ctxt,xoff,yoff) \
+	spans_equal((ctxt)->expected, (ctxt)->expected_spans + (xoff), \
+		(ctxt)->actual, (ctxt)->actual_spans + (yoff))
 #define OFFSET ssize_t
 #define EXTRA_CONTEXT_FIELDS \
-	GList *expected_diffs; \
-	GList *actual_diffs;
+	const char *expected; \
+	const char *actual; \
+	const WordSpan *expected_spans; \
+	const WordSpan *actual_spans; \
+	GArray *expected_diffs; \
+	GArray *actual_diffs;
 #define NOTE_DELETE(ctxt,xoff) \
 	G_STMT_START { \
-		if(*(xv[(xoff)]) != '\0') { \
-			(ctxt)->expected_diffs = g_list_prepend((ctxt)->expected_diffs, GSIZE_TO_POINTER((xoff))); \
-		} \
+		guint index = (xoff); \
+		g_array_append_val((ctxt)->expected_diffs, index); \
 	} G_STMT_END
 #define NOTE_INSERT(ctxt,yoff) \
 	G_STMT_START { \
-		if(*(yv[(yoff)]) != '\0') { \
-			(ctxt)->actual_diffs = g_list_prepend((ctxt)->actual_diffs, GSIZE_TO_POINTER((yoff))); \
-		} \
+		guint index = (yoff); \
+		g_array_append_val((ctxt)->actual_diffs, index); \
 	} G_STMT_END
 #define USE_HEURISTIC
 #define lint /* To suppress GCC warnings */
 
 #include "diffseq.h"
 
+static void
+free_diff_scratch(DiffScratch *scratch)
+{
+	g_array_free(scratch->expected_spans, TRUE);
+	g_array_free(scratch->actual_spans, TRUE);
+	g_free(scratch->work_buffer);
+	g_slice_free(DiffScratch, scratch);
+}
+
+static GPrivate diff_scratch_key = G_PRIVATE_INIT((GDestroyNotify)free_diff_scratch);
+
+static DiffScratch *
+get_diff_scratch(void)
+{
+	DiffScratch *scratch = g_private_get(&diff_scratch_key);
+	if(!scratch) {
+		scratch = g_slice_new0(DiffScratch);
+		scratch->expected_spans = g_array_new(FALSE, FALSE, sizeof(WordSpan));
+		scratch->actual_spans = g_array_new(FALSE, FALSE, sizeof(WordSpan));
+		g_private_set(&diff_scratch_key, scratch);
+	}
+	return scratch;
+}
+
+/* Finds the words in @text, and hashes them */
+static void
+find_words(const char *text, GArray *spans)
+{
+	const char *ptr = text;
+
+	g_array_set_size(spans, 0);
+	while(TRUE) {
+		while(IS_WORD_SEPARATOR(*ptr))
+			ptr++;
+		if(*ptr == '\0')
+			break;
+
+		WordSpan span;
+		span.offset = ptr - text;
+		span.hash = HASH_INIT;
+		for(; *ptr != '\0' && !IS_WORD_SEPARATOR(*ptr); ptr++)
+			span.hash = (span.hash ^ (guchar)*ptr) * HASH_PRIME;
+		span.length = (ptr - text) - span.offset;
+		g_array_append_val(spans, span);
+	}
+}
+
 /*
- * word_diff:
- * Compares strings @expected and @actual for approximate equality. Returns TRUE
- * if they are _exactly_ equal, FALSE if not. @expected_diffs and @actual_diffs
- * are the return locations for lists of word indices that are different in
- * @expected and @actual. The indices are stored using GSIZE_TO_POINTER().
- * If the function returns FALSE but NULL (the empty list) is returned in
- * @expected_diffs and @actual_diffs, then all the words are the same and
- * therefore the strings only differ by whitespace.
- * You should free the lists when done.
+ * word_diff_indices:
+ * @expected: the expected text
+ * @actual: the actual text
+ * @expected_diffs: a #GArray of guint, which is filled with the indices of
+ * the words in @expected that are not in @actual
+ * @actual_diffs: the same for @actual
+ *
+ * Compares strings @expected and @actual word by word. Words are runs of
+ * characters between spaces, tabs and newlines. The texts are not copied,
+ * and no memory is allocated except to grow the result arrays, so the
+ * caller can reuse them.
+ *
+ * Returns: %TRUE if the strings are _exactly_ equal, %FALSE if not. If %FALSE
+ * is returned but both arrays are empty, then the strings only differ in
+ * whitespace.
  */
 gboolean
-word_diff(const char *expected, const char *actual, GList **expected_diffs, GList **actual_diffs)
+word_diff_indices(const char *expected, const char *actual, GArray *expected_diffs, GArray *actual_diffs)
 {
+	g_array_set_size(expected_diffs, 0);
+	g_array_set_size(actual_diffs, 0);
+
 	/* If strings are exactly the same, we have our answer */
 	if(strcmp(expected, actual) == 0)
 		return TRUE;
 
-	char **expected_words = g_strsplit_set(expected, " \n\r\t", -1);
-	char **actual_words = g_strsplit_set(actual, " \n\r\t", -1);
-	ssize_t expected_limit = 0;
-	ssize_t actual_limit = 0;
-	ssize_t *work_buffer;
-	struct context ctxt;
-	char **iter;
-
-	/* Find lengths of word vectors */
-	for(iter = expected_words; *iter; iter++)
-		expected_limit++;
-	for(iter = actual_words; *iter; iter++)
-		actual_limit++;
+	DiffScratch *scratch = get_diff_scratch();
+	find_words(expected, scratch->expected_spans);
+	find_words(actual, scratch->actual_spans);
+	ssize_t expected_limit = scratch->expected_spans->len;
+	ssize_t actual_limit = scratch->actual_spans->len;
 
-	/* Allocate a work buffer */
-	work_buffer = g_new0(ssize_t, 2 * (expected_limit + actual_limit + 3));
+	gsize work_size = 2 * (expected_limit + actual_limit + 3);
+	if(work_size > scratch->work_buffer_size) {
+		g_free(scratch->work_buffer);
+		scratch->work_buffer = g_new(ssize_t, work_size);
+		scratch->work_buffer_size = work_size;
+	}
 
 	/* Call the Gnulib diff algorithm */
-	ctxt.xvec = expected_words; /* char * const * */
-	ctxt.yvec = actual_words;
-	ctxt.fdiag = work_buffer + actual_limit + 1;
+	struct context ctxt;
+	ctxt.expected = expected;
+	ctxt.actual = actual;
+	ctxt.expected_spans = (const WordSpan *)scratch->expected_spans->data;
+	ctxt.actual_spans = (const WordSpan *)scratch->actual_spans->data;
+	ctxt.expected_diffs = expected_diffs;
+	ctxt.actual_diffs = actual_diffs;
+	ctxt.fdiag = scratch->work_buffer + actual_limit + 1;
 	ctxt.bdiag = ctxt.fdiag + expected_limit + actual_limit + 3;
-	ctxt.expected_diffs = *expected_diffs;
-	ctxt.actual_diffs = *actual_diffs;
 	ctxt.heuristic = TRUE;
 	compareseq(0, expected_limit, 0, actual_limit, &ctxt);
 
-	g_strfreev(expected_words);
-	g_strfreev(actual_words);
-	g_free(work_buffer);
-
-	*expected_diffs = g_list_reverse(ctxt.expected_diffs);
-	*actual_diffs = g_list_reverse(ctxt.actual_diffs);
-
 	return FALSE;
 }
 
-char *
-make_pango_markup_string(const char *string, GList *diffs)
+/* Appends @len bytes of @text to @string, escaped like g_markup_escape_text()
+does, without making a copy first */
+static void
+append_escaped(GString *string, const char *text, gsize len)
 {
-	if(diffs == NULL)
-		return g_strdup(string);
+	const char *end = text + len;
+	for(; text < end; text++) {
+		guchar c = *text;
+		switch(c) {
+			case '&':
+				g_string_append(string, "&amp;");
+				break;
+			case '<':
+				g_string_append(string, "&lt;");
+				break;
+			case '>':
+				g_string_append(string, "&gt;");
+				break;
+			case '\'':
+				g_string_append(string, "&#39;");
+				break;
+			case '"':
+				g_string_append(string, "&quot;");
+				break;
+			default:
+				if((c >= 0x1 && c < 0x20) || c == 0x7f)
+					g_string_append_printf(string, "&#x%x;", c);
+				else if(c == 0xc2 && text + 1 < end && (guchar)text[1] >= 0x80 && (guchar)text[1] <= 0x9f)
+					/* C1 control characters, U+0080 to U+009F */
+					g_string_append_printf(string, "&#x%x;", (guchar)*++text);
+				else
+					g_string_append_c(string, c);
+		}
+	}
+}
 
-	char **words = g_strsplit_set(string, " \n\r\t", -1);
-	char **word;
-	ssize_t count;
-	GString *result = g_string_new("");
+/*
+ * make_pango_markup_string_indices:
+ * @string: a text
+ * @diffs: indices of words in @string to highlight, in ascending order, as
+ * returned by word_diff_indices()
+ * @n_diffs: length of @diffs
+ *
+ * Returns: (transfer full): @string as Pango markup, with the words in @diffs
+ * underlined.
+ */
+char *
+make_pango_markup_string_indices(const char *string, const guint *diffs, guint n_diffs)
+{
+	GString *result = g_string_sized_new(strlen(string) + 7 * n_diffs + 16);
+	const char *ptr = string;
+	guint count = 0, next_diff = 0;
 
-	for(word = words, count = 0; *word; word++, count++) {
+	while(*ptr != '\0') {
 		/* Copy whitespace */
-		while(isspace(*string))
-			g_string_append_c(result, *string++);
+		const char *word = ptr;
+		while(IS_WORD_SEPARATOR(*ptr))
+			ptr++;
+		g_string_append_len(result, word, ptr - word);
+		if(*ptr == '\0')
+			break;
 
-		char *escaped_word = g_markup_escape_text(*word, -1);
+		word = ptr;
+		while(*ptr != '\0' && !IS_WORD_SEPARATOR(*ptr))
+			ptr++;
 
-		if(diffs && count == (ssize_t)(GPOINTER_TO_SIZE(diffs->data))) {
-			diffs = g_list_next(diffs);
-			g_string_append_printf(result, "<u>%s</u>", escaped_word);
+		if(next_diff < n_diffs && diffs[next_diff] == count) {
+			next_diff++;
+			g_string_append(result, "<u>");
+			append_escaped(result, word, ptr - word);
+			g_string_append(result, "</u>");
 		} else {
-			g_string_append(result, escaped_word);
+			append_escaped(result, word, ptr - word);
 		}
+		count++;
+	}
 
-		g_free(escaped_word);
+	return g_string_free(result, FALSE); /* return C-string */
+}
 
-		string += strlen(*word);
+/* Converts a list of indices stored using GSIZE_TO_POINTER() to an array */
+static GArray *
+array_from_list(GList *list)
+{
+	GArray *array = g_array_new(FALSE, FALSE, sizeof(guint));
+	for(; list; list = g_list_next(list)) {
+		guint index = GPOINTER_TO_SIZE(list->data);
+		g_array_append_val(array, index);
 	}
+	return array;
+}
 
-	g_strfreev(words);
+static GList *
+list_from_array(GArray *array)
+{
+	GList *list = NULL;
+	guint ix;
+	for(ix = array->len; ix > 0; ix--)
+		list = g_list_prepend(list, GSIZE_TO_POINTER(g_array_index(array, guint, ix - 1)));
+	return list;
+}
 
-	/* Copy final whitespace */
-	while(isspace(*string))
-		g_string_append_c(result, *string++);
+/*
+ * word_diff:
+ * Compares strings @expected and @actual for approximate equality. Returns TRUE
+ * if they are _exactly_ equal, FALSE if not. @expected_diffs and @actual_diffs
+ * are the return locations for lists of word indices that are different in
+ * @expected and @actual. The indices are stored using GSIZE_TO_POINTER().
+ * If the function returns FALSE but NULL (the empty list) is returned in
+ * @expected_diffs and @actual_diffs, then all the words are the same and
+ * therefore the strings only differ by whitespace.
+ * You should free the lists when done.
+ *
+ * This is a wrapper around word_diff_indices(), which should be preferred.
+ */
+gboolean
+word_diff(const char *expected, const char *actual, GList **expected_diffs, GList **actual_diffs)
+{
+	GArray *expected_array = g_array_new(FALSE, FALSE, sizeof(guint));
+	GArray *actual_array = g_array_new(FALSE, FALSE, sizeof(guint));
 
-	return g_string_free(result, FALSE); /* return C-string */
-}
\ No newline at end of file
+	gboolean retval = word_diff_indices(expected, actual, expected_array, actual_array);
+	*expected_diffs = list_from_array(expected_array);
+	*actual_diffs = list_from_array(actual_array);
+
+	g_array_free(expected_array, TRUE);
+	g_array_free(actual_array, TRUE);
+	return retval;
+}
+
+/* Wrapper around make_pango_markup_string_indices() for lists of indices
+returned by word_diff() */
+char *
+make_pango_markup_string(const char *string, GList *diffs)
+{
+	if(diffs == NULL)
+		return g_strdup(string);
+
+	GArray *array = array_from_list(diffs);
+	char *retval = make_pango_markup_string_indices(string, (const guint *)array->data, array->len);
+	g_array_free(array, TRUE);
+	return retval;
+}
@@ -19,5 +19,7 @@
 
 #include <glib.h>
 
+gboolean word_diff_indices(const char *expected, const char *actual, GArray *expected_diffs, GArray *actual_diffs);
+char *make_pango_markup_string_indices(const char *string, const guint *diffs, guint n_diffs);
 gboolean word_diff(const char *expected, const char *actual, GList **expected_diffs, GList **actual_diffs);
 char *make_pango_markup_string(const char *string, GList *diffs);
@@ -27,6 +27,7 @@
 #include <gtk/gtk.h>
 #include <pango/pango.h>
 
+#include "text-extents.h"
 #include "transcript-renderer.h"
 
 typedef enum  {
@@ -47,7 +48,8 @@ typedef enum {
 	CANT_COMPARE = -1,
 	NO_MATCH,
 	NEAR_MATCH,
-	EXACT_MATCH
+	EXACT_MATCH,
+	DIFF_PENDING
 } I7TranscriptMatchType; /* copy of I7NodeMatchType */
 
 typedef struct {
@@ -231,30 +233,18 @@ i7_cell_renderer_transcript_get_size(GtkCellRenderer *self, GtkWidget *widget, G
 	I7_CELL_RENDERER_TRANSCRIPT_USE_PRIVATE;
 
 	PangoRectangle command_rect, transcript_rect, expected_rect;
-	PangoLayout *layout;
+	PangoContext *context = gtk_widget_get_pango_context(widget);
 	unsigned xpad, ypad, transcript_width, calc_width, calc_height;
 	
 	g_object_get(self, "xpad", &xpad, "ypad", &ypad, NULL);
 	transcript_width = (priv->default_width / 2) - xpad;
+	int wrap_width = (int)(transcript_width - priv->text_padding * 2) * PANGO_SCALE;
 
-	/* Get size of command */
-	layout = gtk_widget_create_pango_layout(widget, priv->command);
-	pango_layout_get_pixel_extents(layout, NULL, &command_rect);
-	g_object_unref(layout);
-
-	/* Get size of transcript text */
-	layout = gtk_widget_create_pango_layout(widget, priv->transcript_text);
-	pango_layout_set_width(layout, (int)(transcript_width - priv->text_padding * 2) * PANGO_SCALE);
-	pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-	pango_layout_get_pixel_extents(layout, NULL, &transcript_rect);
-	g_object_unref(layout);
-
-	/* Get size of expected text */
-	layout = gtk_widget_create_pango_layout(widget, priv->expected_text);
-	pango_layout_set_width(layout, (int)(transcript_width - priv->text_padding * 2) * PANGO_SCALE);
-	pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-	pango_layout_get_pixel_extents(layout, NULL, &expected_rect);
-	g_object_unref (layout);
+	/* Get sizes of command, transcript text and expected text; these are
+	 asked for over and over while scrolling, so they are cached */
+	i7_text_extents_get(context, priv->command, FALSE, -1, &command_rect);
+	i7_text_extents_get(context, priv->transcript_text, FALSE, wrap_width, &transcript_rect);
+	i7_text_extents_get(context, priv->expected_text, FALSE, wrap_width, &expected_rect);
 
 	/* Calculate the required width and height for the cell */
 	calc_width = priv->default_width;
@@ -362,6 +352,7 @@ i7_cell_renderer_transcript_render(GtkCellRenderer *self, GdkWindow *window, Gtk
 	/* Draw the expected text */
 	switch(priv->match_type) {
 		case CANT_COMPARE:
+		case DIFF_PENDING:
 			set_rgb_style(cr, STYLE_NO_EXPECTED);
 			break;
 		case NO_MATCH:
@@ -456,8 +447,8 @@ i7_cell_renderer_transcript_class_init(I7CellRendererTranscriptClass *klass)
 			NULL, G_PARAM_READWRITE | flags));
 	g_object_class_install_property(object_class, PROP_MATCH_TYPE,
 	    g_param_spec_int("match-type", "Match type",
-		    "-1 = no comparison, 0 = no match, 1 = near match, 2 = exact match",
-		    -1, 2, -1, G_PARAM_READWRITE | flags));
+		    "-1 = no comparison, 0 = no match, 1 = near match, 2 = exact match, 3 = not compared yet",
+		    -1, 3, -1, G_PARAM_READWRITE | flags));
 	g_object_class_install_property(object_class, PROP_CURRENT,
 	    g_param_spec_boolean("current", "Current",
 		    "Whether to render the node as the currently highlighted node",